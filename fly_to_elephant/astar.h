@@ -0,0 +1,466 @@
+#ifndef ASTAR_H
+#define ASTAR_H
+
+#include "dijkstra.h"
+#include "words_graph.h"
+#include <vector>
+#include <set>
+#include <queue>
+#include <limits>
+#include <fstream>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+// Precomputed BFS distances from a few landmark nodes (ALT heuristic).
+// For any landmark L and nodes v, t: d(v, t) >= |d(L, t) - d(L, v)| (triangle inequality),
+// so the maximum over all landmarks is an admissible and consistent lower bound for A*.
+template <typename Graph>
+class Landmarks
+{
+public:
+	typedef typename Graph::NodeIndex NodeIndex;
+	typedef uint16_t				  Distance;
+
+	static const Distance Unreachable = std::numeric_limits<Distance>::max();
+
+	Landmarks() : m_nodesCount(0)
+	{
+	}
+
+	// Selects up to 'count' landmarks. Landmark gives bounds only inside its own connected component,
+	// so landmarks are shared between components by size (D'Hondt: next one goes to the component with
+	// the largest size / (landmarks + 1)), singletons never get one. Inside a component landmarks are
+	// chosen by farthest-point heuristic: the first is the node most distant from an arbitrary one,
+	// every next is the node most distant from already selected ones.
+	void Build(const Graph& graph, size_t count)
+	{
+		m_nodesCount = graph.GetSize();
+		m_fingerprint = GetFingerprint(graph);
+		m_landmarks.clear();
+		m_distances.clear();
+		if (m_nodesCount == 0 || count == 0)
+			return;
+
+		std::vector<size_t> componentIds;
+		std::vector<size_t> componentSizes;
+		GetComponents(graph, componentIds, componentSizes);
+		std::vector<size_t> componentLandmarks(componentSizes.size(), 0);
+
+		// Distance from every node to the closest landmark of its component
+		std::vector<Distance> closest(m_nodesCount, Unreachable);
+		std::vector<Distance> distances;
+		std::vector<std::vector<Distance>> columns;
+
+		while (m_landmarks.size() < count)
+		{
+			size_t component = NoComponent;
+			for (size_t c = 0; c < componentSizes.size(); ++c)
+			{
+				if (componentSizes[c] <= std::max<size_t>(1, componentLandmarks[c]))
+					continue;
+				if (component == NoComponent ||
+					componentSizes[c] * (componentLandmarks[component] + 1) > componentSizes[component] * (componentLandmarks[c] + 1))
+				{
+					component = c;
+				}
+			}
+			if (component == NoComponent)
+				break;
+
+			if (componentLandmarks[component] == 0)
+			{
+				// Any node of the component, the first landmark is the farthest from it
+				NodeIndex start = std::find(componentIds.begin(), componentIds.end(), component) - componentIds.begin();
+				Bfs(graph, start, distances);
+				for (NodeIndex v = 0; v < m_nodesCount; ++v)
+				{
+					if (componentIds[v] == component)
+						closest[v] = distances[v];
+				}
+			}
+
+			NodeIndex next = 0;
+			for (NodeIndex v = 0; v < m_nodesCount; ++v)
+			{
+				if (componentIds[v] == component && (componentIds[next] != component || closest[v] > closest[next]))
+					next = v;
+			}
+
+			// All nodes are landmarks already
+			if (closest[next] == 0)
+			{
+				componentSizes[component] = 0;
+				continue;
+			}
+
+			m_landmarks.push_back(next);
+			componentLandmarks[component]++;
+			Bfs(graph, next, distances);
+			for (NodeIndex v = 0; v < m_nodesCount; ++v)
+			{
+				if (componentIds[v] == component)
+					closest[v] = std::min(closest[v], distances[v]);
+			}
+			columns.push_back(distances);
+		}
+
+		m_distances.resize(m_nodesCount * m_landmarks.size());
+		for (NodeIndex v = 0; v < m_nodesCount; ++v)
+		{
+			for (size_t i = 0; i < columns.size(); ++i)
+				m_distances[v * columns.size() + i] = columns[i][v];
+		}
+	}
+
+	// Lower bound of distance between nodes, Unreachable if nodes are in different components
+	Distance GetLowerBound(NodeIndex from, NodeIndex to) const
+	{
+		const size_t count = m_landmarks.size();
+		if (count == 0)
+			return 0;
+
+		const Distance* fromRow = &m_distances[from * count];
+		const Distance* toRow = &m_distances[to * count];
+		Distance bound = 0;
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			// Landmark sees only one of the nodes: they are not connected
+			if ((fromRow[i] == Unreachable) != (toRow[i] == Unreachable))
+				return Unreachable;
+
+			if (fromRow[i] == Unreachable)
+				continue;
+
+			Distance diff = fromRow[i] > toRow[i] ? fromRow[i] - toRow[i] : toRow[i] - fromRow[i];
+			bound = std::max(bound, diff);
+		}
+		return bound;
+	}
+
+	size_t GetCount() const
+	{
+		return m_landmarks.size();
+	}
+
+	NodeIndex GetLandmark(size_t i) const
+	{
+		return m_landmarks[i];
+	}
+
+	bool IsBuiltFor(const Graph& graph) const
+	{
+		return m_nodesCount == graph.GetSize() && !m_landmarks.empty() && m_fingerprint == GetFingerprint(graph);
+	}
+
+	// FNV-1a of all words and edges: tables of graphs with other words or edges have other fingerprints
+	static uint64_t GetFingerprint(const Graph& graph)
+	{
+		uint64_t hash = 14695981039346656037ULL;
+		auto mix = [&hash](uint64_t value)
+		{
+			hash ^= value;
+			hash *= 1099511628211ULL;
+		};
+
+		mix(graph.GetSize());
+		for (NodeIndex v = 0; v < graph.GetSize(); ++v)
+		{
+			auto word = graph.GetNodeView(v);
+			mix(word.length());
+			for (size_t i = 0; i < word.length(); ++i)
+				mix(static_cast<uint64_t>(word[i]));
+
+			const auto& edges = graph.GetEdges(v);
+			mix(edges.size());
+			for (NodeIndex to : edges)
+				mix(to);
+		}
+		return hash;
+	}
+
+	// Binary format: magic, nodes count, graph fingerprint, landmarks count, landmark indexes, distances table
+	bool Save(const std::string& filePath) const
+	{
+		std::ofstream file(filePath, std::ios::binary);
+		if (!file)
+			return false;
+
+		uint64_t nodesCount = m_nodesCount, landmarksCount = m_landmarks.size();
+		file.write(Magic, sizeof(Magic));
+		file.write(reinterpret_cast<const char*>(&nodesCount), sizeof(nodesCount));
+		file.write(reinterpret_cast<const char*>(&m_fingerprint), sizeof(m_fingerprint));
+		file.write(reinterpret_cast<const char*>(&landmarksCount), sizeof(landmarksCount));
+		for (NodeIndex landmark : m_landmarks)
+		{
+			uint64_t index = landmark;
+			file.write(reinterpret_cast<const char*>(&index), sizeof(index));
+		}
+		file.write(reinterpret_cast<const char*>(m_distances.data()), m_distances.size() * sizeof(Distance));
+		return static_cast<bool>(file);
+	}
+
+	// Fails if file is broken or was built for another graph (other words or edges)
+	bool Load(const std::string& filePath, const Graph& graph)
+	{
+		std::ifstream file(filePath, std::ios::binary | std::ios::ate);
+		const uint64_t fileSize = file ? static_cast<uint64_t>(file.tellg()) : 0;
+		file.seekg(0);
+
+		char magic[sizeof(Magic)];
+		uint64_t nodesCount = 0, fingerprint = 0, landmarksCount = 0;
+
+		file.read(magic, sizeof(magic));
+		file.read(reinterpret_cast<char*>(&nodesCount), sizeof(nodesCount));
+		file.read(reinterpret_cast<char*>(&fingerprint), sizeof(fingerprint));
+		file.read(reinterpret_cast<char*>(&landmarksCount), sizeof(landmarksCount));
+		if (!file || std::memcmp(magic, Magic, sizeof(Magic)) != 0 || nodesCount != graph.GetSize())
+			return false;
+
+		// Sizes are checked before anything is allocated from them
+		const uint64_t headerSize = sizeof(Magic) + 3 * sizeof(uint64_t);
+		if (landmarksCount > MaxCount || landmarksCount > nodesCount ||
+			fileSize != headerSize + landmarksCount * (sizeof(uint64_t) + nodesCount * sizeof(Distance)))
+		{
+			return false;
+		}
+
+		if (fingerprint != GetFingerprint(graph))
+			return false;
+
+		std::vector<NodeIndex> landmarks;
+		for (uint64_t i = 0; i < landmarksCount; ++i)
+		{
+			uint64_t index = 0;
+			file.read(reinterpret_cast<char*>(&index), sizeof(index));
+			if (!file || index >= nodesCount)
+				return false;
+			landmarks.push_back(index);
+		}
+
+		std::vector<Distance> distances(nodesCount * landmarksCount);
+		file.read(reinterpret_cast<char*>(distances.data()), distances.size() * sizeof(Distance));
+		if (!file)
+			return false;
+
+		m_nodesCount = nodesCount;
+		m_fingerprint = fingerprint;
+		m_landmarks.swap(landmarks);
+		m_distances.swap(distances);
+		return true;
+	}
+
+	// Upper limit of landmarks in a file, real tables have a few
+	static const size_t MaxCount = 256;
+
+private:
+	static constexpr char Magic[4] = { 'A', 'L', 'T', '2' };
+	static const size_t NoComponent = std::numeric_limits<size_t>::max();
+
+	// Labels of the graph if they are built, otherwise labelled here by BFS.
+	// Removed nodes get NoComponent.
+	static void GetComponents(const Graph& graph, std::vector<size_t>& ids, std::vector<size_t>& sizes)
+	{
+		const size_t nodesCount = graph.GetSize();
+		ids.assign(nodesCount, NoComponent);
+		sizes.clear();
+
+		if (graph.HasComponents())
+		{
+			sizes.resize(graph.GetComponentIdsBound());
+			for (NodeIndex v = 0; v < nodesCount; ++v)
+			{
+				if (graph.IsRemoved(v))
+					continue;
+				ids[v] = graph.GetComponentId(v);
+				sizes[ids[v]]++;
+			}
+			return;
+		}
+
+		std::vector<NodeIndex> stack;
+		for (NodeIndex root = 0; root < nodesCount; ++root)
+		{
+			if (ids[root] != NoComponent || graph.IsRemoved(root))
+				continue;
+
+			const size_t id = sizes.size();
+			sizes.push_back(1);
+			ids[root] = id;
+			stack.push_back(root);
+			while (!stack.empty())
+			{
+				NodeIndex v = stack.back();
+				stack.pop_back();
+				for (NodeIndex to : graph.GetEdges(v))
+				{
+					if (ids[to] == NoComponent)
+					{
+						ids[to] = id;
+						sizes[id]++;
+						stack.push_back(to);
+					}
+				}
+			}
+		}
+	}
+
+	static void Bfs(const Graph& graph, NodeIndex start, std::vector<Distance>& distances)
+	{
+		distances.assign(graph.GetSize(), Unreachable);
+		distances[start] = 0;
+
+		std::queue<NodeIndex> q;
+		q.push(start);
+		typename Graph::Edges edges;
+
+		while (!q.empty())
+		{
+			NodeIndex v = q.front();
+			q.pop();
+
+			graph.GetEdges(v, edges);
+			for (NodeIndex to : edges)
+			{
+				if (distances[to] == Unreachable)
+				{
+					distances[to] = distances[v] + 1;
+					q.push(to);
+				}
+			}
+		}
+	}
+
+	std::vector<NodeIndex> m_landmarks;
+
+	// Row per node: distances from the node to every landmark, so one lookup touches one cache line
+	std::vector<Distance>  m_distances;
+	size_t				   m_nodesCount;
+	uint64_t			   m_fingerprint = 0;
+};
+
+template <typename Graph>
+const typename Landmarks<Graph>::Distance Landmarks<Graph>::Unreachable;
+
+template <typename Graph>
+const size_t Landmarks<Graph>::MaxCount;
+
+template <typename Graph>
+const size_t Landmarks<Graph>::NoComponent;
+
+template <typename Graph>
+constexpr char Landmarks<Graph>::Magic[4];
+
+// Number of positions where equal length words differ.
+// Every edge changes one letter, so it is a lower bound of ladder length too.
+template <typename W>
+size_t HammingDistance(const W& w1, const W& w2)
+{
+	size_t distance = 0;
+	for (size_t i = 0; i < w1.length(); ++i)
+		distance += w1[i] != w2[i];
+	return distance;
+}
+
+// A* search with the heuristic max(landmarks bound, hamming distance to end word).
+// In graphs built by CreateEditDistanceEdges letters can be inserted and deleted, hamming distance
+// is not a lower bound there, so pass substitutionsOnly = false to use difference of lengths instead.
+// All these bounds are consistent and edges cost 1, so the estimate of a neighbour is in [f, f + 2]
+// and bucket queue of the context works here just like in Dijkstra.
+template <typename Graph, typename IndexType>
+std::vector<IndexType> AStar(const Graph& graph, const Landmarks<Graph>& landmarks, IndexType start, IndexType end,
+	SearchContext<IndexType>& context, bool substitutionsOnly = true, SearchStats* stats = nullptr)
+{
+	typedef typename SearchContext<IndexType>::Distance Distance;
+	const Distance Infinity = SearchContext<IndexType>::Infinity;
+	const Distance EdgeWeight = 1;
+
+	if (!graph.IsReachable(start, end))
+		return std::vector<IndexType>();
+
+	const auto endWord = graph.GetNodeView(end);
+	auto heuristic = [&](IndexType v) -> Distance
+	{
+		Distance bound = 0;
+		if (landmarks.GetCount() != 0)
+		{
+			auto landmarksBound = landmarks.GetLowerBound(v, end);
+			if (landmarksBound == Landmarks<Graph>::Unreachable)
+				return Infinity;
+			bound = landmarksBound;
+		}
+		auto word = graph.GetNodeView(v);
+		if (!substitutionsOnly || word.length() != endWord.length())
+		{
+			size_t lengthDifference = word.length() > endWord.length() ?
+				word.length() - endWord.length() : endWord.length() - word.length();
+			return std::max<Distance>(bound, lengthDifference);
+		}
+		return std::max<Distance>(bound, HammingDistance(word, endWord));
+	};
+
+	Distance h = heuristic(start);
+	if (h == Infinity)
+		return std::vector<IndexType>();
+
+	// Ordered by estimated full path length: d[v] + heuristic(v)
+	context.Reset(graph.GetSize(), 2 * EdgeWeight, h);
+	context.SetDistance(start, 0, start);
+	auto& q = context.GetQueue();
+	q.Push(h, start);
+
+	Distance estimate;
+	IndexType v;
+	while (q.Pop(estimate, v))
+	{
+		// Outdated element, node was already expanded from a better one
+		if (context.IsClosed(v))
+			continue;
+
+		if (v == end)
+			break;
+		context.Close(v);
+
+		const auto& edges = graph.GetEdges(v);
+		if (stats != nullptr)
+		{
+			stats->visitedNodes++;
+			stats->scannedEdges += edges.size();
+		}
+
+		Distance distance = context.GetDistance(v);
+		for (IndexType to : edges)
+		{
+			if (context.IsClosed(to) || distance + EdgeWeight >= context.GetDistance(to))
+				continue;
+
+			h = heuristic(to);
+			if (h == Infinity)
+				continue;
+
+			context.SetDistance(to, distance + EdgeWeight, v);
+			q.Push(distance + EdgeWeight + h, to);
+		}
+	}
+
+	return context.RestorePath(start, end);
+}
+
+template <typename Graph, typename IndexType = typename Graph::NodeIndex>
+std::vector<IndexType> AStar(const Graph& graph, const Landmarks<Graph>& landmarks, IndexType start, IndexType end,
+	bool substitutionsOnly = true, SearchStats* stats = nullptr)
+{
+	SearchContext<IndexType> context;
+	return AStar(graph, landmarks, start, end, context, substitutionsOnly, stats);
+}
+
+// Same as FindShortestPath, but uses A* with precomputed landmarks
+template <typename W>
+std::vector<W> FindShortestPath(const WordsGraph<W>& graph, const Landmarks<WordsGraph<W>>& landmarks, const W& from, const W& to)
+{
+	auto pathIndexes = AStar(graph, landmarks, graph.GetNodeIndex(from), graph.GetNodeIndex(to));
+	return graph.ConvertIndexesToWords(pathIndexes);
+}
+
+#endif // ASTAR_H
@@ -0,0 +1,129 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "helpers.h"
+#include "parallel.h"
+#include "astar.h"
+#include <map>
+#include <vector>
+#include <istream>
+#include <iostream>
+#include <sstream>
+
+// Landmarks pay off only when there are enough queries against the same graph
+const size_t LandmarksMinQueries = 64;
+const size_t LandmarksCount = 8;
+
+// One ladder request: find path from 'from' to 'to'
+template <typename W>
+struct Query
+{
+	W from;
+	W to;
+};
+
+// Reads queries, one per line: "from to". Empty lines are skipped.
+template <typename W>
+void ReadQueries(std::basic_istream<typename W::value_type>& stream, std::vector<Query<W>>& queries)
+{
+	W line;
+
+	while (std::getline(stream, line))
+	{
+		std::basic_istringstream<typename W::value_type> lineStream(line);
+		Query<W> query;
+		if (!(lineStream >> query.from >> query.to))
+			continue;
+
+		// Same case folding as dictionary loader
+		ToLower(query.from);
+		ToLower(query.to);
+		queries.push_back(query);
+	}
+}
+
+// Cache file of landmarks for graph of words of one length: <dictionary file name>.<length>.alt in the directory
+inline std::string GetLandmarksCachePath(const std::string& directory, const std::string& dictionaryPath, size_t wordLength)
+{
+	const size_t separator = dictionaryPath.find_last_of("/\\");
+	const std::string fileName = separator == std::string::npos ? dictionaryPath : dictionaryPath.substr(separator + 1);
+	return directory + "/" + fileName + "." + std::to_string(wordLength) + ".alt";
+}
+
+// Loads landmarks from the cache file or builds and saves them. Table of another graph
+// (dictionary was changed since it was saved) is rejected by Load and rebuilt.
+// Returns false if landmarks were built, but couldn't be saved.
+template <typename Graph>
+bool LoadOrBuildLandmarks(const std::string& cachePath, const Graph& graph, Landmarks<Graph>& landmarks,
+	size_t count = LandmarksCount)
+{
+	if (landmarks.Load(cachePath, graph))
+		return true;
+
+	landmarks.Build(graph, count);
+	return landmarks.Save(cachePath);
+}
+
+// Answers all queries against one dictionary.
+// Queries are grouped by word length, graph for every length is built only once
+// and then shared between worker threads (graph is not modified during search).
+// Result paths are in the same order as queries, empty path means there is no ladder.
+// With landmarksDirectory landmarks are saved there and reused by the next batches,
+// a failed save is reported to stderr and the batch goes on.
+template <typename W>
+std::vector<std::vector<W>> SolveBatch(const std::string& dictionaryPath, const std::vector<Query<W>>& queries,
+	size_t threadsCount = GetDefaultThreadsCount(), const std::string& landmarksDirectory = std::string())
+{
+	typedef WordsGraph<W> Graph;
+	std::vector<std::vector<W>> results(queries.size());
+
+	// Query indexes grouped by word length
+	std::map<size_t, std::vector<size_t>> groups;
+	for (size_t i = 0; i < queries.size(); ++i)
+	{
+		if (queries[i].from.length() == queries[i].to.length())
+			groups[queries[i].from.length()].push_back(i);
+	}
+
+	for (const auto& group : groups)
+	{
+		Graph graph;
+		ReadWordsFromFile(dictionaryPath, group.first, graph);
+		CreateEdges(graph);
+
+		const auto& indexes = group.second;
+		Landmarks<Graph> landmarks;
+		if (indexes.size() >= LandmarksMinQueries)
+		{
+			if (!landmarksDirectory.empty())
+			{
+				const std::string cachePath = GetLandmarksCachePath(landmarksDirectory, dictionaryPath, group.first);
+				if (!LoadOrBuildLandmarks(cachePath, graph, landmarks))
+					std::cerr << "Can't save landmarks to " << cachePath << std::endl;
+			}
+			else
+			{
+				landmarks.Build(graph, LandmarksCount);
+			}
+		}
+
+		ParallelFor(indexes.size(), threadsCount, [&](size_t i)
+		{
+			const Query<W>& query = queries[indexes[i]];
+			typename Graph::NodeIndex from, to;
+			if (!graph.FindNodeIndex(query.from, from) || !graph.FindNodeIndex(query.to, to))
+				return;
+
+			// Every worker keeps its search arrays between queries and graphs of different lengths
+			thread_local SearchContext<typename Graph::NodeIndex> context;
+			if (landmarks.GetCount() != 0)
+				results[indexes[i]] = graph.ConvertIndexesToWords(AStar(graph, landmarks, from, to, context));
+			else
+				results[indexes[i]] = graph.ConvertIndexesToWords(Dijkstra(graph, from, to, UnitWeight(), context));
+		});
+	}
+
+	return results;
+}
+
+#endif // BATCH_H
@@ -0,0 +1,82 @@
+#ifndef BUCKET_QUEUE_H
+#define BUCKET_QUEUE_H
+
+#include <vector>
+#include <utility>
+#include <stdexcept>
+#include <cstdint>
+
+// Monotone priority queue for small integer weights (Dial's algorithm).
+// When every pushed distance is in [current, current + maxWeight] a circular array of
+// maxWeight + 1 buckets is enough: bucket d % size holds only elements with distance d.
+// There is no decrease-key, outdated elements are skipped by the caller.
+template <typename IndexType, typename DistanceType = uint32_t>
+class BucketQueue
+{
+public:
+	explicit BucketQueue(DistanceType maxWeight)
+		: m_buckets(static_cast<size_t>(maxWeight) + 1), m_maxWeight(maxWeight), m_current(0), m_size(0)
+	{
+	}
+
+	void Push(DistanceType distance, IndexType index)
+	{
+		if (distance < m_current || distance - m_current > m_maxWeight)
+			throw std::runtime_error("Bucket queue: distance is out of monotone window");
+
+		m_buckets[distance % m_buckets.size()].push_back(index);
+		m_size++;
+	}
+
+	// Takes any element with the smallest distance
+	bool Pop(DistanceType& distance, IndexType& index)
+	{
+		if (m_size == 0)
+			return false;
+
+		for (;;)
+		{
+			auto& bucket = m_buckets[m_current % m_buckets.size()];
+			if (!bucket.empty())
+			{
+				index = bucket.back();
+				bucket.pop_back();
+				distance = m_current;
+				m_size--;
+				return true;
+			}
+			m_current++;
+		}
+	}
+
+	bool Empty() const
+	{
+		return m_size == 0;
+	}
+
+	void Clear()
+	{
+		for (auto& bucket : m_buckets)
+			bucket.clear();
+		m_current = 0;
+		m_size = 0;
+	}
+
+	// Clears queue for another weights range and the first distance to push,
+	// allocated buckets are kept
+	void Reset(DistanceType maxWeight, DistanceType minDistance = 0)
+	{
+		Clear();
+		m_buckets.resize(static_cast<size_t>(maxWeight) + 1);
+		m_maxWeight = maxWeight;
+		m_current = minDistance;
+	}
+
+private:
+	std::vector<std::vector<IndexType>> m_buckets;
+	DistanceType						m_maxWeight;
+	DistanceType						m_current;
+	size_t								m_size;
+};
+
+#endif // BUCKET_QUEUE_H
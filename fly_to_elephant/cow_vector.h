@@ -0,0 +1,100 @@
+#ifndef COW_VECTOR_H
+#define COW_VECTOR_H
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cstddef>
+
+// Vector split into fixed size chunks which are shared between copies and copied on write.
+// Copy of the whole vector costs O(size / ChunkSize), changing an element of a shared chunk
+// copies only this chunk. Used to keep snapshots of a graph without copying unchanged parts.
+//
+// Mutable can be called concurrently for elements of different chunks, or for any elements
+// while chunks are not shared with other copies.
+template <typename T, size_t ChunkBits = 6>
+class CowVector
+{
+public:
+	typedef std::vector<T>						 Chunk;
+	typedef typename Chunk::const_reference		 ConstReference;
+	typedef typename Chunk::reference			 Reference;
+
+	static const size_t ChunkSize = size_t(1) << ChunkBits;
+
+	CowVector() : m_size(0)
+	{
+	}
+
+	size_t size() const
+	{
+		return m_size;
+	}
+
+	bool empty() const
+	{
+		return m_size == 0;
+	}
+
+	ConstReference operator[](size_t i) const
+	{
+		return (*m_chunks[i >> ChunkBits])[i & (ChunkSize - 1)];
+	}
+
+	// Element for writing, its chunk is copied first if another vector shares it
+	Reference Mutable(size_t i)
+	{
+		return GetMutableChunk(i >> ChunkBits)[i & (ChunkSize - 1)];
+	}
+
+	void push_back(const T& value)
+	{
+		if (m_size % ChunkSize == 0)
+		{
+			m_chunks.push_back(std::make_shared<Chunk>());
+			m_chunks.back()->reserve(ChunkSize);
+		}
+		GetMutableChunk(m_chunks.size() - 1).push_back(value);
+		m_size++;
+	}
+
+	void assign(size_t size, const T& value)
+	{
+		m_chunks.clear();
+		for (size_t begin = 0; begin < size; begin += ChunkSize)
+			m_chunks.push_back(std::make_shared<Chunk>(std::min(ChunkSize, size - begin), value));
+		m_size = size;
+	}
+
+	void clear()
+	{
+		m_chunks.clear();
+		m_size = 0;
+	}
+
+	// Heap memory of all chunks (shared ones too)
+	size_t GetMemoryUsage() const
+	{
+		return m_chunks.capacity() * sizeof(ChunkPtr) + m_chunks.size() * (sizeof(Chunk) + ChunkSize * sizeof(T));
+	}
+
+private:
+	typedef std::shared_ptr<Chunk> ChunkPtr;
+
+	Chunk& GetMutableChunk(size_t index)
+	{
+		// Only the writer copies vectors, so a chunk used once can't become shared meanwhile
+		ChunkPtr& chunk = m_chunks[index];
+		if (chunk.use_count() > 1)
+			chunk = std::make_shared<Chunk>(*chunk);
+		return *chunk;
+	}
+
+	std::vector<ChunkPtr> m_chunks;
+	size_t				  m_size;
+};
+
+template <typename T, size_t ChunkBits>
+const size_t CowVector<T, ChunkBits>::ChunkSize;
+
+#endif // COW_VECTOR_H
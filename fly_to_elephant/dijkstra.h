@@ -2,62 +2,110 @@
 #define DIJKSTRA_H
 
 #include <algorithm>
+#include <limits>
+#include <vector>
+#include <set>
+#include <cstdint>
+#include "search_context.h"
 
 // Restore path from array of indexes
 template<typename IndexType>
 void RestorePath(std::vector<IndexType>& p, IndexType from, IndexType to)
 {
 	std::vector<IndexType> path;
-	for (int v = to; v != from; v = p[v])
+	for (IndexType v = to; v != from; v = p[v])
 		path.push_back(v);
 	path.push_back(from);
 	std::reverse(path.begin(), path.end());
 	p.swap(path);
 }
 
-template <typename Graph, typename IndexType = typename Graph::NodeIndex, typename EdgeType = typename Graph::Edges>
-std::vector<IndexType> Dijkstra(const Graph& graph, IndexType start, IndexType end)
+// Counters of one search, filled if caller asks for them
+struct SearchStats
+{
+	size_t visitedNodes = 0;
+	size_t scannedEdges = 0;
+};
+
+// Every step costs the same
+struct UnitWeight
+{
+	uint32_t GetMaxWeight() const
+	{
+		return 1;
+	}
+
+	template <typename IndexType>
+	uint32_t operator()(IndexType, IndexType) const
+	{
+		return 1;
+	}
+};
+
+// Dijkstra with integer edge weights: weight(from, to) in [0, weight.GetMaxWeight()].
+// Weights are small, so bucket queue is used instead of a balanced tree.
+// Context keeps arrays and queue between calls, so repeated searches don't allocate.
+template <typename Graph, typename Weight, typename IndexType>
+std::vector<IndexType> Dijkstra(const Graph& graph, IndexType start, IndexType end, const Weight& weight,
+	SearchContext<IndexType>& context, SearchStats* stats = nullptr)
 {
-	const IndexType Infinity = std::numeric_limits<IndexType>::max();
-	const unsigned int EdgeWeight = 1;
+	typedef typename SearchContext<IndexType>::Distance Distance;
+
+	// Nodes are in different components, no need to walk through the whole component of start
+	if (!graph.IsReachable(start, end))
+		return std::vector<IndexType>();
 
-	std::vector<IndexType> d(graph.GetSize(), Infinity), path(graph.GetSize());
-	d[start] = 0;
-	std::set<std::pair<IndexType, IndexType> > q;
-	q.insert(std::make_pair(d[start], start));
+	context.Reset(graph.GetSize(), weight.GetMaxWeight());
+	context.SetDistance(start, 0, start);
 
-	while (!q.empty())
+	auto& q = context.GetQueue();
+	q.Push(0, start);
+
+	Distance distance;
+	IndexType v;
+	while (q.Pop(distance, v))
 	{
-		IndexType v = q.begin()->second;
-		q.erase(q.begin());
+		// Outdated element, node was already reached with a smaller distance
+		if (distance != context.GetDistance(v))
+			continue;
 
-		EdgeType edges;
-		graph.GetEdges(v, edges);
+		// Distance of the end node is final
+		if (v == end)
+			break;
 
-		for (auto edge = edges.begin(); edge != edges.end(); edge++)
+		const auto& edges = graph.GetEdges(v);
+		if (stats != nullptr)
 		{
-			IndexType to = *edge;
-			if (d[v] + EdgeWeight < d[to])
+			stats->visitedNodes++;
+			stats->scannedEdges += edges.size();
+		}
+
+		for (IndexType to : edges)
+		{
+			Distance newDistance = distance + weight(v, to);
+			if (newDistance < context.GetDistance(to))
 			{
-				q.erase(std::make_pair(d[to], to));
-				d[to] = d[v] + EdgeWeight;
-				path[to] = v;
-				q.insert(std::make_pair(d[to], to));
+				context.SetDistance(to, newDistance, v);
+				q.Push(newDistance, to);
 			}
 		}
 	}
-	
-	// End node is unreachable
-	if (d[end] == Infinity)
-	{
-		path.clear();
-		return path;
-	}
-	else
-	{
-		RestorePath(path, start, end);
-		return path;
-	}
+
+	return context.RestorePath(start, end);
+}
+
+template <typename Graph, typename Weight, typename IndexType = typename Graph::NodeIndex>
+std::vector<IndexType> Dijkstra(const Graph& graph, IndexType start, IndexType end, const Weight& weight,
+	SearchStats* stats = nullptr)
+{
+	SearchContext<IndexType> context;
+	return Dijkstra(graph, start, end, weight, context, stats);
+}
+
+template <typename Graph, typename IndexType = typename Graph::NodeIndex>
+std::vector<IndexType> Dijkstra(const Graph& graph, IndexType start, IndexType end)
+{
+	return Dijkstra(graph, start, end, UnitWeight());
 }
 
 #endif // DIJKSTRA_H
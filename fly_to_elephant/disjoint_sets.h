@@ -0,0 +1,64 @@
+#ifndef DISJOINT_SETS_H
+#define DISJOINT_SETS_H
+
+#include <vector>
+#include <numeric>
+#include <utility>
+
+// Union-find with union by size and path halving
+class DisjointSets
+{
+public:
+	typedef size_t Index;
+
+	void Reset(size_t size)
+	{
+		m_parents.resize(size);
+		std::iota(m_parents.begin(), m_parents.end(), 0);
+		m_sizes.assign(size, 1);
+	}
+
+	// Adds new single element set, returns its index
+	Index Add()
+	{
+		m_parents.push_back(m_parents.size());
+		m_sizes.push_back(1);
+		return m_parents.size() - 1;
+	}
+
+	size_t GetSize() const
+	{
+		return m_parents.size();
+	}
+
+	Index Find(Index v)
+	{
+		while (m_parents[v] != v)
+		{
+			m_parents[v] = m_parents[m_parents[v]];
+			v = m_parents[v];
+		}
+		return v;
+	}
+
+	// Returns false if elements were already in the same set
+	bool Union(Index a, Index b)
+	{
+		a = Find(a);
+		b = Find(b);
+		if (a == b)
+			return false;
+
+		if (m_sizes[a] < m_sizes[b])
+			std::swap(a, b);
+		m_parents[b] = a;
+		m_sizes[a] += m_sizes[b];
+		return true;
+	}
+
+private:
+	std::vector<Index>  m_parents;
+	std::vector<size_t> m_sizes;
+};
+
+#endif // DISJOINT_SETS_H
@@ -0,0 +1,184 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <random>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstdio>
+
+#include "helpers.h"
+#include "astar.h"
+
+// Benchmark of graph building and search on synthetic dictionaries.
+// Usage: fly_bench [max_words] [queries_per_dictionary]
+
+typedef std::chrono::steady_clock Clock;
+
+double GetMilliseconds(Clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// Every word is a copy of some previous word with one letter changed (sometimes a new random word),
+// so dictionaries of any word length have long ladders like real ones
+void GenerateDictionary(const std::string& filePath, size_t wordsCount, size_t wordLength, std::mt19937& random)
+{
+	const std::string Alphabet = "abcdefghijklmnopqrstuvwxyz";
+	std::uniform_int_distribution<size_t> letter(0, Alphabet.size() - 1), position(0, wordLength - 1);
+	std::uniform_real_distribution<double> probability(0, 1);
+
+	std::vector<std::string> words;
+	std::string word(wordLength, ' ');
+	for (size_t i = 0; i < wordsCount; ++i)
+	{
+		if (words.empty() || probability(random) < 0.05)
+		{
+			for (auto& c : word)
+				c = Alphabet[letter(random)];
+		}
+		else
+		{
+			word = words[std::uniform_int_distribution<size_t>(0, words.size() - 1)(random)];
+			word[position(random)] = Alphabet[letter(random)];
+		}
+		words.push_back(word);
+	}
+
+	std::shuffle(words.begin(), words.end(), random);
+	std::ofstream file(filePath, std::ios::binary);
+	for (const auto& w : words)
+		file << w << '\n';
+}
+
+double GetPercentile(std::vector<double> values, double percentile)
+{
+	if (values.empty())
+		return 0;
+	std::sort(values.begin(), values.end());
+	return values[static_cast<size_t>(percentile * (values.size() - 1))];
+}
+
+typedef std::vector<std::pair<size_t, size_t>> Queries;
+
+struct SearchResult
+{
+	std::vector<double> latencies;
+
+	// Number of nodes in the found path of every query, 0 if path wasn't found
+	std::vector<size_t> pathLengths;
+	size_t				visitedNodes = 0;
+	size_t				found = 0;
+};
+
+// Random (from, to) pairs, every search answers the same set so their numbers are comparable
+Queries GenerateQueries(const WordsGraph<Word>& graph, size_t queriesCount, std::mt19937& random)
+{
+	Queries queries;
+	std::uniform_int_distribution<size_t> node(0, graph.GetSize() - 1);
+	for (size_t i = 0; i < queriesCount; ++i)
+	{
+		auto from = node(random);
+		queries.push_back(std::make_pair(from, node(random)));
+	}
+	return queries;
+}
+
+template <typename Search>
+SearchResult RunQueries(const Queries& queries, Search search)
+{
+	SearchResult result;
+
+	for (const auto& query : queries)
+	{
+		SearchStats stats;
+
+		auto start = Clock::now();
+		auto path = search(query.first, query.second, stats);
+		result.latencies.push_back(GetMilliseconds(start));
+
+		result.pathLengths.push_back(path.size());
+		result.visitedNodes += stats.visitedNodes;
+		result.found += !path.empty();
+	}
+	return result;
+}
+
+// All searches should find ladders of the same length, otherwise one of them is broken
+bool CheckSameResults(const std::string& name, const SearchResult& result, const SearchResult& expected)
+{
+	if (result.found == expected.found && result.pathLengths == expected.pathLengths)
+		return true;
+
+	std::cout << "  ERROR: " << name << " results differ from dijkstra" << std::endl;
+	return false;
+}
+
+void PrintSearch(const std::string& name, const SearchResult& result, size_t queriesCount)
+{
+	std::cout << "  " << std::left << std::setw(9) << name << std::right << std::fixed << std::setprecision(3)
+		<< " p50 " << GetPercentile(result.latencies, 0.5) << " ms"
+		<< ", p90 " << GetPercentile(result.latencies, 0.9) << " ms"
+		<< ", p99 " << GetPercentile(result.latencies, 0.99) << " ms"
+		<< ", visited nodes/search " << result.visitedNodes / std::max<size_t>(1, queriesCount)
+		<< ", found " << result.found << "/" << queriesCount << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+	size_t maxWords = argc > 1 ? std::stoul(argv[1]) : 100000;
+	size_t queriesCount = argc > 2 ? std::stoul(argv[2]) : 200;
+	const std::string filePath = "fly_bench_dictionary.txt";
+	std::mt19937 random(42);
+	bool isCorrect = true;
+
+	for (size_t wordLength : { 4, 6, 8 })
+	{
+		for (size_t wordsCount = 1000; wordsCount <= maxWords; wordsCount *= 10)
+		{
+			GenerateDictionary(filePath, wordsCount, wordLength, random);
+
+			WordsGraph<Word> graph;
+			auto start = Clock::now();
+			ReadWordsFromFile(filePath, wordLength, graph);
+			double loadTime = GetMilliseconds(start);
+
+			start = Clock::now();
+			CreateEdges(graph);
+			double edgesTime = GetMilliseconds(start);
+
+			std::cout << "words " << wordsCount << " x " << wordLength << " letters: "
+				<< graph.GetSize() << " nodes, " << std::fixed << std::setprecision(2)
+				<< static_cast<double>(graph.GetEdgesCount()) / std::max<size_t>(1, graph.GetSize()) << " edges/node, "
+				<< graph.GetMemoryUsage() / 1024 << " KB, "
+				<< graph.GetComponentsCount() << " components (largest " << graph.GetLargestComponentSize() << ")" << std::endl;
+			std::cout << "  load " << loadTime << " ms, edges " << edgesTime << " ms" << std::endl;
+
+			if (graph.GetSize() == 0)
+				continue;
+
+			const Queries queries = GenerateQueries(graph, queriesCount, random);
+			auto dijkstra = RunQueries(queries,
+				[&](size_t from, size_t to, SearchStats& stats) { return Dijkstra(graph, from, to, UnitWeight(), &stats); });
+			PrintSearch("dijkstra", dijkstra, queriesCount);
+
+			// Same searches without allocating and clearing arrays for every query
+			SearchContext<size_t> context;
+			auto reused = RunQueries(queries,
+				[&](size_t from, size_t to, SearchStats& stats) { return Dijkstra(graph, from, to, UnitWeight(), context, &stats); });
+			PrintSearch("dijkstra+context", reused, queriesCount);
+			isCorrect &= CheckSameResults("dijkstra+context", reused, dijkstra);
+
+			Landmarks<WordsGraph<Word>> landmarks;
+			landmarks.Build(graph, 8);
+			auto astar = RunQueries(queries,
+				[&](size_t from, size_t to, SearchStats& stats) { return AStar(graph, landmarks, from, to, context, true, &stats); });
+			PrintSearch("astar", astar, queriesCount);
+			isCorrect &= CheckSameResults("astar", astar, dijkstra);
+		}
+	}
+
+	std::remove(filePath.c_str());
+	return isCorrect ? 0 : 1;
+}
@@ -4,6 +4,11 @@
 
 #include "helpers.h"
 #include "words_graph.h"
+#include "batch.h"
+#include "astar.h"
+#include "shortest_paths.h"
+#include "weights.h"
+#include "live_graph.h"
 
 TEST(DistanceCalculationTest, CheckDistanceBaseCases)
 {
@@ -15,6 +20,36 @@ TEST(DistanceCalculationTest, CheckDistanceBaseCases)
 	ASSERT_THROW(IsDistanceMeetsExpectations(word2, word3, 0), std::exception);
 }
 
+TEST(DistanceCalculationTest, PackedDistance)
+{
+	std::vector<Word> words = { L"word1", L"word2", L"wxrd2", L"коты1", L"word1" };
+	PackedWords packed;
+	ASSERT_TRUE(packed.Pack(words.begin(), words.end()));
+	EXPECT_EQ(packed.GetSize(), words.size());
+	EXPECT_EQ(packed.GetStride() % PackedBlockSize, 0);
+
+	EXPECT_EQ(packed.GetDistance(0, 1), 1);
+	EXPECT_EQ(packed.GetDistance(0, 2), 2);
+	EXPECT_EQ(packed.GetDistance(0, 3), 4);
+	EXPECT_EQ(packed.GetDistance(0, 4), 0);
+
+	// One word against a block
+	std::vector<size_t> result;
+	packed.FindAtDistance(packed.GetWord(1), 0, packed.GetSize(), 1, result);
+	std::vector<size_t> expected = { 0, 2, 4 };
+	EXPECT_EQ(result, expected);
+
+	// Long words take several blocks
+	std::vector<Word> longWords = { Word(40, L'a'), Word(39, L'a') + L"b" };
+	ASSERT_TRUE(packed.Pack(longWords.begin(), longWords.end()));
+	EXPECT_EQ(packed.GetDistance(0, 1), 1);
+
+	// Different length
+	std::vector<Word> badWords = { L"word", L"words" };
+	EXPECT_FALSE(packed.Pack(badWords.begin(), badWords.end()));
+	EXPECT_EQ(packed.GetSize(), 0);
+}
+
 TEST(ReadWordsFromFileTest, IsReadSucceededOnSmallDict)
 {
 	std::string filePath = "./data/small_dict_en.txt";
@@ -34,6 +69,63 @@ TEST(ReadWordsFromFileTest, IsReadSucceededOnSmallDict)
 	}
 }
 
+TEST(ReadWordsFromFileTest, IsReadSucceededOnCyrillicDict)
+{
+	// UTF-8 with BOM and upper case words, doesn't depend on the global locale
+	std::string filePath = "./data/small_dict.txt";
+	WordsGraph<Word> graph;
+	ReadWordsFromFile(filePath, 3, graph);
+	EXPECT_EQ(graph.GetSize(), 5);
+
+	CreateEdges(graph);
+	auto result = FindShortestPath(graph, Word(L"кот"), Word(L"тон"));
+	decltype(result) expectedResult = { L"кот", L"тот", L"тон" };
+	EXPECT_EQ(result, expectedResult);
+
+	ReadWordsFromFile(filePath, 4, graph);
+	EXPECT_EQ(graph.GetSize(), 5);
+	WordsGraph<Word>::NodeIndex index;
+	EXPECT_TRUE(graph.FindNodeIndex(Word(L"барс"), index));
+}
+
+TEST(Utf8Test, DecodeAndLowerCase)
+{
+	std::string text = "\xD0\x81\xD0\x96\xD0\x98\xD0\x9A AbC \xC3\x89t\xC3\xA9";	// ЁЖИК AbC Été
+	std::vector<wchar_t> out(text.size());
+	ptrdiff_t length = DecodeUtf8Lower(text.data(), text.data() + text.size(), out.data());
+	ASSERT_EQ(length, 12);
+	EXPECT_EQ(Word(out.data(), length), L"ёжик abc été");
+	EXPECT_EQ(Utf8Length(text.data(), text.data() + text.size()), 12);
+
+	// Truncated sequence
+	EXPECT_EQ(DecodeUtf8Lower(text.data(), text.data() + 1, out.data()), -1);
+
+	// Pairs of Latin Extended-A starting at odd code points
+	text = "\xC5\xB8\xC5\xB9\xC5\xBB\xC5\xBD\xC4\xB9\xC5\xBA";	// ŸŹŻŽĹź
+	ASSERT_EQ(DecodeUtf8Lower(text.data(), text.data() + text.size(), out.data()), 6);
+	EXPECT_EQ(Word(out.data(), 6), L"ÿźżžĺź");
+
+	// Overlong forms, surrogates and values over U+10FFFF are malformed
+	for (const char* broken : { "a\xC0\x80", "\xC1\xBF", "\xE0\x80\xAF", "\xE0\x9F\xBF", "\xF0\x8F\xBF\xBF",
+		"\xED\xA0\x80", "\xED\xBF\xBF", "\xF4\x90\x80\x80", "\xF5\x80\x80\x80", "\x80" })
+	{
+		text = broken;
+		EXPECT_EQ(DecodeUtf8Lower(text.data(), text.data() + text.size(), out.data()), -1) << text;
+	}
+
+	// Shortest forms at the boundaries are valid
+	std::vector<uint32_t> wide(4);
+	for (const char* valid : { "\xC2\x80", "\xE0\xA0\x80", "\xED\x9F\xBF", "\xEE\x80\x80", "\xF0\x90\x80\x80", "\xF4\x8F\xBF\xBF" })
+	{
+		text = valid;
+		EXPECT_EQ(DecodeUtf8Lower(text.data(), text.data() + text.size(), wide.data()), 1) << text;
+	}
+
+	Word word = L"КоТ";
+	ToLower(word);
+	EXPECT_EQ(word, L"кот");
+}
+
 TEST(ReadWordsFromFileTest, IsReadSucceededOnBigDict)
 {
 	std::string filePath = "./data/google-10000-english.txt";
@@ -91,6 +183,176 @@ TEST(CreateEdge, EdgesCreated)
 	EXPECT_EQ(edges.size(), 0);
 }
 
+// All words of given length over first 'alphabetSize' letters
+std::vector<Word> GenerateAllWords(size_t length, size_t alphabetSize)
+{
+	std::vector<Word> words(1);
+	for (size_t i = 0; i < length; ++i)
+	{
+		std::vector<Word> next;
+		for (const auto& prefix : words)
+			for (size_t letter = 0; letter < alphabetSize; ++letter)
+				next.push_back(prefix + Word(1, L'a' + letter));
+		words.swap(next);
+	}
+	return words;
+}
+
+TEST(ParallelBuildTest, EdgesCreatedInParallel)
+{
+	typedef WordsGraph<Word> Graph;
+	auto words = GenerateAllWords(3, 16);
+	Graph graph;
+	graph.SetSortedNodes(words);
+	CreateEdges(graph, 4);
+
+	// Every word has 3 positions * 15 other letters neighbours
+	Graph::Edges edges;
+	for (Graph::NodeIndex v = 0; v < graph.GetSize(); ++v)
+	{
+		graph.GetEdges(v, edges);
+		ASSERT_EQ(edges.size(), 45);
+	}
+	graph.GetEdges(L"abc", edges);
+	EXPECT_TRUE(edges.find(graph.GetNodeIndex(L"pbc")) != edges.end());
+	EXPECT_EQ(graph.GetComponentsCount(), 1);
+}
+
+TEST(ParallelBuildTest, DictionaryReadInChunks)
+{
+	auto words = GenerateAllWords(4, 12);
+	std::string filePath = "./parallel_read_test.txt";
+	{
+		std::wofstream file(filePath);
+		for (auto it = words.rbegin(); it != words.rend(); ++it)
+			file << *it << L"\r\n";
+		file << L"toolong\n";
+	}
+
+	WordsGraph<Word> graph;
+	ReadWordsFromFile(filePath, 4, graph, 4);
+	std::remove(filePath.c_str());
+
+	ASSERT_EQ(graph.GetSize(), words.size());
+	EXPECT_TRUE(std::equal(words.begin(), words.end(), graph.Begin()));
+}
+
+TEST(StringPoolTest, PoolAndIndex)
+{
+	StringPool<wchar_t> pool;
+	pool.Add(Word(L"cat").data(), 3);
+	pool.Add(Word(L"dog").data(), 3);
+	EXPECT_EQ(pool.Get(1), Word(L"dog"));
+
+	// Word of another length switches pool from fixed slots to offsets
+	pool.Add(Word(L"horse").data(), 5);
+	EXPECT_EQ(pool.Get(0), Word(L"cat"));
+	EXPECT_EQ(pool.Get(2), Word(L"horse"));
+	EXPECT_EQ(pool.GetSize(), 3);
+
+	StringIndex<wchar_t> index;
+	index.Build(pool);
+	EXPECT_EQ(index.Find(pool, Word(L"horse")), 2);
+	EXPECT_EQ(index.Find(pool, Word(L"cat")), 0);
+	EXPECT_EQ(index.Find(pool, Word(L"cow")), StringIndex<wchar_t>::NotFound);
+
+	// Index grows with inserts
+	auto words = GenerateAllWords(3, 10);
+	for (const auto& word : words)
+		index.Insert(pool, pool.Add(word.data(), word.length()));
+	for (size_t i = 0; i < words.size(); ++i)
+		ASSERT_EQ(index.Find(pool, words[i]), i + 3);
+}
+
+TEST(EditDistanceTest, IsEditDistanceOne)
+{
+	EXPECT_TRUE(IsEditDistanceOne(Word(L"cat"), Word(L"cut")));
+	EXPECT_TRUE(IsEditDistanceOne(Word(L"cat"), Word(L"cart")));
+	EXPECT_TRUE(IsEditDistanceOne(Word(L"cats"), Word(L"cat")));
+	EXPECT_TRUE(IsEditDistanceOne(Word(L"at"), Word(L"cat")));
+	EXPECT_FALSE(IsEditDistanceOne(Word(L"cat"), Word(L"cat")));
+	EXPECT_FALSE(IsEditDistanceOne(Word(L"ab"), Word(L"ba")));
+	EXPECT_FALSE(IsEditDistanceOne(Word(L"cat"), Word(L"dogs")));
+	EXPECT_FALSE(IsEditDistanceOne(Word(L"cat"), Word(L"taco")));
+}
+
+TEST(EditDistanceTest, EdgesBetweenDifferentLengths)
+{
+	typedef WordsGraph<Word> Graph;
+	Graph graph;
+	graph.SetNodes({ L"a", L"at", L"cat", L"cart", L"card", L"ab", L"ba", L"book", L"bok" });
+	CreateEditDistanceEdges(graph);
+
+	Graph::Edges edges;
+	graph.GetEdges(L"cat", edges);
+	std::set<Word> neighbours;
+	for (auto index : edges)
+		neighbours.insert(graph.GetNodeValue(index));
+	EXPECT_EQ(neighbours, (std::set<Word>{ L"at", L"cart" }));
+
+	// Transposition is not a single step
+	graph.GetEdges(L"ab", edges);
+	EXPECT_EQ(edges.count(graph.GetNodeIndex(L"ba")), 0);
+
+	graph.GetEdges(L"book", edges);
+	EXPECT_EQ(edges.size(), 1);
+
+	auto result = FindShortestPath(graph, Word(L"a"), Word(L"card"));
+	decltype(result) expectedResult = { L"a", L"at", L"cat", L"cart", L"card" };
+	EXPECT_EQ(result, expectedResult);
+
+	// Landmarks with length difference bound give the same length
+	Landmarks<Graph> landmarks;
+	landmarks.Build(graph, 2);
+	auto path = AStar(graph, landmarks, graph.GetNodeIndex(L"a"), graph.GetNodeIndex(L"card"), false);
+	EXPECT_EQ(path.size(), expectedResult.size());
+}
+
+TEST(EditDistanceTest, SameAsSubstitutionsOnSameLength)
+{
+	// Read all lengths, but edges between same length words must match CreateEdges
+	typedef WordsGraph<Word> Graph;
+	Graph all, substitutions;
+	ReadWordsFromFile("./data/google-10000-english.txt", 1, std::numeric_limits<size_t>::max(), all);
+	ReadWordsFromFile("./data/google-10000-english.txt", 4, substitutions);
+	EXPECT_EQ(all.GetSize(), 10002);
+	CreateEditDistanceEdges(all);
+	CreateEdges(substitutions);
+
+	Graph::Edges edges, expected;
+	for (Graph::NodeIndex v = 0; v < substitutions.GetSize(); ++v)
+	{
+		auto word = substitutions.GetNodeValue(v);
+		substitutions.GetEdges(v, expected);
+		all.GetEdges(word, edges);
+
+		size_t sameLength = 0;
+		for (auto index : edges)
+			sameLength += all.GetNodeView(index).length() == word.length();
+		ASSERT_EQ(sameLength, expected.size());
+	}
+
+	auto path = FindEditPath("./data/google-10000-english.txt", Word(L"mail"), Word(L"grab"));
+	EXPECT_LE(path.size(), 10);
+}
+
+TEST(ComponentsTest, ComponentsLabelled)
+{
+	typedef WordsGraph<Word> Graph;
+	Graph graph;
+	graph.SetNodes({ L"bat", L"rat", L"god", L"fat", L"rod", L"rad", L"bad", L"ooo", L"oox" });
+	EXPECT_FALSE(graph.HasComponents());
+	CreateEdges(graph);
+	ASSERT_TRUE(graph.HasComponents());
+
+	EXPECT_EQ(graph.GetComponentsCount(), 2);
+	EXPECT_EQ(graph.GetLargestComponentSize(), 7);
+	EXPECT_EQ(graph.GetComponentSize(graph.GetComponentId(graph.GetNodeIndex(L"ooo"))), 2);
+	EXPECT_TRUE(graph.IsReachable(graph.GetNodeIndex(L"god"), graph.GetNodeIndex(L"fat")));
+	EXPECT_FALSE(graph.IsReachable(graph.GetNodeIndex(L"god"), graph.GetNodeIndex(L"ooo")));
+	EXPECT_TRUE(FindShortestPath(graph, Word(L"god"), Word(L"oox")).empty());
+}
+
 TEST(FindShortestPathTest, FindInSmallDictionary)
 {
 	typedef WordsGraph<Word> Graph;
@@ -102,6 +364,645 @@ TEST(FindShortestPathTest, FindInSmallDictionary)
 	EXPECT_EQ(result, expectedResult);
 }
 
+TEST(BatchTest, ReadQueries)
+{
+	std::wistringstream stream(L"Mail grab\n\nbat  fat\nbroken\n");
+	std::vector<Query<Word>> queries;
+	ReadQueries(stream, queries);
+	ASSERT_EQ(queries.size(), 2);
+	EXPECT_EQ(queries[0].from, L"mail");
+	EXPECT_EQ(queries[0].to, L"grab");
+	EXPECT_EQ(queries[1].from, L"bat");
+	EXPECT_EQ(queries[1].to, L"fat");
+}
+
+TEST(BatchTest, SolveBatchMatchesSingleQueries)
+{
+	std::string filePath = "./data/google-10000-english.txt";
+	std::vector<Query<Word>> queries = {
+		{ L"mail", L"grab" },
+		{ L"cat", L"dog" },
+		{ L"mail", L"zzzz" },	// Unknown word
+		{ L"mail", L"cat" },	// Different length
+		{ L"ball", L"bill" }
+	};
+
+	auto results = SolveBatch(filePath, queries, 4);
+	ASSERT_EQ(results.size(), queries.size());
+	EXPECT_EQ(results[0], FindPath(filePath, queries[0].from, queries[0].to));
+	EXPECT_EQ(results[1], FindPath(filePath, queries[1].from, queries[1].to));
+	EXPECT_TRUE(results[2].empty());
+	EXPECT_TRUE(results[3].empty());
+	std::vector<Word> expected = { L"ball", L"bill" };
+	EXPECT_EQ(results[4], expected);
+}
+
+TEST(AStarTest, LandmarksBoundsAreAdmissible)
+{
+	typedef WordsGraph<Word> Graph;
+	Graph graph;
+	graph.SetNodes({ L"bat", L"rat", L"god", L"fat", L"rod", L"rad", L"bad", L"ooo" });
+	CreateEdges(graph);
+
+	Landmarks<Graph> landmarks;
+	landmarks.Build(graph, 3);
+	EXPECT_TRUE(landmarks.IsBuiltFor(graph));
+
+	auto god = graph.GetNodeIndex(L"god"), fat = graph.GetNodeIndex(L"fat"), ooo = graph.GetNodeIndex(L"ooo");
+	EXPECT_LE(landmarks.GetLowerBound(god, fat), 4);
+	EXPECT_EQ(landmarks.GetLowerBound(god, ooo), Landmarks<Graph>::Unreachable);
+	EXPECT_EQ(landmarks.GetLowerBound(god, god), 0);
+}
+
+TEST(AStarTest, SameLengthAsDijkstraOnBigDict)
+{
+	typedef WordsGraph<Word> Graph;
+	Graph graph;
+	ReadWordsFromFile("./data/google-10000-english.txt", 4, graph);
+	CreateEdges(graph);
+
+	Landmarks<Graph> landmarks;
+	landmarks.Build(graph, 4);
+
+	std::vector<std::pair<Word, Word>> queries = {
+		{ L"mail", L"grab" }, { L"ball", L"bill" }, { L"cold", L"warm" }, { L"love", L"hate" }, { L"mail", L"mail" }
+	};
+	for (const auto& query : queries)
+	{
+		auto expected = FindShortestPath(graph, query.first, query.second);
+		auto result = FindShortestPath(graph, landmarks, query.first, query.second);
+		EXPECT_EQ(result.size(), expected.size());
+		if (!result.empty())
+		{
+			EXPECT_EQ(result.front(), query.first);
+			EXPECT_EQ(result.back(), query.second);
+		}
+	}
+}
+
+TEST(SearchContextTest, ReusedBetweenSearches)
+{
+	typedef WordsGraph<Word> Graph;
+	Graph graph;
+	ReadWordsFromFile("./data/google-10000-english.txt", 4, graph);
+	CreateEdges(graph);
+
+	Landmarks<Graph> landmarks;
+	landmarks.Build(graph, 4);
+
+	// Previous search must not leak into the next one
+	SearchContext<Graph::NodeIndex> context;
+	std::vector<std::pair<Word, Word>> queries = {
+		{ L"mail", L"grab" }, { L"ball", L"bill" }, { L"cold", L"warm" }, { L"mail", L"mail" }, { L"mail", L"grab" }
+	};
+	for (const auto& query : queries)
+	{
+		auto from = graph.GetNodeIndex(query.first), to = graph.GetNodeIndex(query.second);
+		auto expected = Dijkstra(graph, from, to);
+		EXPECT_EQ(Dijkstra(graph, from, to, UnitWeight(), context), expected);
+		EXPECT_EQ(AStar(graph, landmarks, from, to, context).size(), expected.size());
+	}
+
+	// Smaller graph resizes arrays
+	Graph small;
+	small.SetNodes({ L"bat", L"rat", L"god", L"fat", L"rod", L"rad", L"bad", L"ooo" });
+	CreateEdges(small);
+	EXPECT_EQ(Dijkstra(small, small.GetNodeIndex(L"god"), small.GetNodeIndex(L"fat"), UnitWeight(), context).size(), 5);
+	EXPECT_TRUE(Dijkstra(small, small.GetNodeIndex(L"god"), small.GetNodeIndex(L"ooo"), UnitWeight(), context).empty());
+}
+
+TEST(AStarTest, LandmarksSaveLoad)
+{
+	typedef WordsGraph<Word> Graph;
+	Graph graph;
+	ReadWordsFromFile("./data/google-10000-english.txt", 3, graph);
+	CreateEdges(graph);
+
+	Landmarks<Graph> landmarks, loaded;
+	landmarks.Build(graph, 2);
+	std::string filePath = "./landmarks_test.bin";
+	ASSERT_TRUE(landmarks.Save(filePath));
+	ASSERT_TRUE(loaded.Load(filePath, graph));
+	std::remove(filePath.c_str());
+
+	EXPECT_EQ(loaded.GetCount(), landmarks.GetCount());
+	for (Graph::NodeIndex v = 0; v < graph.GetSize(); v += 7)
+		EXPECT_EQ(loaded.GetLowerBound(v, 0), landmarks.GetLowerBound(v, 0));
+
+	// Table built for another graph must be rejected
+	Graph other;
+	other.SetNodes({ L"aa" });
+	EXPECT_FALSE(loaded.Load(filePath, other));
+
+	// Same size, but other words
+	Graph small, sameSize;
+	small.SetNodes({ L"bat", L"rat", L"god", L"fat", L"rod", L"rad", L"bad", L"ooo" });
+	sameSize.SetNodes({ L"bat", L"rat", L"god", L"fat", L"rod", L"rad", L"bad", L"ool" });
+	CreateEdges(small);
+	CreateEdges(sameSize);
+	landmarks.Build(small, 2);
+	ASSERT_TRUE(landmarks.Save(filePath));
+	EXPECT_FALSE(loaded.Load(filePath, sameSize));
+
+	// Same words, but other edges
+	Graph sameWords;
+	sameWords.SetNodes({ L"bat", L"rat", L"god", L"fat", L"rod", L"rad", L"bad", L"ooo" });
+	CreateEdges(sameWords);
+	sameWords.AddEdge(L"bat", L"ooo");
+	EXPECT_FALSE(loaded.Load(filePath, sameWords));
+	EXPECT_FALSE(landmarks.IsBuiltFor(sameWords));
+	EXPECT_TRUE(loaded.Load(filePath, small));
+
+	// Landmarks count is checked before the table is allocated
+	{
+		std::fstream file(filePath, std::ios::binary | std::ios::in | std::ios::out);
+		uint64_t landmarksCount = uint64_t(1) << 60;
+		file.seekp(4 + 2 * sizeof(uint64_t));
+		file.write(reinterpret_cast<const char*>(&landmarksCount), sizeof(landmarksCount));
+	}
+	EXPECT_FALSE(loaded.Load(filePath, small));
+
+	// Truncated table
+	ASSERT_TRUE(landmarks.Save(filePath));
+	{
+		std::ofstream file(filePath, std::ios::binary | std::ios::app);
+		file.put(0);
+	}
+	EXPECT_FALSE(loaded.Load(filePath, small));
+	std::remove(filePath.c_str());
+}
+
+TEST(AStarTest, LandmarksInLargestComponents)
+{
+	// Chain of 6 words, triple of words and isolated ones
+	typedef WordsGraph<Word> Graph;
+	Graph graph;
+	graph.SetNodes({ L"aaa", L"baa", L"bba", L"bbb", L"cbb", L"ccb", L"xyz", L"xyq", L"xqq", L"qqq", L"www", L"eee" });
+	CreateEdges(graph);
+
+	Landmarks<Graph> landmarks;
+	landmarks.Build(graph, 3);
+	ASSERT_EQ(landmarks.GetCount(), 3);
+
+	size_t chain = graph.GetComponentId(graph.GetNodeIndex(L"aaa"));
+	size_t inChain = 0;
+	for (size_t i = 0; i < landmarks.GetCount(); ++i)
+	{
+		auto landmark = landmarks.GetLandmark(i);
+		EXPECT_GE(graph.GetComponentSize(graph.GetComponentId(landmark)), 2);
+		inChain += graph.GetComponentId(landmark) == chain;
+	}
+	EXPECT_EQ(inChain, 2);
+
+	// Farthest point: ends of the chain give exact distances inside it
+	auto aaa = graph.GetNodeIndex(L"aaa"), ccb = graph.GetNodeIndex(L"ccb"), bba = graph.GetNodeIndex(L"bba");
+	EXPECT_EQ(landmarks.GetLowerBound(aaa, ccb), 5);
+	EXPECT_EQ(landmarks.GetLowerBound(bba, ccb), 3);
+
+	// The same without labelled components
+	Graph unlabelled;
+	unlabelled.SetNodes({ L"aaa", L"baa", L"bba", L"bbb", L"cbb", L"ccb", L"xyz", L"xyq", L"xqq", L"qqq", L"www", L"eee" });
+	for (size_t v = 0; v < unlabelled.GetSize(); ++v)
+		unlabelled.SetEdges(v, Graph::Edges(graph.GetEdges(v)));
+	ASSERT_FALSE(unlabelled.HasComponents());
+	Landmarks<Graph> other;
+	other.Build(unlabelled, 3);
+	EXPECT_EQ(other.GetCount(), 3);
+	EXPECT_EQ(other.GetLowerBound(aaa, ccb), 5);
+}
+
+TEST(BatchTest, LandmarksCached)
+{
+	typedef WordsGraph<Word> Graph;
+	Graph graph;
+	ReadWordsFromFile("./data/google-10000-english.txt", 4, graph);
+	CreateEdges(graph);
+
+	std::string cachePath = GetLandmarksCachePath(".", "./data/landmarks_cache_test", 4);
+	EXPECT_EQ(cachePath, "./landmarks_cache_test.4.alt");
+	std::remove(cachePath.c_str());
+
+	Landmarks<Graph> built, loaded;
+	ASSERT_TRUE(LoadOrBuildLandmarks(cachePath, graph, built));
+	ASSERT_TRUE(loaded.Load(cachePath, graph));
+	EXPECT_EQ(loaded.GetCount(), LandmarksCount);
+	EXPECT_TRUE(LoadOrBuildLandmarks(cachePath, graph, loaded));
+
+	// Stale cache of another dictionary is rebuilt
+	Graph other;
+	other.SetNodes({ L"aaaa", L"aaab", L"bbbb" });
+	CreateEdges(other);
+	Landmarks<Graph> rebuilt;
+	EXPECT_FALSE(rebuilt.Load(cachePath, other));
+	EXPECT_TRUE(LoadOrBuildLandmarks(cachePath, other, rebuilt));
+	EXPECT_TRUE(rebuilt.IsBuiltFor(other));
+	EXPECT_FALSE(loaded.Load(cachePath, graph));
+	std::remove(cachePath.c_str());
+}
+
+// Landmarks are saved only to the directory given to SolveBatch, failed save doesn't fail the batch
+TEST(BatchTest, LandmarksCachedOnlyInGivenDirectory)
+{
+	std::string filePath = "./data/google-10000-english.txt";
+	std::vector<Query<Word>> queries(LandmarksMinQueries, Query<Word>{ L"mail", L"grab" });
+	std::vector<Word> expected = FindPath(filePath, Word(L"mail"), Word(L"grab"));
+
+	std::string besideDictionary = filePath + ".4.alt", cachePath = GetLandmarksCachePath(".", filePath, 4);
+	std::remove(besideDictionary.c_str());
+	std::remove(cachePath.c_str());
+
+	auto results = SolveBatch(filePath, queries, 2);
+	EXPECT_EQ(results.back(), expected);
+	EXPECT_FALSE(std::ifstream(besideDictionary).is_open());
+	EXPECT_FALSE(std::ifstream(cachePath).is_open());
+
+	results = SolveBatch(filePath, queries, 2, ".");
+	EXPECT_EQ(results.back(), expected);
+	EXPECT_TRUE(std::ifstream(cachePath).is_open());
+	EXPECT_FALSE(std::ifstream(besideDictionary).is_open());
+	std::remove(cachePath.c_str());
+
+	testing::internal::CaptureStderr();
+	results = SolveBatch(filePath, queries, 2, "./no_such_directory");
+	EXPECT_NE(testing::internal::GetCapturedStderr().find("Can't save landmarks to ./no_such_directory/"), std::string::npos);
+	EXPECT_EQ(results.back(), expected);
+}
+
+TEST(ShortestPathsTest, AllShortestPaths)
+{
+	typedef WordsGraph<Word> Graph;
+	Graph graph;
+	graph.SetNodes({ L"cat", L"cot", L"cog", L"dog", L"dot", L"cag", L"xyz" });
+	CreateEdges(graph);
+
+	auto paths = FindShortestPaths(graph, Word(L"cat"), Word(L"dog"));
+	std::set<std::vector<Word>> result(paths.begin(), paths.end());
+	std::set<std::vector<Word>> expected = {
+		{ L"cat", L"cag", L"cog", L"dog" },
+		{ L"cat", L"cot", L"cog", L"dog" },
+		{ L"cat", L"cot", L"dot", L"dog" }
+	};
+	EXPECT_EQ(paths.size(), 3);
+	EXPECT_EQ(result, expected);
+
+	EXPECT_EQ(FindShortestPaths(graph, Word(L"cat"), Word(L"dog"), 2).size(), 2);
+	EXPECT_TRUE(FindShortestPaths(graph, Word(L"cat"), Word(L"xyz")).empty());
+
+	auto same = FindShortestPaths(graph, Word(L"cat"), Word(L"cat"));
+	ASSERT_EQ(same.size(), 1);
+	EXPECT_EQ(same[0], std::vector<Word>{ L"cat" });
+}
+
+TEST(ShortestPathsTest, EnumeratedLazily)
+{
+	// Every order of changing 4 letters is a shortest path: 4! paths
+	typedef WordsGraph<Word> Graph;
+	Graph graph;
+	graph.SetSortedNodes(GenerateAllWords(4, 3));
+	CreateEdges(graph);
+
+	ShortestPathsEnumerator<Graph> paths(graph, graph.GetNodeIndex(L"aaaa"), graph.GetNodeIndex(L"bbbb"));
+	EXPECT_EQ(paths.GetPathLength(), 4);
+
+	std::set<ShortestPathsEnumerator<Graph>::Path> unique;
+	ShortestPathsEnumerator<Graph>::Path path;
+	while (paths.Next(path))
+	{
+		ASSERT_EQ(path.size(), 5);
+		unique.insert(path);
+	}
+	EXPECT_EQ(unique.size(), 24);
+	EXPECT_FALSE(paths.Next(path));
+}
+
+// All loopless paths from v to end by depth first search, for checking on small graphs
+template <typename Graph>
+void CollectSimplePaths(const Graph& graph, size_t v, size_t end, std::vector<size_t>& path,
+	std::vector<std::vector<size_t>>& paths)
+{
+	path.push_back(v);
+	if (v == end)
+	{
+		paths.push_back(path);
+	}
+	else
+	{
+		for (size_t to : graph.GetEdges(v))
+		{
+			if (std::find(path.begin(), path.end(), to) == path.end())
+				CollectSimplePaths(graph, to, end, path, paths);
+		}
+	}
+	path.pop_back();
+}
+
+TEST(ShortestPathsTest, KShortestLooplessPaths)
+{
+	typedef WordsGraph<Word> Graph;
+	Graph graph;
+	graph.SetNodes({ L"cat", L"cot", L"cog", L"dog", L"dot", L"cag", L"dat", L"bat", L"bag", L"xyz" });
+	CreateEdges(graph);
+
+	auto from = graph.GetNodeIndex(L"cat"), to = graph.GetNodeIndex(L"dog");
+	std::vector<std::vector<size_t>> all;
+	std::vector<size_t> current;
+	CollectSimplePaths(graph, from, to, current, all);
+	std::multiset<size_t> expectedLengths;
+	for (const auto& p : all)
+		expectedLengths.insert(p.size());
+
+	// Every loopless path exactly once, in order of length
+	KShortestPathsEnumerator<Graph> paths(graph, from, to);
+	std::set<std::vector<size_t>> unique;
+	std::multiset<size_t> lengths;
+	std::vector<size_t> path;
+	size_t previousLength = 0;
+	while (paths.Next(path))
+	{
+		EXPECT_GE(path.size(), previousLength);
+		previousLength = path.size();
+		EXPECT_TRUE(unique.insert(path).second);
+		lengths.insert(path.size());
+
+		ASSERT_EQ(path.front(), from);
+		ASSERT_EQ(path.back(), to);
+		for (size_t i = 0; i + 1 < path.size(); ++i)
+			EXPECT_EQ(graph.GetEdges(path[i]).count(path[i + 1]), 1);
+	}
+	EXPECT_EQ(unique.size(), all.size());
+	EXPECT_EQ(lengths, expectedLengths);
+	EXPECT_GT(all.size(), 3);
+
+	// Shortest ladders go first, then longer alternatives
+	auto shortest = FindShortestPaths(graph, Word(L"cat"), Word(L"dog"));
+	ASSERT_EQ(shortest.size(), 4);
+	auto ladders = FindKShortestPaths(graph, Word(L"cat"), Word(L"dog"), 6);
+	ASSERT_EQ(ladders.size(), 6);
+	for (size_t i = 0; i < shortest.size(); ++i)
+		EXPECT_EQ(ladders[i].size(), 4);
+	EXPECT_GT(ladders[4].size(), 4);
+	EXPECT_EQ(std::set<std::vector<Word>>(ladders.begin(), ladders.begin() + shortest.size()),
+		std::set<std::vector<Word>>(shortest.begin(), shortest.end()));
+
+	EXPECT_TRUE(FindKShortestPaths(graph, Word(L"cat"), Word(L"xyz"), 3).empty());
+}
+
+TEST(WeightsTest, BucketQueueIsMonotone)
+{
+	BucketQueue<size_t> q(3);
+	q.Push(0, 10);
+	q.Push(3, 13);
+	q.Push(1, 11);
+
+	uint32_t distance;
+	size_t index;
+	ASSERT_TRUE(q.Pop(distance, index));
+	EXPECT_EQ(index, 10);
+	q.Push(2, 12);
+	ASSERT_TRUE(q.Pop(distance, index));
+	EXPECT_EQ(index, 11);
+	ASSERT_TRUE(q.Pop(distance, index));
+	EXPECT_EQ(distance, 2);
+	ASSERT_TRUE(q.Pop(distance, index));
+	EXPECT_EQ(index, 13);
+	EXPECT_FALSE(q.Pop(distance, index));
+
+	// Outside of window
+	ASSERT_THROW(q.Push(10, 1), std::exception);
+}
+
+TEST(WeightsTest, KeyboardWeight)
+{
+	typedef WordsGraph<Word> Graph;
+	Graph graph;
+	graph.SetNodes({ L"sat", L"set", L"spt", L"cat", L"cats", L"кот", L"ком" });
+
+	KeyboardWeight<Graph> weight(graph);
+	auto index = [&](const wchar_t* word) { return graph.GetNodeIndex(word); };
+	EXPECT_EQ(weight(index(L"sat"), index(L"set")), 2);
+	EXPECT_EQ(weight(index(L"sat"), index(L"spt")), 3);
+	EXPECT_EQ(weight.GetKeyCost(L'a', L's'), 1);
+	EXPECT_EQ(weight(index(L"cat"), index(L"cats")), KeyboardWeight<Graph>::MaxCost);
+	EXPECT_EQ(weight(index(L"кот"), index(L"ком")), 2);
+	EXPECT_EQ(weight.GetKeyCost(L'т', L'ь'), 1);
+	EXPECT_EQ(weight.GetKeyCost(L'т', L't'), KeyboardWeight<Graph>::MaxCost);
+}
+
+TEST(WeightsTest, FrequentWordsPreferred)
+{
+	typedef WordsGraph<Word> Graph;
+	Graph graph;
+	graph.SetNodes({ L"cat", L"cot", L"cog", L"dog", L"cag" });
+	CreateEdges(graph);
+
+	FrequencyWeight<Graph> weight(graph, 4);
+	weight.SetWordsByFrequency(std::vector<Word>{ L"cot", L"dog", L"cat", L"cog" });
+	auto result = FindCheapestPath(graph, Word(L"cat"), Word(L"dog"), weight);
+	decltype(result) expectedResult = { L"cat", L"cot", L"cog", L"dog" };
+	EXPECT_EQ(result, expectedResult);
+
+	weight.SetWordsByFrequency(std::vector<Word>{ L"cag", L"dog", L"cat", L"cog" });
+	result = FindCheapestPath(graph, Word(L"cat"), Word(L"dog"), weight);
+	expectedResult = { L"cat", L"cag", L"cog", L"dog" };
+	EXPECT_EQ(result, expectedResult);
+
+	// Combined weight still finds a path of the same length on a real dictionary
+	Graph big;
+	ReadWordsFromFile("./data/google-10000-english.txt", 4, big);
+	CreateEdges(big);
+	FrequencyWeight<Graph> frequency(big);
+	ASSERT_TRUE(frequency.LoadWordsByFrequency("./data/google-10000-english.txt"));
+	KeyboardWeight<Graph> keyboard(big);
+	auto path = FindCheapestPath(big, Word(L"mail"), Word(L"grab"), CombineWeights(keyboard, frequency));
+	ASSERT_FALSE(path.empty());
+	EXPECT_EQ(path.front(), L"mail");
+	EXPECT_EQ(path.back(), L"grab");
+}
+
+TEST(LiveGraphTest, SnapshotsAreIsolated)
+{
+	typedef WordsGraph<Word> Graph;
+	Graph graph;
+	graph.SetNodes({ L"bat", L"rat", L"god", L"fat", L"rod", L"rad", L"bad" });
+	CreateEdges(graph);
+
+	LiveWordsGraph<Word> live(std::move(graph));
+	auto before = live.GetSnapshot();
+	auto batIndex = before->GetNodeIndex(L"bat");
+
+	live.Update({ L"cat", L"cot", L"bat" }, { L"rat", L"xyz" });
+	auto after = live.GetSnapshot();
+
+	// Old snapshot is not changed
+	EXPECT_EQ(before->GetWordsCount(), 7);
+	Graph::NodeIndex index;
+	EXPECT_TRUE(before->FindNodeIndex(Word(L"rat"), index));
+	EXPECT_FALSE(before->FindNodeIndex(Word(L"cat"), index));
+
+	// New snapshot: indexes are stable, edges of new and removed words are updated
+	EXPECT_EQ(after->GetWordsCount(), 8);
+	EXPECT_EQ(after->GetNodeIndex(L"bat"), batIndex);
+	EXPECT_FALSE(after->FindNodeIndex(Word(L"rat"), index));
+
+	Graph::Edges edges;
+	after->GetEdges(after->GetNodeIndex(L"cat"), edges);
+	std::set<Word> neighbours;
+	for (auto neighbour : edges)
+		neighbours.insert(after->GetNodeValue(neighbour));
+	EXPECT_EQ(neighbours, (std::set<Word>{ L"bat", L"fat", L"cot" }));
+
+	auto result = FindShortestPath(*after, Word(L"god"), Word(L"fat"));
+	decltype(result) expectedResult = { L"god", L"rod", L"rad", L"bad", L"bat", L"fat" };
+	EXPECT_EQ(result, expectedResult);
+	EXPECT_EQ(after->GetComponentsCount(), 1);
+
+	// Word can be added back after removal
+	live.Update({ L"rat" }, {});
+	EXPECT_EQ(FindShortestPath(*live.GetSnapshot(), Word(L"god"), Word(L"fat")).size(), 5);
+}
+
+TEST(LiveGraphTest, ReadersDuringUpdates)
+{
+	typedef WordsGraph<Word> Graph;
+	Graph graph;
+	ReadWordsFromFile("./data/google-10000-english.txt", 4, graph);
+	CreateEdges(graph);
+	LiveWordsGraph<Word> live(std::move(graph));
+
+	std::atomic<bool> stop(false);
+	std::atomic<size_t> found(0);
+	std::thread reader([&]()
+	{
+		while (!stop)
+		{
+			auto snapshot = live.GetSnapshot();
+			if (!FindShortestPath(*snapshot, Word(L"mail"), Word(L"grab")).empty())
+				found++;
+		}
+	});
+
+	for (int i = 0; i < 20; ++i)
+	{
+		live.Update({ L"maix", L"grax" }, {});
+		live.Update({}, { L"maix", L"grax" });
+	}
+	stop = true;
+	reader.join();
+
+	EXPECT_EQ(live.GetSnapshot()->GetWordsCount(), live.GetSnapshot()->GetSize() - 40);
+	EXPECT_FALSE(FindShortestPath(*live.GetSnapshot(), Word(L"mail"), Word(L"grab")).empty());
+}
+
+TEST(LiveGraphTest, ComponentsMergedIncrementally)
+{
+	typedef WordsGraph<Word> Graph;
+	Graph graph;
+	graph.SetNodes({ L"bat", L"rat", L"ooo", L"oox", L"zzz" });
+	CreateEdges(graph);
+	ASSERT_EQ(graph.GetComponentsCount(), 3);
+
+	// "boo" joins nothing, "bao" links "bat" with nothing yet, "bo" words link both components
+	LiveWordsGraph<Word> live(std::move(graph));
+	live.Update({ L"bao", L"boo" }, {});
+	auto snapshot = live.GetSnapshot();
+	ASSERT_TRUE(snapshot->HasComponents());
+	EXPECT_EQ(snapshot->GetComponentsCount(), 2);
+	EXPECT_TRUE(snapshot->IsReachable(snapshot->GetNodeIndex(L"rat"), snapshot->GetNodeIndex(L"oox")));
+	EXPECT_FALSE(snapshot->IsReachable(snapshot->GetNodeIndex(L"rat"), snapshot->GetNodeIndex(L"zzz")));
+	EXPECT_EQ(snapshot->GetLargestComponentSize(), 6);
+
+	// Leaf removal keeps labels, removal of a bridge splits the component
+	live.Update({}, { L"zzz" });
+	EXPECT_EQ(live.GetSnapshot()->GetComponentsCount(), 1);
+	live.Update({}, { L"bao" });
+	snapshot = live.GetSnapshot();
+	EXPECT_EQ(snapshot->GetComponentsCount(), 2);
+	EXPECT_FALSE(snapshot->IsReachable(snapshot->GetNodeIndex(L"rat"), snapshot->GetNodeIndex(L"oox")));
+
+	// Labels are the same as a full relabelling gives
+	Graph copy(*snapshot);
+	copy.LabelComponents();
+	for (Graph::NodeIndex v1 = 0; v1 < copy.GetSize(); ++v1)
+	{
+		for (Graph::NodeIndex v2 = 0; v2 < copy.GetSize(); ++v2)
+		{
+			if (!copy.IsRemoved(v1) && !copy.IsRemoved(v2))
+			{
+				EXPECT_EQ(snapshot->IsReachable(v1, v2), copy.IsReachable(v1, v2));
+			}
+		}
+	}
+}
+
+TEST(LiveGraphTest, TombstonesCompacted)
+{
+	typedef WordsGraph<Word> Graph;
+	Graph graph;
+	ReadWordsFromFile("./data/google-10000-english.txt", 4, graph);
+	CreateEdges(graph);
+	const size_t wordsCount = graph.GetSize();
+	LiveWordsGraph<Word> live(std::move(graph));
+	auto first = live.GetSnapshot();
+	const size_t memory = first->GetMemoryUsage();
+
+	// Daily churn: the same words are added and removed again and again
+	std::vector<Word> churn;
+	for (wchar_t c = L'a'; c <= L'z'; ++c)
+		churn.push_back(Word(L"mai") + c + L'x');
+	for (int i = 0; i < 200; ++i)
+	{
+		live.Update(churn, {});
+		live.Update({}, churn);
+
+		auto snapshot = live.GetSnapshot();
+		ASSERT_EQ(snapshot->GetWordsCount(), wordsCount);
+		ASSERT_LE(snapshot->GetRemovedCount() * LiveWordsGraph<Word>::CompactionRatio, snapshot->GetSize());
+	}
+
+	auto last = live.GetSnapshot();
+	EXPECT_LT(last->GetMemoryUsage(), memory * 2);
+	EXPECT_EQ(FindShortestPath(*last, Word(L"mail"), Word(L"grab")).size(),
+		FindShortestPath(*first, Word(L"mail"), Word(L"grab")).size());
+
+	// Compacted graph is the same as the graph built from scratch
+	EXPECT_EQ(last->GetEdgesCount(), first->GetEdgesCount());
+	EXPECT_EQ(last->GetComponentsCount(), first->GetComponentsCount());
+	live.Update({ L"maix" }, {});
+	Graph::Edges edges;
+	auto snapshot = live.GetSnapshot();
+	snapshot->GetEdges(snapshot->GetNodeIndex(L"maix"), edges);
+	EXPECT_TRUE(edges.count(snapshot->GetNodeIndex(L"mail")) == 1);
+}
+
+TEST(GraphCorrectness, CopiesShareStorage)
+{
+	typedef WordsGraph<Word> Graph;
+	Graph graph;
+	graph.SetSortedNodes(GenerateAllWords(3, 8));
+	CreateEdges(graph);
+
+	// Changes of a copy are not visible in the original
+	Graph copy(graph);
+	copy.RemoveNode(Word(L"abc"));
+	copy.AddNode(Word(L"xyz"));
+	copy.AddEdge(copy.GetNodeIndex(L"aaa"), copy.GetNodeIndex(L"xyz"));
+	copy.AddEdge(copy.GetNodeIndex(L"xyz"), copy.GetNodeIndex(L"aaa"));
+	copy.LabelComponents();
+
+	Graph::NodeIndex index;
+	EXPECT_TRUE(graph.FindNodeIndex(Word(L"abc"), index));
+	EXPECT_FALSE(graph.FindNodeIndex(Word(L"xyz"), index));
+	EXPECT_EQ(graph.GetEdges(graph.GetNodeIndex(L"abc")).size(), 21);
+	EXPECT_EQ(graph.GetEdges(graph.GetNodeIndex(L"aaa")).size(), 21);
+	EXPECT_EQ(graph.GetSize(), 512);
+	EXPECT_EQ(graph.GetComponentsCount(), 1);
+
+	EXPECT_FALSE(copy.FindNodeIndex(Word(L"abc"), index));
+	EXPECT_EQ(copy.GetEdges(copy.GetNodeIndex(L"aaa")).size(), 22);
+	EXPECT_EQ(copy.GetComponentsCount(), 1);
+	EXPECT_EQ(FindShortestPath(copy, Word(L"xyz"), Word(L"hhh")).size(), 5);
+}
+
 int main(int argc, char** argv)
 {
 	std::locale::global(std::locale(""));
@@ -0,0 +1,131 @@
+#ifndef HAMMING_H
+#define HAMMING_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// Words are compared in blocks of this many 16-bit code units
+#if defined(__AVX2__)
+const size_t PackedBlockSize = 16;
+#else
+const size_t PackedBlockSize = 8;
+#endif
+
+// Number of different code units in two packed words, stride is a multiple of PackedBlockSize
+inline size_t PackedHammingDistance(const uint16_t* w1, const uint16_t* w2, size_t stride)
+{
+	size_t distance = 0;
+	for (size_t i = 0; i < stride; i += PackedBlockSize)
+	{
+#if defined(__AVX2__)
+		__m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(w1 + i));
+		__m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(w2 + i));
+		// Two mask bits per equal 16-bit unit
+		uint32_t equal = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi16(a, b)));
+		distance += PackedBlockSize - __builtin_popcount(equal) / 2;
+#elif defined(__SSE2__)
+		__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(w1 + i));
+		__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(w2 + i));
+		uint32_t equal = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi16(a, b)));
+		distance += PackedBlockSize - __builtin_popcount(equal) / 2;
+#else
+		for (size_t j = i; j < i + PackedBlockSize; ++j)
+			distance += w1[j] != w2[j];
+#endif
+	}
+	return distance;
+}
+
+// Words of the same length stored as 16-bit code units in fixed size slots,
+// slots are padded with zeros up to a multiple of PackedBlockSize
+class PackedWords
+{
+public:
+	PackedWords() : m_length(0), m_stride(0), m_count(0)
+	{
+	}
+
+	// Fails if words have different length or some code unit doesn't fit into 16 bits
+	template <typename Iterator>
+	bool Pack(Iterator begin, Iterator end)
+	{
+		Clear();
+		if (begin == end)
+			return true;
+
+		m_length = begin->length();
+		m_stride = (m_length + PackedBlockSize - 1) / PackedBlockSize * PackedBlockSize;
+		m_count = std::distance(begin, end);
+		m_units.assign(m_count * m_stride, 0);
+
+		uint16_t* slot = m_units.data();
+		for (Iterator word = begin; word != end; ++word, slot += m_stride)
+		{
+			if (word->length() != m_length)
+				return Clear();
+
+			for (size_t i = 0; i < m_length; ++i)
+			{
+				uint32_t unit = static_cast<uint32_t>((*word)[i]);
+				if (unit > 0xFFFF)
+					return Clear();
+				slot[i] = static_cast<uint16_t>(unit);
+			}
+		}
+		return true;
+	}
+
+	size_t GetSize() const
+	{
+		return m_count;
+	}
+
+	size_t GetStride() const
+	{
+		return m_stride;
+	}
+
+	const uint16_t* GetWord(size_t index) const
+	{
+		return &m_units[index * m_stride];
+	}
+
+	size_t GetDistance(size_t index1, size_t index2) const
+	{
+		return PackedHammingDistance(GetWord(index1), GetWord(index2), m_stride);
+	}
+
+	// Compares one word with a block of words [first, first + count),
+	// indexes of words at exactly 'expectedDistance' are appended to result
+	void FindAtDistance(const uint16_t* word, size_t first, size_t count, size_t expectedDistance,
+		std::vector<size_t>& result) const
+	{
+		const uint16_t* slot = GetWord(first);
+		for (size_t i = 0; i < count; ++i, slot += m_stride)
+		{
+			if (PackedHammingDistance(word, slot, m_stride) == expectedDistance)
+				result.push_back(first + i);
+		}
+	}
+
+private:
+	bool Clear()
+	{
+		m_units.clear();
+		m_length = m_stride = m_count = 0;
+		return false;
+	}
+
+	std::vector<uint16_t> m_units;
+	size_t				  m_length;
+	size_t				  m_stride;
+	size_t				  m_count;
+};
+
+#endif // HAMMING_H
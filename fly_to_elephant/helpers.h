@@ -3,12 +3,19 @@
 
 #include "dijkstra.h"
 #include "words_graph.h"
+#include "parallel.h"
+#include "hamming.h"
+#include "string_pool.h"
+#include "utf8.h"
+#include "mapped_file.h"
 #include <string>
 #include <set>
 #include <fstream>
-
-#include <locale>
-#include <codecvt>
+#include <vector>
+#include <iterator>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
 
 typedef std::wstring Word;
 typedef std::set<Word> WordsList;
@@ -20,31 +27,104 @@ std::vector<W> FindShortestPath(const WordsGraph<W>& graph, const W& from, const
 	return graph.ConvertIndexesToWords(pathIndexes);
 }
 
-template<typename W>
-void ReadWordsFromFile(const std::string& filePath, const size_t wordLength, WordsGraph<W>& graph)
+// Parses part of UTF-8 dictionary file (whole lines only) and collects
+// lower cased words with length (in code points) from minLength to maxLength into pool
+template<typename Char>
+void ParseWords(const char* begin, const char* end, const size_t minLength, const size_t maxLength, StringPool<Char>& words)
 {
-	std::wifstream file(filePath);
-	W tempStr;
-	WordsList words;
-	auto& facet = std::use_facet<std::ctype<typename W::value_type>>(std::locale());
+	std::vector<Char> word;
 
-	while (std::getline(file, tempStr))
+	for (const char* line = begin; line < end; )
 	{
+		const char* lineEnd = static_cast<const char*>(std::memchr(line, '\n', end - line));
+		if (lineEnd == nullptr)
+			lineEnd = end;
+		const char* wordEnd = lineEnd;
 
 		// Remove escape symbols
-		while (tempStr.back() == '\r' || tempStr.back() == '\n' || tempStr.back() == ' ')
-			tempStr.pop_back();
+		while (wordEnd != line && (wordEnd[-1] == '\r' || wordEnd[-1] == ' '))
+			--wordEnd;
 
-		// We are working only with words of the same word length
-		if (tempStr.size() == wordLength)
+		// Words of other length are not even decoded.
+		// Every code point takes at least one byte and at most four.
+		size_t bytes = wordEnd - line;
+		if (bytes >= minLength && bytes / 4 <= maxLength && bytes != 0)
 		{
-			// Convert to lower case
-			facet.tolower(&tempStr[0], &tempStr[0] + tempStr.size());
-			words.insert(tempStr);
+			size_t length = Utf8Length(line, wordEnd);
+			if (word.size() < length)
+				word.resize(length);
+
+			// Broken lines are skipped
+			if (length >= minLength && length <= maxLength &&
+				DecodeUtf8Lower(line, wordEnd, word.data()) == static_cast<ptrdiff_t>(length))
+			{
+				words.Add(word.data(), length);
+			}
 		}
+
+		line = lineEnd + 1;
 	}
-	
-	graph.SetNodes(words);
+}
+
+// File is memory mapped and split into chunks by line boundaries, chunks are parsed in parallel.
+// Words are never allocated one by one: every chunk has its own pool and
+// unique words are copied from them into the pool of the graph.
+template<typename W>
+void ReadWordsFromFile(const std::string& filePath, const size_t minLength, const size_t maxLength, WordsGraph<W>& graph,
+	size_t threadsCount = GetDefaultThreadsCount())
+{
+	MappedFile file(filePath);
+	const char* data = file.GetData();
+	size_t size = file.GetSize();
+
+	// Skip UTF-8 byte order mark
+	if (size >= 3 && std::memcmp(data, "\xEF\xBB\xBF", 3) == 0)
+	{
+		data += 3;
+		size -= 3;
+	}
+
+	// Small files are not worth spawning threads
+	const size_t MinChunkSize = 64 * 1024;
+	threadsCount = std::max<size_t>(1, std::min(threadsCount, size / MinChunkSize));
+
+	std::vector<size_t> bounds(1, 0);
+	for (size_t i = 1; i < threadsCount; ++i)
+	{
+		size_t pos = std::max(bounds.back(), size * i / threadsCount);
+		const void* newLine = std::memchr(data + pos, '\n', size - pos);
+		if (newLine == nullptr)
+			break;
+		bounds.push_back(static_cast<const char*>(newLine) - data + 1);
+	}
+	bounds.push_back(size);
+
+	typedef typename WordsGraph<W>::Nodes Pool;
+	std::vector<Pool> chunks(bounds.size() - 1);
+	ParallelFor(chunks.size(), threadsCount, [&](size_t i)
+	{
+		ParseWords(data + bounds[i], data + bounds[i + 1], minLength, maxLength, chunks[i]);
+	});
+	std::vector<typename Pool::View> views;
+	for (const auto& chunk : chunks)
+		views.insert(views.end(), chunk.begin(), chunk.end());
+
+	std::sort(views.begin(), views.end());
+	views.erase(std::unique(views.begin(), views.end()), views.end());
+
+	Pool words;
+	words.Reserve(views.size());
+	for (const auto& view : views)
+		words.Add(view);
+	graph.SetSortedNodes(std::move(words));
+}
+
+// We are working only with words of the same word length
+template<typename W>
+void ReadWordsFromFile(const std::string& filePath, const size_t wordLength, WordsGraph<W>& graph,
+	size_t threadsCount = GetDefaultThreadsCount())
+{
+	ReadWordsFromFile(filePath, wordLength, wordLength, graph, threadsCount);
 }
 
 // Counts only number of different letters in a words, it is not an 'edit distance'
@@ -67,27 +147,217 @@ bool IsDistanceMeetsExpectations(const W& w1, const W& w2, size_t expectedDistan
 	return currentDistance == expectedDistance;
 }
 
-// Create edges in graph. 
-// Will be created edges only of the same word length and "edit distance" equals 1
+// Hash of the word with one letter (position) replaced by wildcard.
+// Words differing only in this position have equal hashes.
 template <class W>
-void CreateEdges(WordsGraph<W>& graph)
+uint64_t WildcardHash(const W& word, size_t position)
 {
-	for (auto w1 = graph.Begin(); w1 != graph.End(); w1++)
+	// FNV-1a
+	uint64_t hash = 14695981039346656037ULL ^ position;
+	for (size_t i = 0; i < word.length(); ++i)
+	{
+		if (i == position)
+			continue;
+		hash ^= static_cast<uint64_t>(word[i]);
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+// Creates undirected edges between words which share a bucket and are accepted by isNeighbour.
+// getKeys(word, keys) appends hashes of all buckets of the word.
+// Work is split between threads in three phases without any locks:
+//	1. Every thread hashes its range of words into per-shard bucket buffers
+//	2. Every thread sorts one shard and emits edges grouped by owner of the source node
+//	3. Every thread moves edges of its own range of nodes into the graph
+template <class W, class KeysFunc, class NeighbourFunc>
+void CreateEdgesByKeys(WordsGraph<W>& graph, size_t threadsCount, KeysFunc getKeys, NeighbourFunc isNeighbour)
+{
+	typedef typename WordsGraph<W>::NodeIndex NodeIndex;
+	typedef std::pair<uint64_t, NodeIndex> BucketEntry;
+	typedef std::pair<NodeIndex, NodeIndex> Edge;
+
+	const size_t nodesCount = graph.GetSize();
+	auto nodes = graph.Begin();
+
+	// Small graphs are not worth spawning threads
+	const size_t MinNodesPerThread = 1024;
+	threadsCount = std::max<size_t>(1, std::min(threadsCount, nodesCount / MinNodesPerThread));
+	const size_t shards = threadsCount;
+
+	auto rangeBegin = [&](size_t part) { return nodesCount * part / threadsCount; };
+	auto owner = [&](NodeIndex v)
+	{
+		size_t part = v * threadsCount / nodesCount;
+		while (rangeBegin(part + 1) <= v)
+			++part;
+		while (rangeBegin(part) > v)
+			--part;
+		return part;
+	};
+
+	// buckets[thread][shard]
+	std::vector<std::vector<std::vector<BucketEntry>>> buckets(threadsCount, std::vector<std::vector<BucketEntry>>(shards));
+	ParallelFor(threadsCount, threadsCount, [&](size_t thread)
 	{
-		for (auto w2 = graph.Begin(); w2 != graph.End(); w2++)
+		std::vector<uint64_t> keys;
+		for (NodeIndex v = rangeBegin(thread); v < rangeBegin(thread + 1); ++v)
 		{
-			if (w2 == w1)
-				continue;
+			keys.clear();
+			getKeys(nodes[v], keys);
+			for (uint64_t hash : keys)
+				buckets[thread][hash % shards].push_back(std::make_pair(hash, v));
+		}
+	});
 
-			// Graph should contain only words with distance equals 1
-			bool result = IsDistanceMeetsExpectations(*w1, *w2, 1);
-			if (result)
+	// edges[shard][owner thread]
+	std::vector<std::vector<std::vector<Edge>>> edges(shards, std::vector<std::vector<Edge>>(threadsCount));
+	ParallelFor(shards, threadsCount, [&](size_t shard)
+	{
+		std::vector<BucketEntry> entries;
+		for (size_t thread = 0; thread < threadsCount; ++thread)
+		{
+			auto& part = buckets[thread][shard];
+			entries.insert(entries.end(), part.begin(), part.end());
+			std::vector<BucketEntry>().swap(part);
+		}
+		std::sort(entries.begin(), entries.end());
+
+		for (auto first = entries.begin(); first != entries.end(); )
+		{
+			auto last = first;
+			while (last != entries.end() && last->first == first->first)
+				++last;
+
+			for (auto w1 = first; w1 != last; ++w1)
 			{
-				graph.AddEdge(*w1, *w2);
-				graph.AddEdge(*w2, *w1);
+				for (auto w2 = w1 + 1; w2 != last; ++w2)
+				{
+					// Hash collisions are filtered out here
+					if (isNeighbour(w1->second, w2->second))
+					{
+						edges[shard][owner(w1->second)].push_back(std::make_pair(w1->second, w2->second));
+						edges[shard][owner(w2->second)].push_back(std::make_pair(w2->second, w1->second));
+					}
+				}
 			}
+			first = last;
 		}
+	});
+
+	ParallelFor(threadsCount, threadsCount, [&](size_t thread)
+	{
+		NodeIndex begin = rangeBegin(thread);
+		std::vector<typename WordsGraph<W>::Edges> adjacency(rangeBegin(thread + 1) - begin);
+		for (size_t shard = 0; shard < shards; ++shard)
+		{
+			for (const Edge& edge : edges[shard][thread])
+				adjacency[edge.first - begin].insert(edge.second);
+		}
+
+		for (size_t i = 0; i < adjacency.size(); ++i)
+			graph.SetEdges(begin + i, std::move(adjacency[i]));
+	});
+
+	graph.LabelComponents();
+}
+
+// Create edges in graph. 
+// Will be created edges only of the same word length and "edit distance" equals 1
+//
+// Every word is put into L wildcard buckets ("c_t", "_at", "ca_"), neighbours are the words
+// sharing a bucket.
+template <class W>
+void CreateEdges(WordsGraph<W>& graph, size_t threadsCount = GetDefaultThreadsCount())
+{
+	typedef typename WordsGraph<W>::NodeIndex NodeIndex;
+	auto nodes = graph.Begin();
+
+	// Vectorized comparison if all words fit into 16-bit code units
+	PackedWords packed;
+	const bool isPacked = packed.Pack(graph.Begin(), graph.End()) && graph.GetSize() != 0;
+
+	CreateEdgesByKeys(graph, threadsCount,
+		[](const typename WordsGraph<W>::NodeView& word, std::vector<uint64_t>& keys)
+		{
+			for (size_t position = 0; position < word.length(); ++position)
+				keys.push_back(WildcardHash(word, position));
+		},
+		[&](NodeIndex v1, NodeIndex v2)
+		{
+			return isPacked ? packed.GetDistance(v1, v2) == 1 : IsDistanceMeetsExpectations(nodes[v1], nodes[v2], 1);
+		});
+}
+
+// Levenshtein distance equals 1: one letter is substituted, inserted or deleted
+template <typename W>
+bool IsEditDistanceOne(const W& w1, const W& w2)
+{
+	if (w1.length() == w2.length())
+		return IsDistanceMeetsExpectations(w1, w2, 1);
+
+	if (w1.length() + 1 == w2.length())
+		return IsEditDistanceOne(w2, w1);
+
+	if (w1.length() != w2.length() + 1)
+		return false;
+
+	// w1 is longer: skip the first mismatching letter, the rest should be equal
+	size_t i = 0;
+	while (i < w2.length() && w1[i] == w2[i])
+		++i;
+	for (; i < w2.length(); ++i)
+	{
+		if (w1[i + 1] != w2[i])
+			return false;
 	}
+	return true;
+}
+
+// Hash of the word with one letter deleted, whole word if position is out of range.
+// Unlike WildcardHash position is not mixed in, so "ct" from "cat" and "ct" itself are equal.
+template <class W>
+uint64_t DeletionHash(const W& word, size_t position)
+{
+	// FNV-1a
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < word.length(); ++i)
+	{
+		if (i == position)
+			continue;
+		hash ^= static_cast<uint64_t>(word[i]);
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+// Create edges between words of any length with "edit distance" equals 1.
+//
+// Symmetric delete index: every word is put into the bucket of itself and buckets of all its
+// single letter deletions ("cat" -> "cat", "at", "ct", "ca"). Substitution makes equal deletions
+// at the same position, insertion makes the shorter word equal to a deletion of the longer one,
+// so all neighbours share a bucket. Index takes L + 1 entries per word.
+template <class W>
+void CreateEditDistanceEdges(WordsGraph<W>& graph, size_t threadsCount = GetDefaultThreadsCount())
+{
+	typedef typename WordsGraph<W>::NodeIndex NodeIndex;
+	auto nodes = graph.Begin();
+
+	CreateEdgesByKeys(graph, threadsCount,
+		[](const typename WordsGraph<W>::NodeView& word, std::vector<uint64_t>& keys)
+		{
+			keys.push_back(DeletionHash(word, word.length()));
+			for (size_t position = 0; position < word.length(); ++position)
+				keys.push_back(DeletionHash(word, position));
+
+			// Repeated letters give equal deletions ("book" -> "bok" twice)
+			std::sort(keys.begin(), keys.end());
+			keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+		},
+		[&](NodeIndex v1, NodeIndex v2)
+		{
+			return IsEditDistanceOne(nodes[v1], nodes[v2]);
+		});
 }
 
 // Find shortest path using Dijkstra algorithm
@@ -100,4 +370,15 @@ std::vector<W> FindPath(const std::string& filePath, const W& from, const W& to)
 	return FindShortestPath(graph, from, to);
 }
 
+// Find shortest path where every step substitutes, inserts or deletes one letter,
+// so words of any length from the dictionary can be in the path
+template<typename W>
+std::vector<W> FindEditPath(const std::string& filePath, const W& from, const W& to)
+{
+	WordsGraph<W> graph;
+	ReadWordsFromFile(filePath, 1, std::numeric_limits<size_t>::max(), graph);
+	CreateEditDistanceEdges(graph);
+	return FindShortestPath(graph, from, to);
+}
+
 #endif // HELPERS_H
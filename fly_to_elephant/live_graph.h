@@ -0,0 +1,144 @@
+#ifndef LIVE_GRAPH_H
+#define LIVE_GRAPH_H
+
+#include "helpers.h"
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Graph which can be updated while other threads search in it.
+// Readers take an immutable snapshot (shared_ptr) and keep using it as long as they need,
+// writer applies a batch of changes to a copy and publishes it atomically (copy-on-write),
+// old snapshot is freed by the last reader.
+//
+// Copy of the graph shares all its chunks (words, index, adjacency, labels) with the previous snapshot,
+// only chunks of changed nodes are copied. Neighbours of new words are found through wildcard buckets
+// which are kept by the writer and components are merged incrementally, so an update costs
+// O(changed words * L) plus O(N / chunk size) for the copy. Removing a word with several neighbours
+// can split its component, then components are labelled again.
+//
+// Removed words stay as tombstones, so indexes of words don't change between snapshots until
+// tombstones take more than 1 / CompactionRatio of the graph: then the graph is compacted and words
+// are renumbered. Indexes should not be passed from one snapshot to another.
+template <typename W>
+class LiveWordsGraph
+{
+public:
+	typedef WordsGraph<W>						Graph;
+	typedef typename Graph::NodeIndex			NodeIndex;
+	typedef std::shared_ptr<const Graph>		Snapshot;
+
+	static const size_t CompactionRatio = 4;
+
+	// Graph should be already built (nodes and edges)
+	explicit LiveWordsGraph(Graph&& graph)
+	{
+		if (!graph.HasComponents())
+			graph.LabelComponents();
+		FillBuckets(graph);
+		m_snapshot = std::make_shared<const Graph>(std::move(graph));
+	}
+
+	// Current state of the graph, safe to call from any thread
+	Snapshot GetSnapshot() const
+	{
+		return std::atomic_load(&m_snapshot);
+	}
+
+	// Applies one batch of changes and publishes new snapshot. Writers are serialized.
+	void Update(const std::vector<W>& addedWords, const std::vector<W>& removedWords)
+	{
+		std::lock_guard<std::mutex> lock(m_writeMutex);
+		auto graph = std::make_shared<Graph>(*GetSnapshot());
+
+		for (const auto& word : removedWords)
+		{
+			NodeIndex index;
+			if (graph->FindNodeIndex(word, index))
+			{
+				RemoveFromBuckets(word, index);
+				graph->RemoveNode(word);
+			}
+		}
+
+		for (const auto& word : addedWords)
+		{
+			NodeIndex index;
+			if (graph->FindNodeIndex(word, index))
+				continue;
+
+			index = graph->AddNode(word);
+			for (size_t position = 0; position < word.length(); ++position)
+			{
+				for (NodeIndex neighbour : m_buckets[WildcardHash(word, position)])
+				{
+					// Hash collisions and words of other length are filtered out here
+					auto other = graph->GetNodeView(neighbour);
+					if (other.length() == word.length() && IsDistanceMeetsExpectations(typename Graph::NodeView(word), other, 1))
+					{
+						graph->AddEdge(index, neighbour);
+						graph->AddEdge(neighbour, index);
+					}
+				}
+			}
+			AddToBuckets(word, index);
+		}
+
+		if (graph->GetRemovedCount() * CompactionRatio > graph->GetSize())
+		{
+			graph->Compact();
+			FillBuckets(*graph);
+		}
+		else if (!graph->HasComponents())
+		{
+			graph->LabelComponents();
+		}
+		std::atomic_store(&m_snapshot, Snapshot(std::move(graph)));
+	}
+
+private:
+	void FillBuckets(const Graph& graph)
+	{
+		m_buckets.clear();
+		auto nodes = graph.Begin();
+		for (NodeIndex v = 0; v < graph.GetSize(); ++v)
+		{
+			if (!graph.IsRemoved(v))
+				AddToBuckets(nodes[v], v);
+		}
+	}
+
+	template <typename Word>
+	void AddToBuckets(const Word& word, NodeIndex index)
+	{
+		for (size_t position = 0; position < word.length(); ++position)
+			m_buckets[WildcardHash(word, position)].push_back(index);
+	}
+
+	void RemoveFromBuckets(const W& word, NodeIndex index)
+	{
+		for (size_t position = 0; position < word.length(); ++position)
+		{
+			auto bucket = m_buckets.find(WildcardHash(word, position));
+			if (bucket == m_buckets.end())
+				continue;
+
+			auto& indexes = bucket->second;
+			indexes.erase(std::remove(indexes.begin(), indexes.end(), index), indexes.end());
+			if (indexes.empty())
+				m_buckets.erase(bucket);
+		}
+	}
+
+	Snapshot												m_snapshot;
+	std::mutex												m_writeMutex;
+
+	// Wildcard hash -> words in the bucket, used only by the writer
+	std::unordered_map<uint64_t, std::vector<NodeIndex>>	m_buckets;
+};
+
+template <typename W>
+const size_t LiveWordsGraph<W>::CompactionRatio;
+
+#endif // LIVE_GRAPH_H
@@ -7,11 +7,16 @@
 
 #include "words_graph.h"
 #include "helpers.h"
+#include "batch.h"
 
 
 void ShowHelp(char** argv)
 {
 	std::cout << "Usage: " << argv[0] << " path_to_input_file path_to_dictionary" << std::endl;
+	std::cout << "       " << argv[0] << " --edit path_to_input_file path_to_dictionary" << std::endl;
+	std::cout << "       " << argv[0] << " --batch [--landmarks directory] path_to_queries_file|- path_to_dictionary [threads]" << std::endl;
+	std::cout << "Queries file contains one query per line: from_word to_word, '-' means stdin" << std::endl;
+	std::cout << "With --landmarks landmarks of big batches are cached in the directory: dictionary_file_name.<length>.alt" << std::endl;
 }
 
 bool IsFileExists(const std::string& name)
@@ -23,9 +28,82 @@ bool IsFileExists(const std::string& name)
 		return false;
 }
 
+// Answers many queries at once, graph for every word length is built only once
+int RunBatch(int argc, char** argv)
+{
+	int index = 2;
+	std::string landmarksDirectory;
+	if (argc > index + 1 && std::string(argv[index]) == "--landmarks")
+	{
+		landmarksDirectory = argv[index + 1];
+		index += 2;
+	}
+	if (argc - index != 2 && argc - index != 3)
+	{
+		ShowHelp(argv);
+		return 0;
+	}
+
+	std::string queriesPath = argv[index], dictionaryPath = argv[index + 1];
+	if ((queriesPath != "-" && !IsFileExists(queriesPath)) || !IsFileExists(dictionaryPath))
+	{
+		ShowHelp(argv);
+		return 0;
+	}
+
+	size_t threadsCount = argc - index == 3 ? std::stoul(argv[index + 2]) : GetDefaultThreadsCount();
+
+	std::vector<Query<Word>> queries;
+	if (queriesPath == "-")
+	{
+		ReadQueries(std::wcin, queries);
+	}
+	else
+	{
+		std::wifstream file(queriesPath);
+		ReadQueries(file, queries);
+	}
+
+	auto results = SolveBatch(dictionaryPath, queries, threadsCount, landmarksDirectory);
+	for (size_t i = 0; i < queries.size(); ++i)
+	{
+		if (!results[i].empty())
+		{
+			for (const auto& p : results[i])
+				std::wcout << p << L'\n';
+		}
+		else
+		{
+			std::wcout << L"No path from '" << queries[i].from << L"' to '" << queries[i].to << L"'\n";
+		}
+		std::wcout << L'\n';
+	}
+	std::wcout.flush();
+
+	return 0;
+}
+
 int main(int argc, char** argv)
 {
-	if (argc != 3 || !IsFileExists(argv[1]) || !IsFileExists(argv[2]))
+	if (argc >= 2 && std::string(argv[1]) == "--batch")
+	{
+		std::locale::global(std::locale(""));
+		try
+		{
+			return RunBatch(argc, argv);
+		}
+		catch (std::exception& e)
+		{
+			std::cout << e.what() << std::endl;
+			return 0;
+		}
+	}
+
+	// Letters can be also inserted and deleted, words can be of different length
+	bool editMode = argc == 4 && std::string(argv[1]) == "--edit";
+	char** paths = editMode ? argv + 2 : argv + 1;
+
+	if ((argc != 3 && !editMode) || !IsFileExists(paths[0]) || !IsFileExists(paths[1]))
 	{
 		ShowHelp(argv);
 		return 0;
@@ -38,34 +116,33 @@ int main(int argc, char** argv)
 		std::list<Word> firstTwoWords;
 		{
 			
-			std::string filePath = argv[1];
+			std::string filePath = paths[0];
 			std::wifstream file(filePath);
 
 			Word word;
 			if (!std::getline(file, word) || word.empty())
 				throw std::runtime_error("Empty input word");
 
-			auto& facet = std::use_facet<std::ctype<typename Word::value_type>>(std::locale());
-
-			facet.tolower(&word[0], &word[0] + word.size());
+			// Same case folding as dictionary loader
+			ToLower(word);
 			firstTwoWords.push_back(word);
 			word.clear();
 
 			if (!std::getline(file, word) || word.empty())
 				throw std::runtime_error("Empty input word");
 			
-			facet.tolower(&word[0], &word[0] + word.size());
+			ToLower(word);
 			firstTwoWords.push_back(word);
 		}
 
 
-		std::string dictionaryPath = argv[2];
+		std::string dictionaryPath = paths[1];
 		Word fromWord = firstTwoWords.front(), toWord = firstTwoWords.back();
 
-		if (fromWord.length() != toWord.length())
+		if (fromWord.length() != toWord.length() && !editMode)
 			throw std::runtime_error("Words are of different length");
 
-		std::vector<Word> wl = FindPath(dictionaryPath, fromWord, toWord);
+		std::vector<Word> wl = editMode ? FindEditPath(dictionaryPath, fromWord, toWord) : FindPath(dictionaryPath, fromWord, toWord);
 		if (!wl.empty())
 		{
 			for (const auto& p : wl)
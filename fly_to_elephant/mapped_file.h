@@ -0,0 +1,77 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <string>
+#include <fstream>
+#include <iterator>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Read only view of the whole file. File is memory mapped where it is possible,
+// otherwise it is read into memory.
+class MappedFile
+{
+public:
+	explicit MappedFile(const std::string& filePath) : m_data(nullptr), m_size(0), m_mapped(false)
+	{
+#ifndef _WIN32
+		int fd = open(filePath.c_str(), O_RDONLY);
+		if (fd != -1)
+		{
+			struct stat buffer;
+			if (fstat(fd, &buffer) == 0 && buffer.st_size > 0)
+			{
+				void* data = mmap(nullptr, buffer.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+				if (data != MAP_FAILED)
+				{
+					madvise(data, buffer.st_size, MADV_SEQUENTIAL);
+					m_data = static_cast<const char*>(data);
+					m_size = buffer.st_size;
+					m_mapped = true;
+				}
+			}
+			close(fd);
+		}
+		if (m_mapped)
+			return;
+#endif
+		std::ifstream file(filePath, std::ios::binary);
+		m_buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+		m_data = m_buffer.data();
+		m_size = m_buffer.size();
+	}
+
+	~MappedFile()
+	{
+#ifndef _WIN32
+		if (m_mapped)
+			munmap(const_cast<char*>(m_data), m_size);
+#endif
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	const char* GetData() const
+	{
+		return m_data;
+	}
+
+	size_t GetSize() const
+	{
+		return m_size;
+	}
+
+private:
+	const char* m_data;
+	size_t		m_size;
+	bool		m_mapped;
+	std::string m_buffer;
+};
+
+#endif // MAPPED_FILE_H
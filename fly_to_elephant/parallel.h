@@ -0,0 +1,59 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <exception>
+#include <algorithm>
+
+// Number of worker threads to use when caller did not specify it
+inline size_t GetDefaultThreadsCount()
+{
+	size_t count = std::thread::hardware_concurrency();
+	return count != 0 ? count : 1;
+}
+
+// Calls func(i) for every i in [0, count) on a pool of threadsCount workers.
+// Workers take indexes one by one, so long and short tasks are balanced.
+// First exception thrown by func is rethrown in the calling thread.
+template <typename Func>
+void ParallelFor(size_t count, size_t threadsCount, Func func)
+{
+	threadsCount = std::max<size_t>(1, std::min(threadsCount, count));
+
+	std::atomic<size_t> next(0);
+	std::exception_ptr error;
+	std::atomic<bool> failed(false);
+
+	auto worker = [&]()
+	{
+		for (size_t i = next++; i < count && !failed; i = next++)
+		{
+			try
+			{
+				func(i);
+			}
+			catch (...)
+			{
+				if (!failed.exchange(true))
+					error = std::current_exception();
+			}
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (size_t i = 1; i < threadsCount; ++i)
+		threads.emplace_back(worker);
+
+	// Calling thread works too
+	worker();
+
+	for (auto& thread : threads)
+		thread.join();
+
+	if (error)
+		std::rethrow_exception(error);
+}
+
+#endif // PARALLEL_H
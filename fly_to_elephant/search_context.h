@@ -0,0 +1,105 @@
+#ifndef SEARCH_CONTEXT_H
+#define SEARCH_CONTEXT_H
+
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <cstdint>
+#include "bucket_queue.h"
+
+// State of one shortest path search that can be reused by the next search on the same thread.
+// Arrays are sized once per graph; every node slot is stamped with the search generation,
+// so a slot with an old stamp is treated as untouched and Reset doesn't clear anything.
+template <typename IndexType, typename DistanceType = uint32_t>
+class SearchContext
+{
+public:
+	typedef DistanceType					 Distance;
+	typedef BucketQueue<IndexType, Distance> Queue;
+
+	static const Distance Infinity = std::numeric_limits<Distance>::max();
+
+	SearchContext() : m_queue(1), m_generation(0)
+	{
+	}
+
+	// Starts a new search. Costs O(1) unless graph size has changed or generation counter wrapped around.
+	// Queue accepts distances from minDistance up to minDistance + maxWeight at first.
+	void Reset(size_t nodesCount, Distance maxWeight, Distance minDistance = 0)
+	{
+		if (m_nodes.size() != nodesCount)
+		{
+			m_nodes.assign(nodesCount, Node());
+			m_generation = 0;
+		}
+
+		if (++m_generation == 0)
+		{
+			std::fill(m_nodes.begin(), m_nodes.end(), Node());
+			m_generation = 1;
+		}
+
+		m_queue.Reset(maxWeight, minDistance);
+	}
+
+	Distance GetDistance(IndexType v) const
+	{
+		return m_nodes[v].reached == m_generation ? m_nodes[v].distance : Infinity;
+	}
+
+	void SetDistance(IndexType v, Distance distance, IndexType parent)
+	{
+		Node& node = m_nodes[v];
+		node.distance = distance;
+		node.parent = parent;
+		node.reached = m_generation;
+	}
+
+	bool IsClosed(IndexType v) const
+	{
+		return m_nodes[v].closed == m_generation;
+	}
+
+	void Close(IndexType v)
+	{
+		m_nodes[v].closed = m_generation;
+	}
+
+	Queue& GetQueue()
+	{
+		return m_queue;
+	}
+
+	// Path by parents of the last search, empty if end wasn't reached
+	std::vector<IndexType> RestorePath(IndexType start, IndexType end) const
+	{
+		std::vector<IndexType> path;
+		if (GetDistance(end) == Infinity)
+			return path;
+
+		for (IndexType v = end; v != start; v = m_nodes[v].parent)
+			path.push_back(v);
+		path.push_back(start);
+		std::reverse(path.begin(), path.end());
+		return path;
+	}
+
+private:
+	// Everything search touches for a node is in one place
+	struct Node
+	{
+		Distance  distance = Infinity;
+		uint32_t  reached = 0;
+		uint32_t  closed = 0;
+		IndexType parent = 0;
+	};
+
+	std::vector<Node> m_nodes;
+	Queue			  m_queue;
+	uint32_t		  m_generation;
+};
+
+template <typename IndexType, typename DistanceType>
+const DistanceType SearchContext<IndexType, DistanceType>::Infinity;
+
+#endif // SEARCH_CONTEXT_H
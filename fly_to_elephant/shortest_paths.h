@@ -0,0 +1,341 @@
+#ifndef SHORTEST_PATHS_H
+#define SHORTEST_PATHS_H
+
+#include "words_graph.h"
+#include "dijkstra.h"
+#include <vector>
+#include <deque>
+#include <set>
+#include <unordered_map>
+#include <limits>
+#include <memory>
+#include <algorithm>
+
+// Enumerates all shortest paths between two nodes one by one.
+// Layered DAG of shortest paths is built once with two BFS (from start and from end),
+// paths are produced lazily by depth first walk over the DAG, so the whole set
+// (which can be exponential) is never kept in memory.
+template <typename Graph>
+class ShortestPathsEnumerator
+{
+public:
+	typedef typename Graph::NodeIndex NodeIndex;
+	typedef std::vector<NodeIndex>	  Path;
+
+	static const size_t Unreachable = std::numeric_limits<size_t>::max();
+
+	ShortestPathsEnumerator(const Graph& graph, NodeIndex start, NodeIndex end)
+		: m_start(start), m_end(end), m_length(Unreachable), m_started(false)
+	{
+		if (!graph.IsReachable(start, end))
+			return;
+
+		std::vector<size_t> fromStart, toEnd;
+		m_length = Bfs(graph, start, end, Unreachable, fromStart);
+		if (m_length == Unreachable)
+			return;
+		Bfs(graph, end, start, m_length, toEnd);
+
+		// Edge u -> v is in DAG if it moves one layer further from start and one layer closer to end
+		typename Graph::Edges edges;
+		for (NodeIndex u = 0; u < graph.GetSize(); ++u)
+		{
+			if (fromStart[u] == Unreachable || toEnd[u] == Unreachable || fromStart[u] + toEnd[u] != m_length || u == end)
+				continue;
+
+			auto& successors = m_dag[u];
+			graph.GetEdges(u, edges);
+			for (NodeIndex v : edges)
+			{
+				if (fromStart[v] == fromStart[u] + 1 && toEnd[v] + 1 == toEnd[u])
+					successors.push_back(v);
+			}
+		}
+	}
+
+	// Number of edges in every shortest path, Unreachable if there is no path
+	size_t GetPathLength() const
+	{
+		return m_length;
+	}
+
+	// Writes next shortest path, returns false when all paths were enumerated
+	bool Next(Path& path)
+	{
+		if (m_length == Unreachable)
+			return false;
+
+		if (!m_started)
+		{
+			m_started = true;
+			m_stack.push_back(std::make_pair(m_start, 0));
+		}
+		else if (!m_stack.empty())
+		{
+			// Previous call stopped at the end node
+			m_stack.pop_back();
+		}
+
+		while (!m_stack.empty())
+		{
+			auto& top = m_stack.back();
+			if (top.first == m_end)
+			{
+				path.clear();
+				for (const auto& item : m_stack)
+					path.push_back(item.first);
+				return true;
+			}
+
+			// Every DAG node leads to the end, so there are no dead ends
+			const auto& successors = m_dag[top.first];
+			if (top.second < successors.size())
+				m_stack.push_back(std::make_pair(successors[top.second++], 0));
+			else
+				m_stack.pop_back();
+		}
+
+		return false;
+	}
+
+private:
+	// Distances from 'from', search stops on the layer where 'to' is found or after maxDistance
+	static size_t Bfs(const Graph& graph, NodeIndex from, NodeIndex to, size_t maxDistance, std::vector<size_t>& d)
+	{
+		d.assign(graph.GetSize(), Unreachable);
+		d[from] = 0;
+
+		std::deque<NodeIndex> q(1, from);
+		typename Graph::Edges edges;
+		while (!q.empty())
+		{
+			NodeIndex v = q.front();
+			q.pop_front();
+			if (v == to || d[v] >= maxDistance)
+				continue;
+
+			graph.GetEdges(v, edges);
+			for (NodeIndex next : edges)
+			{
+				if (d[next] == Unreachable)
+				{
+					d[next] = d[v] + 1;
+					q.push_back(next);
+				}
+			}
+
+			// Nodes after the layer of 'to' can't be on a shortest path
+			if (d[to] != Unreachable && (q.empty() || d[q.front()] >= d[to]))
+				break;
+		}
+		return d[to];
+	}
+
+	NodeIndex m_start;
+	NodeIndex m_end;
+	size_t	  m_length;
+	bool	  m_started;
+
+	// Successors of every node lying on some shortest path
+	std::unordered_map<NodeIndex, Path> m_dag;
+
+	// Current path with position of the next successor to try for every node
+	std::vector<std::pair<NodeIndex, size_t>> m_stack;
+};
+
+template <typename Graph>
+const size_t ShortestPathsEnumerator<Graph>::Unreachable;
+
+// Returns up to 'limit' different shortest ladders between two words (all of the minimal length,
+// see FindKShortestPaths for longer alternatives)
+template <typename W>
+std::vector<std::vector<W>> FindShortestPaths(const WordsGraph<W>& graph, const W& from, const W& to,
+	size_t limit = std::numeric_limits<size_t>::max())
+{
+	std::vector<std::vector<W>> result;
+	ShortestPathsEnumerator<WordsGraph<W>> paths(graph, graph.GetNodeIndex(from), graph.GetNodeIndex(to));
+
+	typename ShortestPathsEnumerator<WordsGraph<W>>::Path path;
+	while (result.size() < limit && paths.Next(path))
+		result.push_back(graph.ConvertIndexesToWords(path));
+
+	return result;
+}
+
+// Graph with some nodes and some edges of one node hidden, everything else is delegated.
+// Used by k shortest paths search to find detours without copying the graph.
+template <typename Graph>
+class RestrictedGraph
+{
+public:
+	typedef typename Graph::NodeIndex NodeIndex;
+	typedef std::vector<NodeIndex>	  Edges;
+
+	explicit RestrictedGraph(const Graph& graph)
+		: m_graph(graph), m_blockedNodes(graph.GetSize(), false), m_edgesOwner(0)
+	{
+	}
+
+	size_t GetSize() const
+	{
+		return m_graph.GetSize();
+	}
+
+	// Hiding nodes and edges can only make nodes unreachable
+	bool IsReachable(NodeIndex from, NodeIndex to) const
+	{
+		return m_graph.IsReachable(from, to);
+	}
+
+	void BlockNode(NodeIndex v, bool isBlocked)
+	{
+		m_blockedNodes[v] = isBlocked;
+	}
+
+	// Hides edges owner -> to for every 'to' in the list, edges of other nodes are visible
+	void BlockEdges(NodeIndex owner, std::vector<NodeIndex>&& to)
+	{
+		m_edgesOwner = owner;
+		m_blockedEdges = std::move(to);
+	}
+
+	// Reference is valid until the next call
+	const Edges& GetEdges(NodeIndex v) const
+	{
+		m_edges.clear();
+		for (NodeIndex to : m_graph.GetEdges(v))
+		{
+			if (m_blockedNodes[to])
+				continue;
+			if (v == m_edgesOwner && std::find(m_blockedEdges.begin(), m_blockedEdges.end(), to) != m_blockedEdges.end())
+				continue;
+			m_edges.push_back(to);
+		}
+		return m_edges;
+	}
+
+private:
+	const Graph&		   m_graph;
+	std::vector<bool>	   m_blockedNodes;
+	NodeIndex			   m_edgesOwner;
+	std::vector<NodeIndex> m_blockedEdges;
+	mutable Edges		   m_edges;
+};
+
+// Enumerates loopless paths between two nodes in order of length (Yen's algorithm):
+// the shortest path first, then alternatives including longer ones.
+// Every next path is the best detour of an already found one: for every node of the last found path
+// (spur node) the search is repeated from it with the root part of the path hidden and with edges
+// leaving the spur node along already found paths with the same root hidden.
+// Detours wait in a set of candidates ordered by length, so each call costs O(path length) searches.
+template <typename Graph>
+class KShortestPathsEnumerator
+{
+public:
+	typedef typename Graph::NodeIndex NodeIndex;
+	typedef std::vector<NodeIndex>	  Path;
+
+	// Context is reused by all searches, pass one to share it with other calls on the same thread
+	KShortestPathsEnumerator(const Graph& graph, NodeIndex start, NodeIndex end,
+		SearchContext<NodeIndex>* context = nullptr)
+		: m_graph(graph), m_restricted(graph), m_start(start), m_end(end), m_context(context)
+	{
+		if (m_context == nullptr)
+		{
+			m_ownContext.reset(new SearchContext<NodeIndex>());
+			m_context = m_ownContext.get();
+		}
+	}
+
+	// Writes next path, returns false when there are no more loopless paths
+	bool Next(Path& path)
+	{
+		if (m_found.empty())
+		{
+			Path shortest = Dijkstra(m_graph, m_start, m_end, UnitWeight(), *m_context);
+			if (shortest.empty())
+				return false;
+			m_found.push_back(shortest);
+			path = shortest;
+			return true;
+		}
+
+		AddDetours(m_found.back());
+		if (m_candidates.empty())
+			return false;
+
+		m_found.push_back(*m_candidates.begin());
+		m_candidates.erase(m_candidates.begin());
+		path = m_found.back();
+		return true;
+	}
+
+private:
+	// Shorter paths first, equal ones in lexicographic order of indexes
+	struct PathLess
+	{
+		bool operator()(const Path& p1, const Path& p2) const
+		{
+			return p1.size() != p2.size() ? p1.size() < p2.size() : p1 < p2;
+		}
+	};
+
+	void AddDetours(const Path& last)
+	{
+		for (size_t i = 0; i + 1 < last.size(); ++i)
+		{
+			NodeIndex spur = last[i];
+
+			// Next nodes of found paths going through the same root
+			std::vector<NodeIndex> usedEdges;
+			for (const Path& found : m_found)
+			{
+				if (found.size() > i + 1 && std::equal(last.begin(), last.begin() + i + 1, found.begin()))
+					usedEdges.push_back(found[i + 1]);
+			}
+
+			for (size_t j = 0; j < i; ++j)
+				m_restricted.BlockNode(last[j], true);
+			m_restricted.BlockEdges(spur, std::move(usedEdges));
+
+			Path spurPath = Dijkstra(m_restricted, spur, m_end, UnitWeight(), *m_context);
+
+			for (size_t j = 0; j < i; ++j)
+				m_restricted.BlockNode(last[j], false);
+
+			if (spurPath.empty())
+				continue;
+
+			Path candidate(last.begin(), last.begin() + i);
+			candidate.insert(candidate.end(), spurPath.begin(), spurPath.end());
+			m_candidates.insert(std::move(candidate));
+		}
+	}
+
+	const Graph&							  m_graph;
+	RestrictedGraph<Graph>					  m_restricted;
+	NodeIndex								  m_start;
+	NodeIndex								  m_end;
+	SearchContext<NodeIndex>*				  m_context;
+	std::unique_ptr<SearchContext<NodeIndex>> m_ownContext;
+
+	std::vector<Path>						  m_found;
+	std::set<Path, PathLess>				  m_candidates;
+};
+
+// Returns up to 'k' loopless ladders between two words, shortest first. Unlike FindShortestPaths
+// longer alternatives are returned too when there are less than 'k' shortest ladders.
+template <typename W>
+std::vector<std::vector<W>> FindKShortestPaths(const WordsGraph<W>& graph, const W& from, const W& to, size_t k)
+{
+	std::vector<std::vector<W>> result;
+	KShortestPathsEnumerator<WordsGraph<W>> paths(graph, graph.GetNodeIndex(from), graph.GetNodeIndex(to));
+
+	typename KShortestPathsEnumerator<WordsGraph<W>>::Path path;
+	while (result.size() < k && paths.Next(path))
+		result.push_back(graph.ConvertIndexesToWords(path));
+
+	return result;
+}
+
+#endif // SHORTEST_PATHS_H
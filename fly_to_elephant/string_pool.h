@@ -0,0 +1,375 @@
+#ifndef STRING_POOL_H
+#define STRING_POOL_H
+
+#include <string>
+#include <vector>
+#include <iterator>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include "cow_vector.h"
+
+// Non owning reference to a string stored somewhere else (pool, buffer)
+template <typename Char>
+class StringView
+{
+public:
+	StringView() : m_data(nullptr), m_length(0)
+	{
+	}
+
+	StringView(const Char* data, size_t length) : m_data(data), m_length(length)
+	{
+	}
+
+	StringView(const std::basic_string<Char>& str) : m_data(str.data()), m_length(str.length())
+	{
+	}
+
+	const Char* data() const { return m_data; }
+	size_t length() const { return m_length; }
+	size_t size() const { return m_length; }
+	bool empty() const { return m_length == 0; }
+	const Char* begin() const { return m_data; }
+	const Char* end() const { return m_data + m_length; }
+	Char operator[](size_t i) const { return m_data[i]; }
+
+	std::basic_string<Char> str() const
+	{
+		return std::basic_string<Char>(m_data, m_length);
+	}
+
+	bool operator==(const StringView& other) const
+	{
+		return m_length == other.m_length && std::equal(begin(), end(), other.begin());
+	}
+
+	bool operator!=(const StringView& other) const
+	{
+		return !(*this == other);
+	}
+
+	bool operator<(const StringView& other) const
+	{
+		return std::lexicographical_compare(begin(), end(), other.begin(), other.end());
+	}
+
+private:
+	const Char* m_data;
+	size_t		m_length;
+};
+
+template <typename Char>
+bool operator==(const StringView<Char>& view, const std::basic_string<Char>& str)
+{
+	return view == StringView<Char>(str);
+}
+
+template <typename Char>
+bool operator==(const std::basic_string<Char>& str, const StringView<Char>& view)
+{
+	return view == StringView<Char>(str);
+}
+
+// Arena for strings: code units are kept in chunks of ChunkSize consecutive strings, strings are addressed by ids.
+// While all strings have the same length they are stored in fixed size slots without offsets.
+// Chunks are shared between copies of the pool and copied on write, so a copy costs O(count / ChunkSize)
+// and appending to a copy copies only its last chunk.
+template <typename Char>
+class StringPool
+{
+public:
+	typedef uint32_t		Id;
+	typedef StringView<Char> View;
+
+	static const size_t ChunkBits = 6;
+	static const size_t ChunkSize = size_t(1) << ChunkBits;
+
+	// Random access iterator over strings in order of ids
+	class Iterator
+	{
+	public:
+		typedef std::random_access_iterator_tag iterator_category;
+		typedef View							value_type;
+		typedef std::ptrdiff_t					difference_type;
+		typedef const View*						pointer;
+		typedef View							reference;
+
+		Iterator(const StringPool* pool = nullptr, Id id = 0) : m_pool(pool), m_id(id) {}
+
+		View operator*() const { return m_pool->Get(m_id); }
+		View operator[](std::ptrdiff_t n) const { return m_pool->Get(static_cast<Id>(m_id + n)); }
+
+		Iterator& operator++() { ++m_id; return *this; }
+		Iterator operator++(int) { Iterator it(*this); ++m_id; return it; }
+		Iterator& operator--() { --m_id; return *this; }
+		Iterator& operator+=(std::ptrdiff_t n) { m_id = static_cast<Id>(m_id + n); return *this; }
+		Iterator operator+(std::ptrdiff_t n) const { return Iterator(m_pool, static_cast<Id>(m_id + n)); }
+		std::ptrdiff_t operator-(const Iterator& other) const { return static_cast<std::ptrdiff_t>(m_id) - other.m_id; }
+
+		bool operator==(const Iterator& other) const { return m_id == other.m_id; }
+		bool operator!=(const Iterator& other) const { return m_id != other.m_id; }
+		bool operator<(const Iterator& other) const { return m_id < other.m_id; }
+
+		// Allows iterator->length() like for a container of strings
+		struct Arrow
+		{
+			View view;
+			const View* operator->() const { return &view; }
+		};
+		Arrow operator->() const { return Arrow{ **this }; }
+
+	private:
+		const StringPool* m_pool;
+		Id				  m_id;
+	};
+
+	StringPool() : m_stride(0), m_count(0), m_isFixedStride(true)
+	{
+	}
+
+	// Chunk table for count strings, units are allocated chunk by chunk as strings are added
+	void Reserve(size_t count)
+	{
+		m_chunks.reserve((count + ChunkSize - 1) / ChunkSize);
+	}
+
+	Id Add(const Char* data, size_t length)
+	{
+		if (m_isFixedStride)
+		{
+			if (m_count == 0)
+				m_stride = length;
+			else if (length != m_stride)
+				SwitchToOffsets();
+		}
+
+		if (m_count % ChunkSize == 0)
+		{
+			m_chunks.push_back(std::make_shared<Chunk>());
+			if (m_isFixedStride)
+				m_chunks.back()->units.reserve(ChunkSize * m_stride);
+			else
+				m_chunks.back()->offsets.push_back(0);
+		}
+
+		Chunk& chunk = GetMutableChunk(m_chunks.size() - 1);
+		chunk.units.insert(chunk.units.end(), data, data + length);
+		if (!m_isFixedStride)
+			chunk.offsets.push_back(static_cast<uint32_t>(chunk.units.size()));
+		return static_cast<Id>(m_count++);
+	}
+
+	Id Add(const View& view)
+	{
+		return Add(view.data(), view.length());
+	}
+
+	View Get(Id id) const
+	{
+		const Chunk& chunk = *m_chunks[id >> ChunkBits];
+		const size_t i = id & (ChunkSize - 1);
+		if (m_isFixedStride)
+			return View(chunk.units.data() + i * m_stride, m_stride);
+		return View(chunk.units.data() + chunk.offsets[i], chunk.offsets[i + 1] - chunk.offsets[i]);
+	}
+
+	size_t GetSize() const
+	{
+		return m_count;
+	}
+
+	// Heap memory used by pool (chunks shared with copies too)
+	size_t GetMemoryUsage() const
+	{
+		size_t usage = m_chunks.capacity() * sizeof(ChunkPtr);
+		for (const auto& chunk : m_chunks)
+			usage += sizeof(Chunk) + chunk->units.capacity() * sizeof(Char) + chunk->offsets.capacity() * sizeof(uint32_t);
+		return usage;
+	}
+
+	void Clear()
+	{
+		m_chunks.clear();
+		m_stride = m_count = 0;
+		m_isFixedStride = true;
+	}
+
+	Iterator begin() const
+	{
+		return Iterator(this, 0);
+	}
+
+	Iterator end() const
+	{
+		return Iterator(this, static_cast<Id>(m_count));
+	}
+
+private:
+	struct Chunk
+	{
+		std::vector<Char>	  units;
+
+		// Start of every string of the chunk plus end of the last one, empty while all strings are m_stride long
+		std::vector<uint32_t> offsets;
+	};
+	typedef std::shared_ptr<Chunk> ChunkPtr;
+
+	Chunk& GetMutableChunk(size_t index)
+	{
+		ChunkPtr& chunk = m_chunks[index];
+		if (chunk.use_count() > 1)
+			chunk = std::make_shared<Chunk>(*chunk);
+		return *chunk;
+	}
+
+	// First string of another length: every chunk gets explicit offsets
+	void SwitchToOffsets()
+	{
+		for (size_t index = 0; index < m_chunks.size(); ++index)
+		{
+			Chunk& chunk = GetMutableChunk(index);
+			size_t count = chunk.units.size() / m_stride;
+			chunk.offsets.resize(count + 1);
+			for (size_t i = 0; i <= count; ++i)
+				chunk.offsets[i] = static_cast<uint32_t>(i * m_stride);
+		}
+		m_isFixedStride = false;
+	}
+
+	std::vector<ChunkPtr> m_chunks;
+	size_t				  m_stride;
+	size_t				  m_count;
+	bool				  m_isFixedStride;
+};
+
+template <typename Char>
+const size_t StringPool<Char>::ChunkBits;
+
+template <typename Char>
+const size_t StringPool<Char>::ChunkSize;
+
+// Open addressing (linear probing) hash table from string to its id in pool.
+// Slots are copy-on-write chunks like strings of the pool, so copies of the index share unchanged slots.
+template <typename Char>
+class StringIndex
+{
+public:
+	typedef typename StringPool<Char>::Id	Id;
+	typedef typename StringPool<Char>::View View;
+
+	static const Id NotFound = UINT32_MAX;
+
+	StringIndex() : m_count(0)
+	{
+	}
+
+	void Build(const StringPool<Char>& pool)
+	{
+		m_count = 0;
+		m_slots.clear();
+		Rehash(pool, pool.GetSize() * 2);
+		for (Id id = 0; id < pool.GetSize(); ++id)
+			Insert(pool, id);
+	}
+
+	// String with this id should be already added to pool
+	void Insert(const StringPool<Char>& pool, Id id)
+	{
+		if ((m_count + 1) * 2 > m_slots.size())
+			Rehash(pool, (m_count + 1) * 2);
+
+		size_t slot = FindSlot(pool, pool.Get(id));
+		if (m_slots[slot] == NotFound)
+			m_count++;
+		m_slots.Mutable(slot) = id;
+	}
+
+	// Removes id from the index, string should still be available in pool
+	void Erase(const StringPool<Char>& pool, Id id)
+	{
+		if (m_slots.empty())
+			return;
+
+		size_t slot = FindSlot(pool, pool.Get(id));
+		if (m_slots[slot] != id)
+			return;
+
+		// Backward shift deletion keeps probe chains valid without tombstones
+		const size_t mask = m_slots.size() - 1;
+		m_slots.Mutable(slot) = NotFound;
+		m_count--;
+		for (size_t next = (slot + 1) & mask; m_slots[next] != NotFound; next = (next + 1) & mask)
+		{
+			size_t home = Hash(pool.Get(m_slots[next])) & mask;
+
+			// Element can fill the hole if the hole is between its home slot and its current slot
+			if (((next - home) & mask) >= ((next - slot) & mask))
+			{
+				m_slots.Mutable(slot) = m_slots[next];
+				m_slots.Mutable(next) = NotFound;
+				slot = next;
+			}
+		}
+	}
+
+	Id Find(const StringPool<Char>& pool, const View& str) const
+	{
+		if (m_slots.empty())
+			return NotFound;
+		return m_slots[FindSlot(pool, str)];
+	}
+
+	size_t GetMemoryUsage() const
+	{
+		return m_slots.GetMemoryUsage();
+	}
+
+	static size_t Hash(const View& str)
+	{
+		// FNV-1a
+		uint64_t hash = 14695981039346656037ULL;
+		for (Char c : str)
+		{
+			hash ^= static_cast<uint64_t>(c);
+			hash *= 1099511628211ULL;
+		}
+		return static_cast<size_t>(hash ^ (hash >> 32));
+	}
+
+private:
+	// Slot with the string or the first empty slot of its probe chain
+	size_t FindSlot(const StringPool<Char>& pool, const View& str) const
+	{
+		const size_t mask = m_slots.size() - 1;
+		size_t slot = Hash(str) & mask;
+		while (m_slots[slot] != NotFound && pool.Get(m_slots[slot]) != str)
+			slot = (slot + 1) & mask;
+		return slot;
+	}
+
+	void Rehash(const StringPool<Char>& pool, size_t minSize)
+	{
+		size_t size = 16;
+		while (size < minSize)
+			size *= 2;
+
+		CowVector<Id> old;
+		old.assign(size, NotFound);
+		std::swap(old, m_slots);
+		for (size_t i = 0; i < old.size(); ++i)
+		{
+			if (old[i] != NotFound)
+				m_slots.Mutable(FindSlot(pool, pool.Get(old[i]))) = old[i];
+		}
+	}
+
+	CowVector<Id> m_slots;
+	size_t		  m_count;
+};
+
+template <typename Char>
+const typename StringIndex<Char>::Id StringIndex<Char>::NotFound;
+
+#endif // STRING_POOL_H
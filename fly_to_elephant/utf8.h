@@ -0,0 +1,126 @@
+#ifndef UTF8_H
+#define UTF8_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <limits>
+
+// Lower case mapping for code points below CaseTableSize (Latin, Greek, Cyrillic),
+// other code points are left as is. Doesn't depend on the global locale.
+const uint32_t CaseTableSize = 0x530;
+
+class CaseTable
+{
+public:
+	static const CaseTable& Get()
+	{
+		static const CaseTable table;
+		return table;
+	}
+
+	uint32_t ToLower(uint32_t codePoint) const
+	{
+		return codePoint < CaseTableSize ? m_lower[codePoint] : codePoint;
+	}
+
+private:
+	CaseTable() : m_lower(CaseTableSize)
+	{
+		for (uint32_t c = 0; c < CaseTableSize; ++c)
+			m_lower[c] = static_cast<uint16_t>(c);
+
+		SetRange(0x41, 0x5A, 0x20);		// A-Z
+		SetRange(0xC0, 0xD6, 0x20);		// Latin-1 À-Ö
+		SetRange(0xD8, 0xDE, 0x20);		// Latin-1 Ø-Þ
+		SetPairs(0x100, 0x12F);			// Latin Extended-A
+		SetPairs(0x132, 0x137);
+		SetPairs(0x139, 0x148);
+		SetPairs(0x14A, 0x177);
+		m_lower[0x178] = 0xFF;			// Ÿ -> ÿ
+		SetPairs(0x179, 0x17E);			// Ź-ž
+		SetRange(0x391, 0x3A1, 0x20);	// Greek Α-Ρ
+		SetRange(0x3A3, 0x3AB, 0x20);	// Greek Σ-Ϋ
+		SetRange(0x400, 0x40F, 0x50);	// Cyrillic Ѐ-Џ (Ё -> ё)
+		SetRange(0x410, 0x42F, 0x20);	// Cyrillic А-Я
+		SetPairs(0x460, 0x481);			// Cyrillic historic letters
+		SetPairs(0x48A, 0x4BF);
+		SetPairs(0x4D0, 0x52F);
+	}
+
+	void SetRange(uint32_t first, uint32_t last, uint32_t shift)
+	{
+		for (uint32_t c = first; c <= last; ++c)
+			m_lower[c] = static_cast<uint16_t>(c + shift);
+	}
+
+	// Letters go in pairs from first to last, first of each pair is upper case, the next one is its lower case
+	void SetPairs(uint32_t first, uint32_t last)
+	{
+		for (uint32_t c = first; c < last; c += 2)
+			m_lower[c] = static_cast<uint16_t>(c + 1);
+	}
+
+	std::vector<uint16_t> m_lower;
+};
+
+// Number of code points in valid UTF-8: every byte except continuation ones starts a code point
+inline size_t Utf8Length(const char* begin, const char* end)
+{
+	size_t length = 0;
+	for (const char* c = begin; c != end; ++c)
+		length += (static_cast<unsigned char>(*c) & 0xC0) != 0x80;
+	return length;
+}
+
+// Decodes UTF-8 and lower cases every code point, returns number of written units
+// or -1 if sequence is broken, overlong, encodes a surrogate or a value over U+10FFFF,
+// or code point doesn't fit into Char
+template <typename Char>
+ptrdiff_t DecodeUtf8Lower(const char* begin, const char* end, Char* out)
+{
+	static const uint32_t MinCodePoints[] = { 0, 0x80, 0x800, 0x10000 };
+	const CaseTable& table = CaseTable::Get();
+	Char* start = out;
+
+	for (const unsigned char* c = reinterpret_cast<const unsigned char*>(begin),
+		*last = reinterpret_cast<const unsigned char*>(end); c != last; )
+	{
+		uint32_t codePoint = *c++;
+		if (codePoint >= 0x80)
+		{
+			size_t tail = codePoint >= 0xF0 ? 3 : codePoint >= 0xE0 ? 2 : codePoint >= 0xC0 ? 1 : 0;
+			if (tail == 0 || codePoint >= 0xF8 || static_cast<size_t>(last - c) < tail)
+				return -1;
+
+			codePoint &= 0x3F >> tail;
+			for (size_t i = 0; i < tail; ++i, ++c)
+			{
+				if ((*c & 0xC0) != 0x80)
+					return -1;
+				codePoint = (codePoint << 6) | (*c & 0x3F);
+			}
+			if (codePoint < MinCodePoints[tail] || codePoint > 0x10FFFF || (codePoint >= 0xD800 && codePoint <= 0xDFFF))
+				return -1;
+		}
+
+		codePoint = table.ToLower(codePoint);
+		if (static_cast<uint64_t>(codePoint) > static_cast<uint64_t>(std::numeric_limits<Char>::max()))
+			return -1;
+		*out++ = static_cast<Char>(codePoint);
+	}
+
+	return out - start;
+}
+
+// Lower cases already decoded string with the same table as dictionary loader
+template <typename W>
+void ToLower(W& word)
+{
+	const CaseTable& table = CaseTable::Get();
+	for (auto& c : word)
+		c = static_cast<typename W::value_type>(table.ToLower(static_cast<uint32_t>(c)));
+}
+
+#endif // UTF8_H
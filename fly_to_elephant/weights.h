@@ -0,0 +1,191 @@
+#ifndef WEIGHTS_H
+#define WEIGHTS_H
+
+#include "dijkstra.h"
+#include "words_graph.h"
+#include "utf8.h"
+#include <unordered_map>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// Cost of a step depends on how far the replaced letters are on the keyboard:
+// neighbouring keys are typical typos and cost 1, far keys, insertions and deletions cost MaxCost.
+// QWERTY and ЙЦУКЕН layouts are supported, other letters always cost MaxCost.
+template <typename Graph>
+class KeyboardWeight
+{
+public:
+	static const uint32_t MaxCost = 3;
+
+	explicit KeyboardWeight(const Graph& graph) : m_graph(graph)
+	{
+		AddLayout({ L"qwertyuiop", L"asdfghjkl", L"zxcvbnm" });
+		AddLayout({ L"йцукенгшщзхъ", L"фывапролджэ", L"ячсмитьбю" });
+	}
+
+	uint32_t GetMaxWeight() const
+	{
+		return MaxCost;
+	}
+
+	uint32_t operator()(typename Graph::NodeIndex from, typename Graph::NodeIndex to) const
+	{
+		auto w1 = m_graph.GetNodeView(from), w2 = m_graph.GetNodeView(to);
+		if (w1.length() != w2.length())
+			return MaxCost;
+
+		for (size_t i = 0; i < w1.length(); ++i)
+		{
+			if (w1[i] != w2[i])
+				return GetKeyCost(w1[i], w2[i]);
+		}
+		return MaxCost;
+	}
+
+	uint32_t GetKeyCost(uint32_t c1, uint32_t c2) const
+	{
+		auto key1 = m_keys.find(c1), key2 = m_keys.find(c2);
+		if (key1 == m_keys.end() || key2 == m_keys.end() || key1->second.layout != key2->second.layout)
+			return MaxCost;
+
+		// Rows are shifted by half of a key, so x is kept doubled
+		int dx = std::abs(key1->second.x2 - key2->second.x2), dy = std::abs(key1->second.y - key2->second.y);
+		uint32_t distance = static_cast<uint32_t>(std::max(dy, (dx + 1) / 2));
+		return std::max<uint32_t>(1, std::min(distance, MaxCost));
+	}
+
+private:
+	struct Key
+	{
+		int layout;
+		int x2;
+		int y;
+	};
+
+	void AddLayout(const std::vector<std::wstring>& rows)
+	{
+		int layout = m_layouts++;
+		for (size_t row = 0; row < rows.size(); ++row)
+		{
+			for (size_t i = 0; i < rows[row].length(); ++i)
+				m_keys[rows[row][i]] = Key{ layout, static_cast<int>(2 * i + row), static_cast<int>(row) };
+		}
+	}
+
+	const Graph&					  m_graph;
+	std::unordered_map<uint32_t, Key> m_keys;
+	int								  m_layouts = 0;
+};
+
+template <typename Graph>
+const uint32_t KeyboardWeight<Graph>::MaxCost;
+
+// Cost of a step is 1 plus penalty for rare target word: words are split into 'levels' groups
+// by frequency rank, the most frequent group has no penalty, unknown words get the largest one.
+template <typename Graph>
+class FrequencyWeight
+{
+public:
+	FrequencyWeight(const Graph& graph, uint32_t levels = 4)
+		: m_levels(levels), m_penalties(graph.GetSize(), levels), m_graph(graph)
+	{
+	}
+
+	uint32_t GetMaxWeight() const
+	{
+		return 1 + m_levels;
+	}
+
+	uint32_t operator()(typename Graph::NodeIndex, typename Graph::NodeIndex to) const
+	{
+		return 1 + m_penalties[to];
+	}
+
+	// Words are sorted from the most frequent one
+	template <typename W>
+	void SetWordsByFrequency(const std::vector<W>& words)
+	{
+		std::fill(m_penalties.begin(), m_penalties.end(), m_levels);
+		for (size_t rank = 0; rank < words.size(); ++rank)
+		{
+			typename Graph::NodeIndex index;
+			if (m_graph.FindNodeIndex(words[rank], index))
+				m_penalties[index] = std::min<uint32_t>(m_penalties[index], static_cast<uint32_t>(rank * m_levels / words.size()));
+		}
+	}
+
+	// UTF-8 file with one word per line, the most frequent first (like google-10000-english.txt)
+	bool LoadWordsByFrequency(const std::string& filePath)
+	{
+		std::ifstream file(filePath, std::ios::binary);
+		if (!file)
+			return false;
+
+		std::vector<std::wstring> words;
+		std::string line;
+		while (std::getline(file, line))
+		{
+			while (!line.empty() && (line.back() == '\r' || line.back() == ' '))
+				line.pop_back();
+
+			std::wstring word(line.size(), 0);
+			ptrdiff_t length = DecodeUtf8Lower(line.data(), line.data() + line.size(), &word[0]);
+			if (length > 0)
+			{
+				word.resize(length);
+				words.push_back(word);
+			}
+		}
+
+		SetWordsByFrequency(words);
+		return true;
+	}
+
+private:
+	uint32_t			  m_levels;
+	std::vector<uint32_t> m_penalties;
+	const Graph&		  m_graph;
+};
+
+// Sum of two weights, e.g. keyboard distance and frequency penalty
+template <typename Weight1, typename Weight2>
+class CombinedWeight
+{
+public:
+	CombinedWeight(const Weight1& weight1, const Weight2& weight2) : m_weight1(weight1), m_weight2(weight2)
+	{
+	}
+
+	uint32_t GetMaxWeight() const
+	{
+		return m_weight1.GetMaxWeight() + m_weight2.GetMaxWeight();
+	}
+
+	template <typename IndexType>
+	uint32_t operator()(IndexType from, IndexType to) const
+	{
+		return m_weight1(from, to) + m_weight2(from, to);
+	}
+
+private:
+	const Weight1& m_weight1;
+	const Weight2& m_weight2;
+};
+
+template <typename Weight1, typename Weight2>
+CombinedWeight<Weight1, Weight2> CombineWeights(const Weight1& weight1, const Weight2& weight2)
+{
+	return CombinedWeight<Weight1, Weight2>(weight1, weight2);
+}
+
+// Path with the smallest sum of weights ("most natural" ladder), not the smallest number of steps
+template <typename W, typename Weight>
+std::vector<W> FindCheapestPath(const WordsGraph<W>& graph, const W& from, const W& to, const Weight& weight)
+{
+	auto pathIndexes = Dijkstra(graph, graph.GetNodeIndex(from), graph.GetNodeIndex(to), weight);
+	return graph.ConvertIndexesToWords(pathIndexes);
+}
+
+#endif // WEIGHTS_H
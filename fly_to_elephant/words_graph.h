@@ -8,35 +8,60 @@
 #include <set>
 #include <sstream>
 #include <cstdint>
+#include <limits>
+#include <vector>
+#include "disjoint_sets.h"
+#include "string_pool.h"
+#include "cow_vector.h"
 
 template <typename W>
 class WordsGraph
 {
 public:	
 	typedef size_t				 	 NodeIndex;
-	typedef std::vector<W>			 Nodes;
-	typedef typename Nodes::iterator NodesIterator;
+	typedef typename W::value_type	 Char;
+	typedef StringPool<Char>		 Nodes;
+	typedef typename Nodes::View	 NodeView;
+	typedef typename Nodes::Iterator NodesIterator;
 	typedef std::set<NodeIndex>		 Edges;
 	typedef std::vector<W>			 Path;
 
-	NodesIterator Begin()
+	NodesIterator Begin() const
 	{
 		return m_nodes.begin();
 	}
 
-	NodesIterator End()
+	NodesIterator End() const
 	{
 		return m_nodes.end();
 	}
 
 	size_t GetSize() const
 	{
-		return m_nodes.size();
+		return m_nodes.GetSize();
 	}
 
 	void SetNodes(const std::set<W>& nodes)
 	{
-		std::copy(nodes.begin(), nodes.end(), std::back_inserter(m_nodes));
+		m_nodes.Clear();
+		for (const auto& node : nodes)
+			m_nodes.Add(node.data(), node.length());
+		ResetNodes();
+	}
+
+	// Nodes should be already sorted and unique
+	void SetSortedNodes(Nodes&& nodes)
+	{
+		m_nodes = std::move(nodes);
+		ResetNodes();
+	}
+
+	void SetSortedNodes(const std::vector<W>& nodes)
+	{
+		m_nodes.Clear();
+		for (const auto& node : nodes)
+			m_nodes.Add(node.data(), node.length());
+		ResetNodes();
 	}
 
 	void GetEdges(const W& word, Edges& edges)
@@ -46,17 +71,246 @@ public:
 
 	void GetEdges(NodeIndex index, Edges& edges) const
 	{
-		edges.clear();
-		auto it = m_edges.find(index);
-		if (it != m_edges.end())
-			edges = it->second;
+		edges = m_edges[index];
+	}
+
+	// Same without copying, reference is valid until edges of the node are changed
+	const Edges& GetEdges(NodeIndex index) const
+	{
+		return m_edges[index];
+	}
+
+	// Replaces all edges of the node. Can be called concurrently for different nodes
+	// while the graph is not shared with its copies, components are updated only by LabelComponents.
+	void SetEdges(NodeIndex index, Edges&& edges)
+	{
+		m_edges.Mutable(index) = std::move(edges);
 	}
 
 	void AddEdge(const W& node1, const W& node2)
 	{
-		NodeIndex index1 = GetNodeIndex(node1), index2 = GetNodeIndex(node2);
+		AddEdge(GetNodeIndex(node1), GetNodeIndex(node2));
+	}
+
+	// Components stay labelled: if nodes were in different components, the smaller one is relabelled
+	void AddEdge(NodeIndex index1, NodeIndex index2)
+	{
 		if (index1 != index2)
-			m_edges[GetNodeIndex(node1)].insert(GetNodeIndex(node2));
+		{
+			m_edges.Mutable(index1).insert(index2);
+			if (HasComponents())
+				MergeComponents(index1, index2);
+		}
+	}
+
+	// Appends word with a new index (indexes of other words are not changed),
+	// returns index of existing word if it is already in the graph.
+	// New word is a new component if components are labelled.
+	NodeIndex AddNode(const NodeView& word)
+	{
+		NodeIndex index;
+		if (FindNodeIndex(word, index))
+			return index;
+
+		const bool hasComponents = HasComponents();
+		index = m_nodes.Add(word);
+		m_index.Insert(m_nodes, static_cast<typename Nodes::Id>(index));
+		m_edges.push_back(Edges());
+		m_removed.push_back(false);
+
+		if (hasComponents)
+		{
+			m_componentIds.push_back(m_componentSizes.size());
+			m_componentSizes.push_back(1);
+			m_componentsCount++;
+		}
+		return index;
+	}
+
+	// Removes word and all its edges. Index is not reused: word stays in storage
+	// as a tombstone until Compact, so indexes of other words are stable.
+	// Labels are kept if the word had at most one neighbour (component can't split),
+	// otherwise LabelComponents should be called again.
+	bool RemoveNode(const NodeView& word)
+	{
+		NodeIndex index;
+		if (!FindNodeIndex(word, index))
+			return false;
+
+		const size_t degree = m_edges[index].size();
+		for (NodeIndex to : m_edges[index])
+			m_edges.Mutable(to).erase(index);
+		m_edges.Mutable(index).clear();
+
+		m_index.Erase(m_nodes, static_cast<typename Nodes::Id>(index));
+		m_removed.Mutable(index) = true;
+		m_removedCount++;
+
+		if (HasComponents() && degree <= 1)
+		{
+			size_t id = m_componentIds[index];
+			if (--m_componentSizes.Mutable(id) == 0)
+				m_componentsCount--;
+			m_componentIds.Mutable(index) = NoComponent;
+		}
+		else
+		{
+			m_componentIds.clear();
+		}
+		return true;
+	}
+
+	// Drops removed words: remaining words get new indexes (in the same order),
+	// edges are renumbered and components labelled again. Costs O(N + E).
+	void Compact()
+	{
+		if (m_removedCount == 0)
+			return;
+
+		const NodeIndex NoIndex = std::numeric_limits<NodeIndex>::max();
+		std::vector<NodeIndex> newIndexes(GetSize(), NoIndex);
+		Nodes nodes;
+		for (NodeIndex v = 0; v < GetSize(); ++v)
+		{
+			if (!m_removed[v])
+				newIndexes[v] = nodes.Add(GetNodeView(v));
+		}
+
+		CowVector<Edges> edges;
+		for (NodeIndex v = 0; v < GetSize(); ++v)
+		{
+			if (m_removed[v])
+				continue;
+
+			// Renumbering keeps the order, so every edge is appended to the end of the set
+			Edges renumbered;
+			for (NodeIndex to : m_edges[v])
+				renumbered.insert(renumbered.end(), newIndexes[to]);
+			edges.push_back(renumbered);
+		}
+
+		m_nodes = std::move(nodes);
+		ResetNodes();
+		m_edges = std::move(edges);
+		LabelComponents();
+	}
+
+	bool IsRemoved(NodeIndex index) const
+	{
+		return m_removed[index];
+	}
+
+	// Number of words without removed ones
+	size_t GetWordsCount() const
+	{
+		return GetSize() - m_removedCount;
+	}
+
+	// Number of removed words still kept as tombstones
+	size_t GetRemovedCount() const
+	{
+		return m_removedCount;
+	}
+
+	// Assigns component id to every node, should be called when all edges are added.
+	// Edges are treated as undirected (CreateEdges always adds both directions).
+	void LabelComponents()
+	{
+		DisjointSets sets;
+		sets.Reset(GetSize());
+		for (NodeIndex v = 0; v < GetSize(); ++v)
+		{
+			for (NodeIndex to : m_edges[v])
+				sets.Union(v, to);
+		}
+
+		std::vector<size_t> rootIds(GetSize(), NoComponent);
+		std::vector<size_t> ids(GetSize(), NoComponent);
+		std::vector<size_t> sizes;
+
+		for (NodeIndex v = 0; v < GetSize(); ++v)
+		{
+			if (m_removed[v])
+				continue;
+
+			size_t& id = rootIds[sets.Find(v)];
+			if (id == NoComponent)
+			{
+				id = sizes.size();
+				sizes.push_back(0);
+			}
+			ids[v] = id;
+			sizes[id]++;
+		}
+
+		m_componentIds.clear();
+		for (size_t id : ids)
+			m_componentIds.push_back(id);
+		m_componentSizes.clear();
+		for (size_t size : sizes)
+			m_componentSizes.push_back(size);
+		m_componentsCount = sizes.size();
+	}
+
+	bool HasComponents() const
+	{
+		return GetSize() != 0 && m_componentIds.size() == GetSize();
+	}
+
+	// O(1) check, if components are not labelled yet every pair is treated as reachable
+	bool IsReachable(NodeIndex from, NodeIndex to) const
+	{
+		return !HasComponents() || m_componentIds[from] == m_componentIds[to];
+	}
+
+	size_t GetComponentId(NodeIndex index) const
+	{
+		return m_componentIds[index];
+	}
+
+	// Number of non empty components
+	size_t GetComponentsCount() const
+	{
+		return HasComponents() ? m_componentsCount : 0;
+	}
+
+	// Ids are less than this bound. Components merged by AddEdge keep their ids with zero size.
+	size_t GetComponentIdsBound() const
+	{
+		return HasComponents() ? m_componentSizes.size() : 0;
+	}
+
+	size_t GetComponentSize(size_t componentId) const
+	{
+		return m_componentSizes[componentId];
+	}
+
+	size_t GetLargestComponentSize() const
+	{
+		size_t largest = 0;
+		for (size_t id = 0; id < GetComponentIdsBound(); ++id)
+			largest = std::max(largest, m_componentSizes[id]);
+		return largest;
+	}
+
+	// Number of directed edges
+	size_t GetEdgesCount() const
+	{
+		size_t count = 0;
+		for (NodeIndex v = 0; v < GetSize(); ++v)
+			count += m_edges[v].size();
+		return count;
+	}
+
+	// Approximate heap memory used by the graph (parts shared with its copies too)
+	size_t GetMemoryUsage() const
+	{
+		// Node of std::set: value plus three pointers and color
+		const size_t EdgeSize = sizeof(NodeIndex) + 3 * sizeof(void*) + sizeof(int);
+
+		return m_nodes.GetMemoryUsage() + m_index.GetMemoryUsage() +
+			m_edges.GetMemoryUsage() + GetEdgesCount() * EdgeSize +
+			m_removed.GetMemoryUsage() + m_componentIds.GetMemoryUsage() + m_componentSizes.GetMemoryUsage();
 	}
 
 	Path ConvertIndexesToWords(const std::vector<NodeIndex>& p) const
@@ -69,34 +323,101 @@ public:
 
 	W GetNodeValue(NodeIndex index) const
 	{
-		return m_nodes[index];
+		return GetNodeView(index).str();
+	}
+
+	// Reference to the word inside the graph storage, doesn't allocate
+	NodeView GetNodeView(NodeIndex index) const
+	{
+		return m_nodes.Get(static_cast<typename Nodes::Id>(index));
 	}
 
 	size_t GetNodeIndex(const W& word) const
 	{
-		auto it = BinaryFind(m_nodes.cbegin(), m_nodes.cend(), word);
-		if (it == m_nodes.end())
+		NodeIndex index;
+		if (!FindNodeIndex(word, index))
 		{
 			std::wcout << "Word '" << word.c_str() << "' not found in dictionary" << std::endl;
 			throw std::runtime_error("");
 		}
-		return (it - m_nodes.begin());
+		return index;
+	}
+
+	// Same as GetNodeIndex, but doesn't throw when word is absent
+	bool FindNodeIndex(const NodeView& word, NodeIndex& index) const
+	{
+		auto id = m_index.Find(m_nodes, word);
+		if (id == StringIndex<Char>::NotFound)
+			return false;
+		index = id;
+		return true;
 	}
 
 private:
+	static const size_t NoComponent = std::numeric_limits<size_t>::max();
 
-	template<class ForwardIt, class Compare = std::less<std::wstring>>
-	ForwardIt BinaryFind(ForwardIt first, ForwardIt last, const W& value, Compare comp = {}) const
+	void ResetNodes()
 	{
-		first = std::lower_bound(first, last, value, comp);
-		return first != last && !comp(value, *first) ? first : last;
+		m_index.Build(m_nodes);
+		m_edges.assign(GetSize(), Edges());
+		m_removed.assign(GetSize(), false);
+		m_removedCount = 0;
+		m_componentIds.clear();
 	}
+
+	// Relabels the smaller of two components by BFS inside it, so every node is relabelled
+	// O(log N) times in total and a series of insertions never walks the whole graph
+	void MergeComponents(NodeIndex index1, NodeIndex index2)
+	{
+		size_t id1 = m_componentIds[index1], id2 = m_componentIds[index2];
+		if (id1 == id2)
+			return;
+
+		if (m_componentSizes[id1] < m_componentSizes[id2])
+		{
+			std::swap(id1, id2);
+			std::swap(index1, index2);
+		}
+
+		std::vector<NodeIndex> q(1, index2);
+		m_componentIds.Mutable(index2) = id1;
+		for (size_t i = 0; i < q.size(); ++i)
+		{
+			for (NodeIndex to : m_edges[q[i]])
+			{
+				if (m_componentIds[to] == id2)
+				{
+					m_componentIds.Mutable(to) = id1;
+					q.push_back(to);
+				}
+			}
+		}
+
+		m_componentSizes.Mutable(id1) += m_componentSizes[id2];
+		m_componentSizes.Mutable(id2) = 0;
+		m_componentsCount--;
+	}
+
+	// Every node have list of edges, nodes are represented as indexes in m_nodes array.
+	// All arrays are copy-on-write chunks, so copies of the graph share unchanged parts.
+	CowVector<Edges>		   m_edges;
 	
-	// Every node have list of edges, nodes are represented as indexes in m_nodes array
-	std::map<NodeIndex, Edges> m_edges;
-	
-	// All words are stored in sorted order
+	// Words are stored in one arena in order of indexes (sorted unless AddNode was called),
+	// hash index maps word to its node
 	Nodes					   m_nodes;
+	StringIndex<Char>		   m_index;
+
+	// Removed words keep their indexes
+	CowVector<bool>			   m_removed;
+	size_t					   m_removedCount = 0;
+
+	// Connected components: flat labels built by LabelComponents and kept by AddNode and AddEdge
+	CowVector<size_t>		   m_componentIds;
+	CowVector<size_t>		   m_componentSizes;
+	size_t					   m_componentsCount = 0;
 };
 
+template <typename W>
+const size_t WordsGraph<W>::NoComponent;
+
 #endif // WORDS_GRAPH_H
@@ -0,0 +1,106 @@
+#ifndef ALIAS_TABLE_H
+#define ALIAS_TABLE_H
+
+#include "common.h"
+#include <random>
+
+// Walker's alias method: picks next word proportionally to its count in O(1).
+// Every column holds one word and optionally an alias, probability of the column word
+// is threshold / total. Integer weights are used, so probabilities are exact.
+class AliasTable
+{
+public:
+	void Build(const Transition* transitions, size_t size)
+	{
+		m_columns.assign(size, Column());
+		m_total = 0;
+		for (size_t i = 0; i < size; ++i)
+			m_total += transitions[i].count;
+
+		// Weight of every column scaled by size, so column is full when its weight is m_total
+		vector<uint64_t> weights(size);
+		vector<size_t> small, large;
+		for (size_t i = 0; i < size; ++i)
+		{
+			weights[i] = static_cast<uint64_t>(transitions[i].count) * size;
+			m_columns[i].word = m_columns[i].alias = transitions[i].word;
+			(weights[i] < m_total ? small : large).push_back(i);
+		}
+
+		while (!small.empty() && !large.empty())
+		{
+			size_t s = small.back(), l = large.back();
+			small.pop_back();
+
+			m_columns[s].threshold = weights[s];
+			m_columns[s].alias = transitions[l].word;
+
+			// Large column gives the rest of small column to it
+			weights[l] -= m_total - weights[s];
+			if (weights[l] < m_total)
+			{
+				large.pop_back();
+				small.push_back(l);
+			}
+		}
+
+		// Rounding can't leave anything here with integer weights, remaining columns are full
+		for (size_t i : large)
+			m_columns[i].threshold = m_total;
+		for (size_t i : small)
+			m_columns[i].threshold = m_total;
+	}
+
+	bool IsEmpty() const
+	{
+		return m_columns.empty();
+	}
+
+	// Memory taken by a table of size transitions
+	static size_t GetMemoryUsage(size_t size)
+	{
+		return sizeof(AliasTable) + size * sizeof(Column);
+	}
+
+	template <typename Random>
+	WordId Sample(Random& random) const
+	{
+		uniform_int_distribution<size_t> column(0, m_columns.size() - 1);
+		uniform_int_distribution<uint64_t> weight(0, m_total - 1);
+
+		const Column& current = m_columns[column(random)];
+		return weight(random) < current.threshold ? current.word : current.alias;
+	}
+
+	// Same distribution as Sample of a built table, but in O(size) and without the table
+	template <typename Random>
+	static WordId SampleDirectly(const Transition* transitions, size_t size, Random& random)
+	{
+		uint64_t total = 0;
+		for (size_t i = 0; i < size; ++i)
+			total += transitions[i].count;
+
+		uint64_t weight = uniform_int_distribution<uint64_t>(0, total - 1)(random);
+		size_t i = 0;
+		for (; weight >= transitions[i].count; ++i)
+			weight -= transitions[i].count;
+		return transitions[i].word;
+	}
+
+private:
+	struct Column
+	{
+		WordId	 word = 0;
+		WordId	 alias = 0;
+		uint64_t threshold = 0;
+	};
+
+	vector<Column> m_columns;
+	uint64_t	   m_total = 0;
+};
+
+// Limit of memory taken by samplers cached by one generating thread. The cache is cleared when
+// it would grow over the limit, and transitions needing over a quarter of it are never cached.
+const size_t MaxCachedSamplersSize = size_t(64) << 20;
+
+#endif // ALIAS_TABLE_H
@@ -0,0 +1,86 @@
+#ifndef BINARY_MODEL_H
+#define BINARY_MODEL_H
+
+#include "common.h"
+#include <cstdint>
+#include <limits>
+
+// Binary model file is used right from mapped memory: header and then sections,
+// every section starts at offset aligned by 8 bytes.
+//   words:		  uint64 offsets[wordsCount + 1] into UTF-8 bytes, then the bytes
+//   keys:		  WordId[keysCount * order], keys are sorted
+//   ranges:	  uint64[keysCount + 1], transitions of key i are [ranges[i], ranges[i + 1])
+//   transitions: Transition[transitionsCount] with exact counts by default. In compact layouts ids of a key are sorted:
+//				  WordId[transitionsCount], or with Elias-Fano code uint64 bit offsets[keysCount + 1] and then
+//				  uint64 words of codes (see elias_fano.h)
+//   weights:	  only in compact layouts, uint8, uint16 or uint32[transitionsCount] weights of transitions
+//   slots:		  uint32[slotsCount], hash index of keys: key index or EmptySlot, linear probing by HashKey
+struct BinaryModelHeader
+{
+	char	 magic[4];
+	uint32_t order;
+	uint32_t weightBits;
+	uint32_t eliasFano;
+	uint64_t wordsCount;
+	uint64_t keysCount;
+	uint64_t transitionsCount;
+	uint64_t slotsCount;
+	uint64_t wordsOffset;
+	uint64_t keysOffset;
+	uint64_t rangesOffset;
+	uint64_t transitionsOffset;
+	uint64_t weightsOffset;
+	uint64_t slotsOffset;
+	uint64_t fileSize;
+};
+
+// How transitions are stored, default layout keeps Transition records with exact counts
+struct BinaryModelLayout
+{
+	// 8 or 16 bits keep probabilities quantized relative to the most frequent next word of the key
+	uint32_t weightBits = 32;
+	bool	 eliasFano = false;
+
+	bool IsCompact() const
+	{
+		return weightBits != 32 || eliasFano;
+	}
+};
+
+const char BinaryModelMagic[4] = { 'M', 'K', 'V', '2' };
+const uint32_t EmptySlot = numeric_limits<uint32_t>::max();
+
+static_assert(sizeof(Transition) == 8, "Transition is stored in files as is");
+
+// Backoff model file holds contexts of orders 0..order in one trie. Context is stored reversed,
+// the last word is next to the root, so context of order k continues its context of order k - 1.
+// Nodes are in level order, children of a node follow each other sorted by label. Node 0 is the root,
+// its transitions are all words of the text. Sections are aligned as in binary model:
+//   words:		  as in binary model
+//   labels:	  WordId[nodesCount], word of the node, the root has Vocabulary::Unknown
+//   children:	  uint64[nodesCount + 1], children of node i are [children[i], children[i + 1])
+//   ranges:	  uint64[nodesCount + 1], transitions of node i are [ranges[i], ranges[i + 1])
+//   transitions: Transition[transitionsCount]
+struct BackoffModelHeader
+{
+	char	 magic[4];
+	uint32_t order;
+	uint64_t wordsCount;
+	uint64_t nodesCount;
+	uint64_t transitionsCount;
+	uint64_t wordsOffset;
+	uint64_t labelsOffset;
+	uint64_t childrenOffset;
+	uint64_t rangesOffset;
+	uint64_t transitionsOffset;
+	uint64_t fileSize;
+};
+
+const char BackoffModelMagic[4] = { 'M', 'K', 'B', '1' };
+
+inline uint64_t AlignOffset(uint64_t offset)
+{
+	return (offset + 7) & ~uint64_t(7);
+}
+
+#endif // BINARY_MODEL_H
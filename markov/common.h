@@ -14,15 +14,32 @@
 #include <boost/format.hpp>
 
 using namespace std;
+#ifdef _WIN32
 const wstring CurlPath = L"curl.exe";
+#else
+const wstring CurlPath = L"curl";
+#endif
 const uint32_t BufferSize = 1024 * 100; // 100 kb
 
+// Index of a word in Vocabulary
+typedef uint32_t WordId;
+
+// Next word of a key and how many times it followed the key
+struct Transition
+{
+	WordId	 word;
+	uint32_t count;
+};
+
 #define Check(eval, message) if (eval) throw std::runtime_error(message)
 
-inline bool IsFileExists(const std::wstring& name) 
+#ifdef _WIN32
+// Streams take wide paths only on Windows
+inline bool IsFileExists(const std::wstring& name)
 {
 	ifstream stream(name);
 	return stream.is_open();
 }
+#endif
 
 #endif // COMMON_H
\ No newline at end of file
@@ -2,28 +2,203 @@
 
 #include <string>
 #include <list>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+#include "common.h"
+
+#ifndef _WIN32
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/wait.h>
+
+extern char** environ;
+#endif
 
 using namespace std;
 
+// Downloads links with curl. On Linux up to maxProcesses curl processes run at once and their
+// output is read through pipes multiplexed by epoll, so one thread serves all of them.
+// Any url curl understands can be used, file:// ones too.
 class Downloader
 {
 public:
-	Downloader()
-	{
+	// Chunk of output of the link, chunks of one link come in order
+	typedef function<void(size_t link, const char* data, size_t size)> DataHandler;
+	// Called once per link after its last chunk
+	typedef function<void(size_t link, bool succeeded)>				   DoneHandler;
 
+	explicit Downloader(size_t maxProcesses = 8) : m_maxProcesses(max<size_t>(1, maxProcesses))
+	{
 	}
 
-	void Download(list<wstring>& links)
+	// Links are identified in handlers by index in the list, handlers are called on this thread
+	void Download(const list<wstring>& links, DataHandler onData, DoneHandler onDone)
 	{
-		m_links = links;
+		m_links.assign(links.begin(), links.end());
+		m_onData = onData;
+		m_onDone = onDone;
 		Run();
 	}
 
 private:
+#ifdef _WIN32
+	// No pipes to poll, links are downloaded one by one
+	void Run()
+	{
+		vector<char> buffer(BufferSize);
+		for (size_t link = 0; link < m_links.size(); ++link)
+		{
+			FILE* file = _wpopen((boost::wformat(L"\"%1%\" -s --url %2%") % CurlPath % m_links[link]).str().c_str(), L"rb");
+			if (file == NULL)
+			{
+				m_onDone(link, false);
+				continue;
+			}
+
+			size_t readed = 0;
+			while ((readed = fread(buffer.data(), 1, buffer.size(), file)) != 0)
+				m_onData(link, buffer.data(), readed);
+			m_onDone(link, _pclose(file) == 0);
+		}
+	}
+#else
+	struct Process
+	{
+		pid_t  pid;
+		size_t link;
+	};
+
 	void Run()
 	{
+		m_epoll = epoll_create1(EPOLL_CLOEXEC);
+		Check(m_epoll == -1, "Can't create epoll");
+
+		try
+		{
+			Poll();
+		}
+		catch (...)
+		{
+			StopAll();
+			close(m_epoll);
+			throw;
+		}
+		close(m_epoll);
+	}
+
+	void Poll()
+	{
+		vector<char> buffer(BufferSize);
+		vector<epoll_event> events(m_maxProcesses);
+		size_t next = 0;
+
+		while (next < m_links.size() || !m_processes.empty())
+		{
+			while (m_processes.size() < m_maxProcesses && next < m_links.size())
+			{
+				size_t link = next++;
+				if (!Start(link))
+					m_onDone(link, false);
+			}
+			if (m_processes.empty())
+				continue;
+
+			int count = epoll_wait(m_epoll, events.data(), static_cast<int>(events.size()), -1);
+			if (count == -1 && errno == EINTR)
+				continue;
+			Check(count == -1, "epoll_wait failed");
+
+			for (int i = 0; i < count; ++i)
+			{
+				int fd = events[i].data.fd;
+				size_t link = m_processes[fd].link;
+
+				// Pipe is level triggered, the rest is read on next wake up
+				ssize_t readed = read(fd, buffer.data(), buffer.size());
+				if (readed > 0)
+					m_onData(link, buffer.data(), static_cast<size_t>(readed));
+				else if (readed == 0 || (errno != EAGAIN && errno != EINTR))
+					m_onDone(link, Finish(fd) && readed == 0);
+			}
+		}
+	}
+
+	// curl writes to the pipe, its stdin is /dev/null
+	bool Start(size_t link)
+	{
+		int fds[2];
+		if (pipe2(fds, O_CLOEXEC) != 0)
+			return false;
+
+		posix_spawn_file_actions_t actions;
+		posix_spawn_file_actions_init(&actions);
+		posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+		posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+
+		string curl = ToBytes(CurlPath), url = ToBytes(m_links[link]);
+		char silent[] = "-s", urlOption[] = "--url";
+		char* argv[] = { &curl[0], silent, urlOption, &url[0], nullptr };
+
+		pid_t pid = 0;
+		int error = posix_spawnp(&pid, curl.c_str(), &actions, nullptr, argv, environ);
+		posix_spawn_file_actions_destroy(&actions);
+		close(fds[1]);
+
+		epoll_event event = {};
+		event.events = EPOLLIN;
+		event.data.fd = fds[0];
+		if (error != 0 || fcntl(fds[0], F_SETFL, O_NONBLOCK) != 0 || epoll_ctl(m_epoll, EPOLL_CTL_ADD, fds[0], &event) != 0)
+		{
+			close(fds[0]);
+			if (error == 0)
+				waitpid(pid, nullptr, 0);
+			return false;
+		}
+
+		m_processes[fds[0]] = Process{ pid, link };
+		return true;
+	}
+
+	// True if curl exited successfully
+	bool Finish(int fd)
+	{
+		pid_t pid = m_processes[fd].pid;
+		m_processes.erase(fd);
+		epoll_ctl(m_epoll, EPOLL_CTL_DEL, fd, nullptr);
+		close(fd);
 
+		int status = 0;
+		while (waitpid(pid, &status, 0) == -1 && errno == EINTR)
+			;
+		return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+	}
+
+	// Handler has thrown, remaining downloads are abandoned
+	void StopAll()
+	{
+		while (!m_processes.empty())
+		{
+			kill(m_processes.begin()->second.pid, SIGTERM);
+			Finish(m_processes.begin()->first);
+		}
 	}
 
-	list<wstring> m_links;
-};
\ No newline at end of file
+	static string ToBytes(const wstring& text)
+	{
+		return wstring_convert<codecvt_utf8<wchar_t>>().to_bytes(text);
+	}
+
+	unordered_map<int, Process> m_processes;
+	int							m_epoll = -1;
+#endif
+
+	vector<wstring> m_links;
+	DataHandler		m_onData;
+	DoneHandler		m_onDone;
+	size_t			m_maxProcesses;
+};
@@ -0,0 +1,128 @@
+#ifndef ELIAS_FANO_H
+#define ELIAS_FANO_H
+
+#include "common.h"
+#include <cstdint>
+
+// Elias-Fano code of count sorted ids less than universe: low bits of every id, then high parts
+// as unary coded gaps. It takes about 2 + log2(universe / count) bits per id.
+// Bits are packed into uint64 words from the lowest bit, codes of different lists follow each other.
+inline uint32_t GetEliasFanoLowBits(uint64_t count, uint64_t universe)
+{
+	uint32_t bits = 0;
+	while (universe / count >> (bits + 1) != 0)
+		++bits;
+	return bits;
+}
+
+// Size of the code in bits, it depends only on count and universe
+inline uint64_t GetEliasFanoSize(uint64_t count, uint64_t universe)
+{
+	const uint32_t lowBits = GetEliasFanoLowBits(count, universe);
+	return count * lowBits + count + ((universe - 1) >> lowBits) + 1;
+}
+
+// Writes bits sequentially, full words go to the stream
+class BitWriter
+{
+public:
+	explicit BitWriter(ostream& stream) : m_stream(stream), m_word(0), m_size(0)
+	{
+	}
+
+	void Write(uint64_t value, uint32_t bits)
+	{
+		for (uint32_t written = 0; written < bits; )
+		{
+			const uint32_t position = m_size % 64;
+			const uint32_t part = min(bits - written, 64 - position);
+			const uint64_t mask = part == 64 ? ~uint64_t(0) : (uint64_t(1) << part) - 1;
+
+			m_word |= ((value >> written) & mask) << position;
+			written += part;
+			m_size += part;
+			if (m_size % 64 == 0)
+			{
+				m_stream.write(reinterpret_cast<const char*>(&m_word), sizeof(m_word));
+				m_word = 0;
+			}
+		}
+	}
+
+	void WriteZeros(uint64_t count)
+	{
+		for (; count > 64; count -= 64)
+			Write(0, 64);
+		Write(0, static_cast<uint32_t>(count));
+	}
+
+	// Writes incomplete last word
+	void Close()
+	{
+		if (m_size % 64 != 0)
+			m_stream.write(reinterpret_cast<const char*>(&m_word), sizeof(m_word));
+		m_word = 0;
+	}
+
+	uint64_t GetSize() const
+	{
+		return m_size;
+	}
+
+private:
+	ostream& m_stream;
+	uint64_t m_word;
+	uint64_t m_size;
+};
+
+inline void EncodeEliasFano(const WordId* ids, size_t count, uint64_t universe, BitWriter& writer)
+{
+	const uint32_t lowBits = GetEliasFanoLowBits(count, universe);
+	for (size_t i = 0; i < count; ++i)
+		writer.Write(ids[i], lowBits);
+
+	// Zeros before the one of every id is the gap between high parts
+	uint64_t high = 0;
+	for (size_t i = 0; i < count; ++i)
+	{
+		const uint64_t idHigh = ids[i] >> lowBits;
+		writer.WriteZeros(idHigh - high);
+		writer.Write(1, 1);
+		high = idHigh;
+	}
+	writer.WriteZeros(((universe - 1) >> lowBits) + 1 - high);
+}
+
+// Code starts at bit offset, caller checks that GetEliasFanoSize bits of it are inside of bits.
+// False if the code is broken.
+inline bool DecodeEliasFano(const uint64_t* bits, uint64_t offset, size_t count, uint64_t universe, WordId* ids)
+{
+	auto getBit = [bits](uint64_t position) { return (bits[position / 64] >> (position % 64)) & 1; };
+
+	const uint32_t lowBits = GetEliasFanoLowBits(count, universe);
+	for (size_t i = 0; i < count; ++i, offset += lowBits)
+	{
+		uint64_t low = 0;
+		for (uint32_t bit = 0; bit < lowBits; ++bit)
+			low |= getBit(offset + bit) << bit;
+		ids[i] = static_cast<WordId>(low);
+	}
+
+	const uint64_t highEnd = offset + count + ((universe - 1) >> lowBits) + 1;
+	uint64_t high = 0;
+	for (size_t i = 0; i < count; ++i, ++offset)
+	{
+		while (offset < highEnd && getBit(offset) == 0)
+			++offset, ++high;
+		if (offset == highEnd)
+			return false;
+
+		const uint64_t id = (high << lowBits) | ids[i];
+		if (id >= universe || (i != 0 && id <= ids[i - 1]))
+			return false;
+		ids[i] = static_cast<WordId>(id);
+	}
+	return true;
+}
+
+#endif // ELIAS_FANO_H
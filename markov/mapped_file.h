@@ -0,0 +1,110 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include "common.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Whole file mapped to memory for reading, pages are loaded by OS on first access
+class MappedFile
+{
+public:
+	explicit MappedFile(const string& filePath) : m_data(nullptr), m_size(0)
+	{
+#ifdef _WIN32
+		m_file = CreateFileA(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		Check(m_file == INVALID_HANDLE_VALUE, (boost::format("Can't open file: %1%") % filePath).str());
+
+		LARGE_INTEGER size;
+		m_mapping = NULL;
+		if (GetFileSizeEx(m_file, &size) && size.QuadPart != 0)
+			m_mapping = CreateFileMappingA(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (m_mapping != NULL)
+			m_data = static_cast<const char*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+		if (m_data == nullptr)
+			Close();
+		Check(m_data == nullptr, (boost::format("Can't map file: %1%") % filePath).str());
+		m_size = static_cast<size_t>(size.QuadPart);
+#else
+		m_file = open(filePath.c_str(), O_RDONLY);
+		Check(m_file == -1, (boost::format("Can't open file: %1%") % filePath).str());
+
+		struct stat stat_buf;
+		void* data = MAP_FAILED;
+		if (fstat(m_file, &stat_buf) == 0 && stat_buf.st_size != 0)
+			data = mmap(nullptr, stat_buf.st_size, PROT_READ, MAP_SHARED, m_file, 0);
+		if (data == MAP_FAILED)
+			Close();
+		Check(data == MAP_FAILED, (boost::format("Can't map file: %1%") % filePath).str());
+		m_data = static_cast<const char*>(data);
+		m_size = stat_buf.st_size;
+#endif
+	}
+
+	~MappedFile()
+	{
+		Close();
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	const char* GetData() const
+	{
+		return m_data;
+	}
+
+	size_t GetSize() const
+	{
+		return m_size;
+	}
+
+	// Array of count elements at offset, checks that it is inside the file
+	template <typename T>
+	const T* GetSection(uint64_t offset, uint64_t count) const
+	{
+		Check(offset % alignof(T) != 0 || offset > m_size || count > (m_size - offset) / sizeof(T), "Bad model, section is out of file");
+		return reinterpret_cast<const T*>(m_data + offset);
+	}
+
+private:
+	void Close()
+	{
+#ifdef _WIN32
+		if (m_data != nullptr)
+			UnmapViewOfFile(m_data);
+		if (m_mapping != NULL)
+			CloseHandle(m_mapping);
+		if (m_file != INVALID_HANDLE_VALUE)
+			CloseHandle(m_file);
+		m_mapping = NULL;
+		m_file = INVALID_HANDLE_VALUE;
+#else
+		if (m_data != nullptr)
+			munmap(const_cast<char*>(m_data), m_size);
+		if (m_file != -1)
+			close(m_file);
+		m_file = -1;
+#endif
+		m_data = nullptr;
+	}
+
+#ifdef _WIN32
+	HANDLE		m_file;
+	HANDLE		m_mapping;
+#else
+	int			m_file;
+#endif
+	const char* m_data;
+	size_t		m_size;
+};
+
+#endif // MAPPED_FILE_H
@@ -1,203 +1,1514 @@
 #include "model.h"
+#include <cwctype>
+#include <cstring>
+#include <cstdio>
+#include <queue>
+#include <sstream>
+#include <atomic>
+#include <thread>
+#include <functional>
 
-// Generates random between a and b
-int GenerateRandom(int a, int b)
+// Upper bound of memory of an open file stream with its buffer, external build counts streams by it
+static const size_t StreamMemory = 32 * 1024;
+
+// Words section of model files: uint64 offsets[wordsCount + 1] into UTF-8 bytes, then the bytes
+static void EncodeWords(const Vocabulary& vocabulary, vector<uint64_t>& offsets, string& words)
 {
-	std::random_device r;
-	std::default_random_engine e1(r());
-	std::uniform_int_distribution<int> uniform_dist(a, b);
-	return uniform_dist(e1);
+	wstring_convert<codecvt_utf8_utf16<wchar_t>> converter;
+	offsets.assign(1, 0);
+	words.clear();
+	for (WordId id = 0; id < vocabulary.GetSize(); ++id)
+	{
+		const wchar_t* word = vocabulary.GetData(id);
+		words += converter.to_bytes(word, word + vocabulary.GetLength(id));
+		offsets.push_back(words.size());
+	}
 }
 
-MarkovChainModel::MarkovChainModel(uint32_t order) : m_order(order)
+// Words get ids of the file, vocabulary should be empty
+static void DecodeWords(const MappedFile& file, uint64_t offset, uint64_t count, Vocabulary& vocabulary)
 {
+	const uint64_t* wordOffsets = file.GetSection<uint64_t>(offset, count + 1);
+	const char* words = file.GetSection<char>(offset + (count + 1) * sizeof(uint64_t), wordOffsets[count]);
+
+	wstring_convert<codecvt_utf8_utf16<wchar_t>> converter;
+	for (uint64_t id = 0; id < count; ++id)
+	{
+		Check(wordOffsets[id] > wordOffsets[id + 1], "Bad model, wrong vocabulary");
+		Check(vocabulary.Add(converter.from_bytes(words + wordOffsets[id], words + wordOffsets[id + 1])) != id, "Bad model, duplicate words");
+	}
 }
 
-bool MarkovChainModel::CreateModel(vector<wchar_t>& text)
+// Transitions of sorted keys one by one in compact or default layout of binary model.
+// Parts of transitions section and weights go to separate streams, they are copied to the file
+// when their sizes are known.
+class TransitionsEncoder
 {
-	vector<wstring> words;
-	boost::split(words, text, boost::algorithm::is_space(), boost::token_compress_on);
-	
-	Check(m_order > words.size(), "Text is too small");
-
-	Sentence sentence(words, m_order);
-	auto currentWord = words.begin();
-	std::advance(currentWord, m_order);
-	wstring key;
+public:
+	TransitionsEncoder(const BinaryModelLayout& layout, uint64_t wordsCount, ostream& bitOffsets, ostream& ids, ostream& weights)
+		: m_layout(layout), m_wordsCount(wordsCount), m_bitOffsets(bitOffsets), m_ids(ids), m_weights(weights),
+		  m_bits(ids), m_keysCount(0), m_transitionsCount(0)
+	{
+		Check(layout.weightBits != 8 && layout.weightBits != 16 && layout.weightBits != 32, "Weights can be of 8, 16 or 32 bits only");
+	}
 
-	while (currentWord != words.end())
+	void Add(const vector<Transition>& transitions)
 	{
-		key = sentence.GetKey();
+		m_keysCount++;
+		m_transitionsCount += transitions.size();
+		if (!m_layout.IsCompact())
+		{
+			m_ids.write(reinterpret_cast<const char*>(transitions.data()), transitions.size() * sizeof(Transition));
+			return;
+		}
+
+		m_sorted.assign(transitions.begin(), transitions.end());
+		sort(m_sorted.begin(), m_sorted.end(), [](const Transition& a, const Transition& b) { return a.word < b.word; });
 
-		auto currentValue = m_chain.find(key);
-		if (m_chain.end() != currentValue)
-			currentValue->second.push_front(*currentWord);
+		m_words.clear();
+		for (const auto& transition : m_sorted)
+			m_words.push_back(transition.word);
+		if (m_layout.eliasFano)
+		{
+			const uint64_t offset = m_bits.GetSize();
+			m_bitOffsets.write(reinterpret_cast<const char*>(&offset), sizeof(offset));
+			EncodeEliasFano(m_words.data(), m_words.size(), m_wordsCount, m_bits);
+		}
 		else
-			m_chain.emplace(key, forward_list<wstring>{ *currentWord });
+		{
+			m_ids.write(reinterpret_cast<const char*>(m_words.data()), m_words.size() * sizeof(WordId));
+		}
+
+		// Weight of the most frequent word is the largest one, rare words keep weight 1 at least
+		uint64_t maxCount = 0;
+		for (const auto& transition : m_sorted)
+			maxCount = max<uint64_t>(maxCount, transition.count);
+		const uint64_t maxWeight = (uint64_t(1) << m_layout.weightBits) - 1;
+		for (const auto& transition : m_sorted)
+		{
+			const uint32_t weight = m_layout.weightBits == 32 ? transition.count
+				: static_cast<uint32_t>(max<uint64_t>(1, (transition.count * maxWeight + maxCount / 2) / maxCount));
+			m_weights.write(reinterpret_cast<const char*>(&weight), m_layout.weightBits / 8);
+		}
+	}
+
+	void Close()
+	{
+		if (m_layout.eliasFano)
+		{
+			const uint64_t offset = m_bits.GetSize();
+			m_bitOffsets.write(reinterpret_cast<const char*>(&offset), sizeof(offset));
+			m_bits.Close();
+		}
+	}
+
+	uint64_t GetTransitionsCount() const
+	{
+		return m_transitionsCount;
+	}
+
+	// Sizes of sections in bytes
+	uint64_t GetTransitionsSize() const
+	{
+		if (!m_layout.IsCompact())
+			return m_transitionsCount * sizeof(Transition);
+		if (!m_layout.eliasFano)
+			return m_transitionsCount * sizeof(WordId);
+		return (m_keysCount + 1 + (m_bits.GetSize() + 63) / 64) * sizeof(uint64_t);
+	}
+
+	uint64_t GetWeightsSize() const
+	{
+		return m_layout.IsCompact() ? m_transitionsCount * m_layout.weightBits / 8 : 0;
+	}
+
+private:
+	BinaryModelLayout m_layout;
+	uint64_t m_wordsCount;
+	ostream& m_bitOffsets;
+	ostream& m_ids;
+	ostream& m_weights;
+	BitWriter m_bits;
+	uint64_t m_keysCount;
+	uint64_t m_transitionsCount;
+	vector<Transition> m_sorted;
+	vector<WordId> m_words;
+};
+
+// Writes binary model file section by section, header and words are written at once
+class BinaryModelWriter
+{
+public:
+	BinaryModelWriter(const string& filePath, const Vocabulary& vocabulary, uint32_t order, uint64_t keysCount, uint64_t transitionsCount,
+		const BinaryModelLayout& layout, uint64_t transitionsSize, uint64_t weightsSize)
+		: m_stream(filePath, ios::binary), m_filePath(filePath), m_header(), m_position(0)
+	{
+		Check(!m_stream.is_open(), (boost::format("Can't open file %1%") % filePath).str());
+		Check(keysCount >= EmptySlot, "Too many keys for binary model");
+
+		copy_n(BinaryModelMagic, sizeof(BinaryModelMagic), m_header.magic);
+		m_header.order = order;
+		m_header.weightBits = layout.weightBits;
+		m_header.eliasFano = layout.eliasFano;
+		m_header.wordsCount = vocabulary.GetSize();
+		m_header.keysCount = keysCount;
+		m_header.transitionsCount = transitionsCount;
+
+		// Index is at most half full
+		m_header.slotsCount = 16;
+		while (m_header.slotsCount < m_header.keysCount * 2)
+			m_header.slotsCount *= 2;
+
+		vector<uint64_t> wordOffsets;
+		string words;
+		EncodeWords(vocabulary, wordOffsets, words);
+
+		m_header.wordsOffset = AlignOffset(sizeof(m_header));
+		m_header.keysOffset = AlignOffset(m_header.wordsOffset + wordOffsets.size() * sizeof(uint64_t) + words.size());
+		m_header.rangesOffset = AlignOffset(m_header.keysOffset + m_header.keysCount * order * sizeof(WordId));
+		m_header.transitionsOffset = m_header.rangesOffset + (m_header.keysCount + 1) * sizeof(uint64_t);
+		m_header.weightsOffset = layout.IsCompact() ? AlignOffset(m_header.transitionsOffset + transitionsSize) : 0;
+		m_header.slotsOffset = AlignOffset(layout.IsCompact() ? m_header.weightsOffset + weightsSize : m_header.transitionsOffset + transitionsSize);
+		m_header.fileSize = m_header.slotsOffset + m_header.slotsCount * sizeof(uint32_t);
+
+		Write(&m_header, sizeof(m_header));
+		Pad(m_header.wordsOffset);
+		Write(wordOffsets.data(), wordOffsets.size() * sizeof(uint64_t));
+		Write(words.data(), words.size());
+	}
+
+	const BinaryModelHeader& GetHeader() const
+	{
+		return m_header;
+	}
+
+	void Write(const void* data, uint64_t size)
+	{
+		m_stream.write(static_cast<const char*>(data), size);
+		m_position += size;
+	}
+
+	// Zeros up to the offset of the next section
+	void Pad(uint64_t offset)
+	{
+		const char zeros[8] = {};
+		Write(zeros, offset - m_position);
+	}
+
+	// Hashes of keys in order of keys
+	void WriteSlots(const vector<uint64_t>& hashes)
+	{
+		vector<uint32_t> slots(m_header.slotsCount, EmptySlot);
+		const uint64_t mask = m_header.slotsCount - 1;
+		for (uint32_t index = 0; index < hashes.size(); ++index)
+		{
+			uint64_t slot = hashes[index] & mask;
+			while (slots[slot] != EmptySlot)
+				slot = (slot + 1) & mask;
+			slots[slot] = index;
+		}
+		Write(slots.data(), slots.size() * sizeof(uint32_t));
+	}
+
+	// Same index as above for hashes written to a file, but only one part of slots is in memory.
+	// Keys are spread to files by the part of their home slot, then parts are filled one by one:
+	// keys probing past the end of a part go on from the start of the next one in order of indexes,
+	// so every key gets the same slot as above. Keys probing past the last slot go to the first part,
+	// parts are filled again until keys passed between them don't change.
+	// Temporary files are named tempPath + suffix, returns estimated memory it took.
+	size_t WriteSlots(const string& hashesPath, const string& tempPath, size_t memoryBudget)
+	{
+		// Index of key and its home slot
+		typedef pair<uint32_t, uint64_t> SlotKey;
+
+		// Half of the budget is for slots of a part, the other half is for files
+		const uint64_t mask = m_header.slotsCount - 1;
+		uint64_t partSize = min<uint64_t>(m_header.slotsCount, 1024);
+		while (partSize < m_header.slotsCount && partSize * 2 * sizeof(uint32_t) <= memoryBudget / 2)
+			partSize *= 2;
+		const uint64_t partsCount = m_header.slotsCount / partSize;
+		const uint64_t filesCount = max<uint64_t>(1, min<uint64_t>(partsCount, memoryBudget / 2 / StreamMemory));
+		size_t memory = static_cast<size_t>(filesCount + 1) * StreamMemory;
+
+		auto getPartPath = [&](uint64_t part) { return (boost::format("%1%.part%2%") % tempPath % part).str(); };
+		auto removeFiles = [&]()
+		{
+			for (uint64_t part = 0; part < partsCount; ++part)
+				remove(getPartPath(part).c_str());
+			remove((tempPath + ".slots").c_str());
+		};
+
+		try
+		{
+			// Files of parts are written filesCount at once, every pass reads all hashes
+			for (uint64_t first = 0; first < partsCount; first += filesCount)
+			{
+				const uint64_t last = min(partsCount, first + filesCount);
+				vector<ofstream> parts(last - first);
+				for (uint64_t part = first; part < last; ++part)
+				{
+					parts[part - first].open(getPartPath(part), ios::binary);
+					Check(!parts[part - first].is_open(), "Can't create temporary files");
+				}
+
+				ifstream hashes(hashesPath, ios::binary);
+				Check(!hashes.is_open(), (boost::format("Can't open file %1%") % hashesPath).str());
+				uint64_t hash = 0;
+				for (uint32_t index = 0; hashes.read(reinterpret_cast<char*>(&hash), sizeof(hash)); ++index)
+				{
+					const uint64_t slot = hash & mask, part = slot / partSize;
+					if (part < first || part >= last)
+						continue;
+					parts[part - first].write(reinterpret_cast<const char*>(&index), sizeof(index));
+					parts[part - first].write(reinterpret_cast<const char*>(&slot), sizeof(slot));
+				}
+
+				for (auto& part : parts)
+				{
+					part.close();
+					Check(!part, "Can't write temporary files");
+				}
+			}
+
+			fstream slotsStream(tempPath + ".slots", ios::in | ios::out | ios::binary | ios::trunc);
+			Check(!slotsStream.is_open(), "Can't create temporary files");
+			vector<uint32_t> slots(static_cast<size_t>(partSize));
+			memory = max(memory, slots.size() * sizeof(uint32_t) + 2 * StreamMemory);
+			vector<vector<SlotKey>> incoming(static_cast<size_t>(partsCount));
+			size_t incomingCount = 0;
+
+			for (uint64_t step = 0; ; ++step)
+			{
+				const uint64_t part = step % partsCount, next = (part + 1) % partsCount, begin = part * partSize;
+				ifstream keys(getPartPath(part), ios::binary);
+				Check(!keys.is_open(), "Can't open temporary files");
+				SlotKey own(0, 0);
+				auto readOwn = [&]()
+				{
+					keys.read(reinterpret_cast<char*>(&own.first), sizeof(own.first));
+					keys.read(reinterpret_cast<char*>(&own.second), sizeof(own.second));
+					return static_cast<bool>(keys);
+				};
+
+				// Keys coming from the previous part probe from the first slot of this one. The only part
+				// wraps its probes, with more parts a probe can't come back to its part at half load.
+				vector<SlotKey> outgoing;
+				fill(slots.begin(), slots.end(), EmptySlot);
+				size_t nextIncoming = 0;
+				for (bool hasOwn = readOwn(); hasOwn || nextIncoming < incoming[part].size(); )
+				{
+					const bool isIncoming = nextIncoming < incoming[part].size() && (!hasOwn || incoming[part][nextIncoming].first < own.first);
+					const SlotKey key = isIncoming ? incoming[part][nextIncoming++] : own;
+					uint64_t slot = isIncoming ? 0 : key.second - begin;
+					if (!isIncoming)
+						hasOwn = readOwn();
+
+					while (slot < partSize && slots[slot] != EmptySlot)
+						slot = partsCount != 1 ? slot + 1 : (slot + 1) & (partSize - 1);
+					if (slot < partSize)
+						slots[slot] = key.first;
+					else
+						outgoing.push_back(key);
+				}
+
+				slotsStream.seekp(begin * sizeof(uint32_t));
+				slotsStream.write(reinterpret_cast<const char*>(slots.data()), slots.size() * sizeof(uint32_t));
+				Check(!slotsStream, "Can't write temporary files");
+
+				if (step + 1 >= partsCount && outgoing == incoming[next])
+					break;
+				incomingCount = incomingCount - incoming[next].size() + outgoing.size();
+				incoming[next] = move(outgoing);
+				memory = max(memory, slots.size() * sizeof(uint32_t) + incomingCount * sizeof(SlotKey) + 2 * StreamMemory);
+			}
+
+			slotsStream.close();
+			Check(!slotsStream, "Can't write temporary files");
+			vector<uint32_t>().swap(slots);
+			Copy(tempPath + ".slots");
+			memory = max(memory, BufferSize + StreamMemory);
+		}
+		catch (...)
+		{
+			removeFiles();
+			throw;
+		}
 
-		sentence.InsertWord(*currentWord);
-		currentWord++;
+		removeFiles();
+		return memory;
 	}
 
+	void Write(const string& data)
+	{
+		Write(data.data(), data.size());
+	}
+
+	// Section prepared in a temporary file
+	void Copy(const string& filePath)
+	{
+		ifstream stream(filePath, ios::binary);
+		Check(!stream.is_open(), (boost::format("Can't open file %1%") % filePath).str());
+
+		vector<char> buffer(BufferSize);
+		while (stream.read(buffer.data(), buffer.size()) || stream.gcount() != 0)
+			Write(buffer.data(), stream.gcount());
+	}
+
+	void Close()
+	{
+		m_stream.close();
+		Check(!m_stream || m_position != m_header.fileSize, (boost::format("Can't write file %1%") % m_filePath).str());
+	}
+
+private:
+	ofstream m_stream;
+	string m_filePath;
+	BinaryModelHeader m_header;
+	uint64_t m_position;
+};
+
+MarkovChainModel::MarkovChainModel(uint32_t order, shared_ptr<Vocabulary> vocabulary)
+	: m_chain(order),
+	  m_order(order),
+	  m_vocabulary(vocabulary),
+	  m_text(order)
+{
+}
+
+bool MarkovChainModel::CreateModel(vector<wchar_t>& text)
+{
+	BeginText();
+	AddText(text.data(), text.size());
+	EndText();
 	return true;
 }
 
+void MarkovChainModel::BeginText()
+{
+	m_text.tokenizer.Reset();
+	m_text.window.Clear();
+}
+
+void MarkovChainModel::AddText(const wchar_t* text, size_t size)
+{
+	m_text.tokenizer.Write(text, size, [this](const wchar_t* word, size_t length) { AddWord(word, length); });
+}
+
+void MarkovChainModel::EndText()
+{
+	m_text.tokenizer.Close([this](const wchar_t* word, size_t length) { AddWord(word, length); });
+	Check(m_order > m_text.window.GetCount(), "Text is too small");
+}
+
+// Key of every word is the window of m_order previous words
+void MarkovChainModel::AddWord(const wchar_t* word, size_t length)
+{
+	WordId id = m_vocabulary->Add(word, length);
+	if (m_text.window.IsFull())
+		AddTransition(m_chain[m_text.window.GetKey()], id, 1);
+	m_text.window.Push(id);
+}
+
 void MarkovChainModel::Merge(const MarkovChainModel& otherModel)
 {
 	if (this == &otherModel)
 		return;
 
-	for (auto keyValue : otherModel.m_chain)
+	Check(m_order != otherModel.m_order, "Can't merge models of different order");
+
+	// Ids of other model words in this model, nothing to remap if vocabulary is shared
+	const Vocabulary& otherVocabulary = *otherModel.m_vocabulary;
+	const bool isSharedVocabulary = m_vocabulary == otherModel.m_vocabulary;
+	vector<WordId> ids;
+	if (!isSharedVocabulary)
+	{
+		ids.resize(otherVocabulary.GetSize());
+		for (WordId id = 0; id < ids.size(); ++id)
+			ids[id] = m_vocabulary->Add(otherVocabulary.GetData(id), otherVocabulary.GetLength(id));
+	}
+	auto remap = [&](WordId id) { return isSharedVocabulary ? id : ids[id]; };
+
+	vector<WordId> key(m_order);
+	otherModel.m_chain.ForEach([&](const WordId* otherKey, const Transitions& otherTransitions)
+	{
+		for (uint32_t i = 0; i < m_order; ++i)
+			key[i] = remap(otherKey[i]);
+
+		auto& current = m_chain[key.data()];
+		for (const auto& transition : otherTransitions)
+			AddTransition(current, remap(transition.word), transition.count);
+	});
+}
+
+void MarkovChainModel::Merge(MarkovChainModel&& otherModel)
+{
+	if (this == &otherModel)
+		return;
+
+	if (m_vocabulary != otherModel.m_vocabulary)
+	{
+		Merge(static_cast<const MarkovChainModel&>(otherModel));
+		otherModel.m_chain.Clear();
+		return;
+	}
+
+	Check(m_order != otherModel.m_order, "Can't merge models of different order");
+
+	m_chain.Reserve(m_chain.GetSize() + otherModel.m_chain.GetSize());
+	otherModel.m_chain.ForEach([&](const WordId* key, Transitions& otherTransitions)
+	{
+		MoveTransitions(m_chain[key], otherTransitions);
+	});
+	otherModel.m_chain.Clear();
+}
+
+void MarkovChainModel::SaveBinary(const string& filePath, const BinaryModelLayout& layout) const
+{
+	vector<KeyValue> keys;
+	GetSortedKeys(keys);
+
+	// Default layout is written right from the model, compact one is encoded first
+	ostringstream bitOffsets, ids, weights;
+	TransitionsEncoder encoder(layout, m_vocabulary->GetSize(), bitOffsets, ids, weights);
+	uint64_t transitionsCount = 0;
+	for (const auto& key : keys)
+	{
+		transitionsCount += key.second->size();
+		if (layout.IsCompact())
+			encoder.Add(*key.second);
+	}
+	encoder.Close();
+
+	const uint64_t transitionsSize = layout.IsCompact() ? encoder.GetTransitionsSize() : transitionsCount * sizeof(Transition);
+	BinaryModelWriter writer(filePath, *m_vocabulary, m_order, keys.size(), transitionsCount, layout, transitionsSize, encoder.GetWeightsSize());
+
+	writer.Pad(writer.GetHeader().keysOffset);
+	for (const auto& key : keys)
+		writer.Write(key.first, m_order * sizeof(WordId));
+
+	writer.Pad(writer.GetHeader().rangesOffset);
+	uint64_t range = 0;
+	writer.Write(&range, sizeof(range));
+	for (const auto& key : keys)
+	{
+		range += key.second->size();
+		writer.Write(&range, sizeof(range));
+	}
+
+	if (layout.IsCompact())
+	{
+		writer.Write(bitOffsets.str());
+		writer.Write(ids.str());
+		writer.Pad(writer.GetHeader().weightsOffset);
+		writer.Write(weights.str());
+	}
+	else
+	{
+		for (const auto& key : keys)
+			writer.Write(key.second->data(), key.second->size() * sizeof(Transition));
+	}
+	writer.Pad(writer.GetHeader().slotsOffset);
+
+	vector<uint64_t> hashes;
+	hashes.reserve(keys.size());
+	for (const auto& key : keys)
+		hashes.push_back(HashKey(key.first, m_order));
+	writer.WriteSlots(hashes);
+	writer.Close();
+}
+
+void MarkovChainModel::Prune(const PruneOptions& options)
+{
+	// Keys come in order of home slots, so they must go to a table of final size:
+	// a growing table would get all of them in its first slots
+	size_t size = 0;
+	m_chain.ForEach([&](const WordId*, Transitions& transitions)
 	{
-		auto current = m_chain.find(keyValue.first);
-		if (m_chain.end() != current)
-			current->second.splice_after(current->second.before_begin(), keyValue.second);
+		if (PruneTransitions(transitions, options))
+			size++;
 		else
-			m_chain.emplace(keyValue.first, keyValue.second);
+			transitions.clear();
+	});
+
+	Chain chain(m_order);
+	chain.Reserve(size);
+	m_chain.ForEach([&](const WordId* key, Transitions& transitions)
+	{
+		if (!transitions.empty())
+			chain[key] = move(transitions);
+	});
+	m_chain = move(chain);
+}
+
+bool MarkovChainModel::PruneTransitions(Transitions& transitions, const PruneOptions& options)
+{
+	transitions.erase(remove_if(transitions.begin(), transitions.end(), [&](const Transition& transition)
+	{
+		return transition.count < options.minCount;
+	}), transitions.end());
+
+	if (options.maxTransitions != 0 && transitions.size() > options.maxTransitions)
+	{
+		stable_sort(transitions.begin(), transitions.end(), [](const Transition& a, const Transition& b) { return a.count > b.count; });
+		transitions.resize(options.maxTransitions);
 	}
+
+	uint64_t count = 0;
+	for (const auto& transition : transitions)
+		count += transition.count;
+	return !transitions.empty() && count >= options.minKeyCount;
 }
 
-bool MarkovChainModel::Load(const wstring& filePath, bool fullLoad)
+void MarkovChainModel::GetSortedKeys(vector<KeyValue>& keys) const
 {
-	m_chain.clear();
+	keys.clear();
+	keys.reserve(m_chain.GetSize());
+	m_chain.ForEach([&](const WordId* key, const Transitions& transitions)
+	{
+		keys.emplace_back(key, &transitions);
+	});
+	sort(keys.begin(), keys.end(), [this](const KeyValue& a, const KeyValue& b)
+	{
+		return lexicographical_compare(a.first, a.first + m_order, b.first, b.first + m_order);
+	});
+}
 
-	wifstream stream(filePath);
-	wstring line;
-	getline(stream, line);
-	uint32_t newOrder = stol(line);
-	if (newOrder != m_order)
+bool MarkovChainModel::operator== (const MarkovChainModel& model) const
+{
+	if (m_order != model.m_order || GetSize() != model.GetSize())
 		return false;
 
-	while (getline(stream, line))
+	// Models may have different vocabularies, then words are compared
+	const Vocabulary& otherVocabulary = *model.m_vocabulary;
+	auto toOtherId = [&](WordId id)
+	{
+		return m_vocabulary == model.m_vocabulary ? id : otherVocabulary.Find(m_vocabulary->GetData(id), m_vocabulary->GetLength(id));
+	};
+
+	bool isEqual = true;
+	vector<WordId> key(m_order);
+	m_chain.ForEach([&](const WordId* thisKey, const Transitions& transitions)
+	{
+		if (!isEqual)
+			return;
+
+		for (uint32_t i = 0; i < m_order; ++i)
+			key[i] = toOtherId(thisKey[i]);
+
+		// Order of transitions depends on order of merges, it is not compared
+		const Transitions* otherTransitions = model.m_chain.Find(key.data());
+		isEqual = otherTransitions != nullptr && otherTransitions->size() == transitions.size() &&
+			all_of(transitions.begin(), transitions.end(), [&](const Transition& transition)
+			{
+				WordId word = toOtherId(transition.word);
+				return any_of(otherTransitions->begin(), otherTransitions->end(), [&](const Transition& other)
+				{
+					return other.word == word && other.count == transition.count;
+				});
+			});
+	});
+
+	return isEqual;
+}
+
+void MarkovChainModel::MoveTransitions(Transitions& transitions, Transitions& otherTransitions)
+{
+	if (transitions.empty())
+	{
+		transitions = move(otherTransitions);
+		return;
+	}
+
+	for (const auto& transition : otherTransitions)
+		AddTransition(transitions, transition.word, transition.count);
+	otherTransitions.clear();
+}
+
+void MarkovChainModel::AddTransition(Transitions& transitions, WordId word, uint32_t count)
+{
+	// Keys usually have few next words, linear search is the fastest here
+	for (auto& transition : transitions)
+	{
+		if (transition.word == word)
+		{
+			transition.count += count;
+			return;
+		}
+	}
+	transitions.push_back(Transition{ word, count });
+}
+
+ParallelModelBuilder::ParallelModelBuilder(uint32_t order, shared_ptr<Vocabulary> vocabulary, size_t workersCount)
+	: m_order(order),
+	  m_vocabulary(vocabulary),
+	  m_shardsCount(1),
+	  m_workers(workersCount)
+{
+	// More shards than threads, so big shards don't keep other threads waiting.
+	// Shard is a part of the model table, their count is a power of two.
+	uint32_t shardBits = 0;
+	while (m_shardsCount < workersCount * 4)
+	{
+		m_shardsCount *= 2;
+		shardBits++;
+	}
+	for (auto& worker : m_workers)
+		worker.shards.assign(m_shardsCount, Chain(order, shardBits));
+}
+
+void ParallelModelBuilder::AddText(size_t workerIndex, TextStream& stream, const wchar_t* text, size_t size)
+{
+	Worker& worker = m_workers[workerIndex];
+	stream.tokenizer.Write(text, size, [&](const wchar_t* word, size_t length) { AddWord(worker, stream.window, word, length); });
+}
+
+void ParallelModelBuilder::AddText(size_t workerIndex, TextStream& stream, const char* text, size_t size)
+{
+	Worker& worker = m_workers[workerIndex];
+	stream.utf8Tokenizer.Write(text, size, [&](const wchar_t* word, size_t length) { AddWord(worker, stream.window, word, length); });
+}
+
+void ParallelModelBuilder::EndText(size_t workerIndex, TextStream& stream)
+{
+	Worker& worker = m_workers[workerIndex];
+	auto addWord = [&](const wchar_t* word, size_t length) { AddWord(worker, stream.window, word, length); };
+	stream.tokenizer.Close(addWord);
+	stream.utf8Tokenizer.Close(addWord);
+	Check(m_order > stream.window.GetCount(), "Text is too small");
+}
+
+void ParallelModelBuilder::AddWord(Worker& worker, NGramWindow& window, const wchar_t* word, size_t length)
+{
+	WordId id = worker.words.Add(word, length);
+	if (id == worker.globalIds.size())
+	{
+		lock_guard<mutex> lock(m_vocabularyMutex);
+		worker.globalIds.push_back(m_vocabulary->Add(word, length));
+	}
+	id = worker.globalIds[id];
+
+	if (window.IsFull())
+	{
+		const WordId* key = window.GetKey();
+		MarkovChainModel::AddTransition(worker.shards[GetShard(key)][key], id, 1);
+	}
+	window.Push(id);
+}
+
+void ParallelModelBuilder::Build(MarkovChainModel& model)
+{
+	Check(model.m_vocabulary != m_vocabulary || model.m_order != m_order, "Model is not compatible with builder");
+
+	auto runThreads = [&](const function<void()>& func)
+	{
+		vector<thread> threads;
+		for (size_t i = 1; i < m_workers.size(); ++i)
+			threads.emplace_back(func);
+		func();
+		for (auto& thread : threads)
+			thread.join();
+	};
+
+	// Every shard is merged by one thread: tables of other workers are moved to the first one
+	atomic<size_t> nextShard(0);
+	runThreads([&]()
+	{
+		for (size_t shard = nextShard++; shard < m_shardsCount; shard = nextShard++)
+		{
+			Chain& result = m_workers.front().shards[shard];
+			for (size_t worker = 1; worker < m_workers.size(); ++worker)
+			{
+				Chain& other = m_workers[worker].shards[shard];
+				result.Reserve(result.GetSize() + other.GetSize());
+				other.ForEach([&](const WordId* key, MarkovChainModel::Transitions& transitions)
+				{
+					MarkovChainModel::MoveTransitions(result[key], transitions);
+				});
+				other.Clear();
+			}
+		}
+	});
+
+	// Table is allocated once, then every shard is moved into its own range of slots by one thread.
+	// Keys whose probe runs out of the range (a few near the ends of ranges) are moved at the end.
+	auto& shards = m_workers.front().shards;
+	size_t size = model.m_chain.GetSize();
+	for (const auto& shard : shards)
+		size += shard.GetSize();
+	model.m_chain.Reserve(size, m_shardsCount);
+
+	vector<vector<pair<const WordId*, MarkovChainModel::Transitions*>>> overflows(m_shardsCount);
+	vector<size_t> added(m_shardsCount, 0);
+	nextShard = 0;
+	runThreads([&]()
+	{
+		for (size_t shard = nextShard++; shard < m_shardsCount; shard = nextShard++)
+		{
+			shards[shard].ForEach([&](const WordId* key, MarkovChainModel::Transitions& transitions)
+			{
+				MarkovChainModel::Transitions* result = model.m_chain.InsertInPart(key, shard, m_shardsCount, added[shard]);
+				if (result != nullptr)
+					MarkovChainModel::MoveTransitions(*result, transitions);
+				else
+					overflows[shard].push_back(make_pair(key, &transitions));
+			});
+		}
+	});
+
+	for (size_t shard = 0; shard < m_shardsCount; ++shard)
+		model.m_chain.AddSize(added[shard]);
+	for (const auto& overflow : overflows)
+	{
+		for (const auto& keyValue : overflow)
+			MarkovChainModel::MoveTransitions(model.m_chain[keyValue.first], *keyValue.second);
+	}
+
+	for (auto& shard : shards)
+		shard.Clear();
+}
+
+// Keys of a run one by one: key ids, count of transitions and transitions
+class ExternalModelBuilder::RunReader
+{
+public:
+	RunReader(const string& filePath, uint32_t order, size_t index)
+		: m_stream(filePath, ios::binary), key(order), index(index)
+	{
+		Check(!m_stream.is_open(), (boost::format("Can't open file %1%") % filePath).str());
+	}
+
+	// False at the end of the run
+	bool Read()
 	{
-		vector<wstring> words;
-		boost::split(words, line, boost::is_any_of(" "));
-		auto currentWord = words.begin();
+		uint32_t count = 0;
+		m_stream.read(reinterpret_cast<char*>(key.data()), key.size() * sizeof(WordId));
+		m_stream.read(reinterpret_cast<char*>(&count), sizeof(count));
+		if (!m_stream)
+			return false;
+
+		transitions.resize(count);
+		m_stream.read(reinterpret_cast<char*>(transitions.data()), count * sizeof(Transition));
+		Check(!m_stream, "Run file is truncated");
+		return true;
+	}
+
+private:
+	ifstream m_stream;
+
+public:
+	vector<WordId> key;
+	Transitions transitions;
+	size_t index;
+};
+
+ExternalModelBuilder::ExternalModelBuilder(uint32_t order, const string& tempPath, size_t memoryBudget)
+	: m_order(order),
+	  m_tempPath(tempPath),
+	  m_memoryBudget(memoryBudget),
+	  m_chain(order),
+	  m_memory(0),
+	  m_peakMemory(0),
+	  m_runsCreated(0)
+{
+}
+
+ExternalModelBuilder::~ExternalModelBuilder()
+{
+	RemoveFiles();
+}
+
+void ExternalModelBuilder::AddText(TextStream& stream, const wchar_t* text, size_t size)
+{
+	stream.tokenizer.Write(text, size, [&](const wchar_t* word, size_t length) { AddWord(stream.window, word, length); });
+}
+
+void ExternalModelBuilder::AddText(TextStream& stream, const char* text, size_t size)
+{
+	stream.utf8Tokenizer.Write(text, size, [&](const wchar_t* word, size_t length) { AddWord(stream.window, word, length); });
+}
 
-		wstring key;
-		for (uint32_t i = 1; i <= m_order; ++i, ++currentWord)
+void ExternalModelBuilder::EndText(TextStream& stream)
+{
+	auto addWord = [&](const wchar_t* word, size_t length) { AddWord(stream.window, word, length); };
+	stream.tokenizer.Close(addWord);
+	stream.utf8Tokenizer.Close(addWord);
+	Check(m_order > stream.window.GetCount(), "Text is too small");
+}
+
+void ExternalModelBuilder::AddWord(NGramWindow& window, const wchar_t* word, size_t length)
+{
+	WordId id = m_vocabulary.Add(word, length);
+	Check(GetVocabularyMemory() > m_memoryBudget / 2, "Memory budget is too small for vocabulary of texts");
+	if (window.IsFull())
+	{
+		// Tables are spilled before they grow over the budget. Growing vector holds both old and new memory.
+		const WordId* key = window.GetKey();
+		Transitions* transitions = m_chain.Find(key);
+		size_t growth = 0;
+		if (transitions == nullptr)
+		{
+			const size_t capacity = m_chain.GetCapacity();
+			growth = sizeof(Transition) + sizeof(MarkovChainModel::KeyValue);
+			if ((m_chain.GetSize() + 1) * 4 > capacity * 3)
+				growth += GetCountingMemory(max<size_t>(16, capacity * 2)) - GetVocabularyMemory() - StreamMemory;
+		}
+		else if (transitions->size() == transitions->capacity())
 		{
-			if (currentWord == words.end())
-				return false;
+			growth = 2 * transitions->capacity() * sizeof(Transition);
+		}
 
-			key += *currentWord;
-			if (i != m_order)
-				key += L" ";
+		if (GetCountingMemory(m_chain.GetCapacity()) + growth > m_memoryBudget)
+		{
+			Spill();
+			transitions = nullptr;
 		}
-		m_chain.emplace(key, forward_list<wstring>(currentWord, words.end()));
+		if (transitions == nullptr)
+			transitions = &m_chain[key];
+
+		size_t capacity = transitions->capacity();
+		MarkovChainModel::AddTransition(*transitions, id, 1);
+		m_memory += (transitions->capacity() - capacity) * sizeof(Transition);
+		CountMemory(GetCountingMemory(m_chain.GetCapacity()));
 	}
-	
-	return true;
+	window.Push(id);
+}
+
+size_t ExternalModelBuilder::GetCountingMemory(size_t capacity) const
+{
+	// Slots of the table and sorted keys of the spill, then the run being written
+	const size_t tableMemory = capacity * (m_order * sizeof(WordId) + sizeof(Transitions) + sizeof(uint8_t));
+	return GetVocabularyMemory() + m_memory + tableMemory + m_chain.GetSize() * sizeof(MarkovChainModel::KeyValue) + StreamMemory;
+}
+
+string ExternalModelBuilder::GetNewRunPath()
+{
+	return (boost::format("%1%.run%2%") % m_tempPath % m_runsCreated++).str();
+}
+
+static void WriteRunKey(ostream& stream, const WordId* key, uint32_t order, const vector<Transition>& transitions)
+{
+	uint32_t count = static_cast<uint32_t>(transitions.size());
+	stream.write(reinterpret_cast<const char*>(key), order * sizeof(WordId));
+	stream.write(reinterpret_cast<const char*>(&count), sizeof(count));
+	stream.write(reinterpret_cast<const char*>(transitions.data()), count * sizeof(Transition));
 }
 
-void MarkovChainModel::Save(const string& filePath) const
+void ExternalModelBuilder::Spill()
 {
-	wofstream stream;
-	stream.open(filePath);
+	if (m_chain.GetSize() == 0)
+		return;
+
+	MarkovChainModel model(m_order);
+	model.m_chain = move(m_chain);
+	vector<MarkovChainModel::KeyValue> keys;
+	model.GetSortedKeys(keys);
+
+	string filePath = GetNewRunPath();
+	ofstream stream(filePath, ios::binary);
 	Check(!stream.is_open(), (boost::format("Can't open file %1%") % filePath).str());
+	m_runs.push_back(filePath);
+
+	for (const auto& key : keys)
+		WriteRunKey(stream, key.first, m_order, *key.second);
+	stream.close();
+	Check(!stream, (boost::format("Can't write file %1%") % filePath).str());
+
+	m_chain = Chain(m_order);
+	m_memory = 0;
+}
+
+template <typename Func>
+void ExternalModelBuilder::MergeRuns(size_t begin, size_t end, size_t memory, Func func)
+{
+	vector<unique_ptr<RunReader>> readers;
+	for (size_t run = begin; run < end; ++run)
+		readers.emplace_back(new RunReader(m_runs[run], m_order, readers.size()));
+
+	// Smallest key on top, runs with the same key in order of spilling, so transitions
+	// get the same order as in a model built in memory
+	auto isGreater = [](const RunReader* a, const RunReader* b)
+	{
+		return a->key != b->key ? a->key > b->key : a->index > b->index;
+	};
+	priority_queue<RunReader*, vector<RunReader*>, decltype(isGreater)> queue(isGreater);
+
+	// Transitions of readers, merged transitions and the largest ones, which the encoder copies
+	size_t readersMemory = 0, maxTransitions = 0;
+	auto read = [&](RunReader* reader)
+	{
+		readersMemory -= reader->transitions.capacity() * sizeof(Transition);
+		if (reader->Read())
+			queue.push(reader);
+		readersMemory += reader->transitions.capacity() * sizeof(Transition);
+	};
+	for (auto& reader : readers)
+		read(reader.get());
 
-	stream << m_order << endl;
-	for (auto& value : m_chain)
+	vector<WordId> key;
+	Transitions transitions;
+	while (!queue.empty())
 	{
-		stream << value.first << " ";
-		stream << boost::join(value.second, " ");
-		stream << endl;
+		key = queue.top()->key;
+		transitions.clear();
+		while (!queue.empty() && queue.top()->key == key)
+		{
+			RunReader* reader = queue.top();
+			queue.pop();
+			for (const auto& transition : reader->transitions)
+				MarkovChainModel::AddTransition(transitions, transition.word, transition.count);
+			read(reader);
+		}
+
+		maxTransitions = max(maxTransitions, transitions.size());
+		CountMemory(memory + readers.size() * StreamMemory + readersMemory + transitions.capacity() * sizeof(Transition) +
+			maxTransitions * (sizeof(Transition) + sizeof(WordId)));
+		func(key, transitions);
 	}
 }
 
-MarkovChainView::MarkovChainView(string filePath, uint32_t order) 
-	: MarkovChainModel(order), 
-	  m_stream(filePath)
+void ExternalModelBuilder::SaveBinary(const string& filePath, const BinaryModelLayout& layout, const PruneOptions& pruneOptions)
 {
-	Check(!m_stream.is_open(), (boost::format("Can't open file: %1%") % filePath).str());
+	Spill();
+
+	// Half of the budget left by vocabulary and output files is for readers of runs. Runs are merged
+	// by groups of consecutive runs until they can be read at once, order of spilling is kept.
+	const size_t outputMemory = GetVocabularyMemory() + 7 * StreamMemory;
+	const size_t maxRuns = max<size_t>(2, (m_memoryBudget - min(m_memoryBudget, outputMemory)) / 2 / StreamMemory);
+	while (m_runs.size() > maxRuns)
+	{
+		for (size_t begin = 0; begin < m_runs.size(); ++begin)
+		{
+			const size_t end = min(m_runs.size(), begin + maxRuns);
+			if (end - begin < 2)
+				break;
+			string runPath = GetNewRunPath();
+			ofstream stream(runPath, ios::binary);
+			Check(!stream.is_open(), (boost::format("Can't open file %1%") % runPath).str());
+			m_runs.insert(m_runs.begin() + end, runPath);
+
+			MergeRuns(begin, end, GetVocabularyMemory() + StreamMemory, [&](const vector<WordId>& key, Transitions& transitions)
+			{
+				WriteRunKey(stream, key.data(), m_order, transitions);
+			});
+			stream.close();
+			Check(!stream, (boost::format("Can't write file %1%") % runPath).str());
+
+			for (size_t run = begin; run < end; ++run)
+				remove(m_runs[run].c_str());
+			m_runs.erase(m_runs.begin() + begin, m_runs.begin() + end);
+		}
+	}
+
+	// Sizes of sections are known only after merge, so sections go to temporary files first.
+	// Hashes of keys go to a file for the index too.
+	ofstream keysStream(m_tempPath + ".keys", ios::binary);
+	ofstream rangesStream(m_tempPath + ".ranges", ios::binary);
+	ofstream bitOffsetsStream(m_tempPath + ".offsets", ios::binary);
+	ofstream transitionsStream(m_tempPath + ".transitions", ios::binary);
+	ofstream weightsStream(m_tempPath + ".weights", ios::binary);
+	ofstream hashesStream(m_tempPath + ".hashes", ios::binary);
+	Check(!keysStream.is_open() || !rangesStream.is_open() || !bitOffsetsStream.is_open() || !transitionsStream.is_open() ||
+		!weightsStream.is_open() || !hashesStream.is_open(), "Can't create temporary files");
+
+	TransitionsEncoder encoder(layout, m_vocabulary.GetSize(), bitOffsetsStream, transitionsStream, weightsStream);
+	uint64_t keysCount = 0, transitionsCount = 0;
+	MergeRuns(0, m_runs.size(), outputMemory, [&](const vector<WordId>& key, Transitions& transitions)
+	{
+		if (!MarkovChainModel::PruneTransitions(transitions, pruneOptions))
+			return;
 
-	wstring line;
-	getline(m_stream, line);
-	Check(m_order != stol(line), "Order from file is not compatible, order wrong");
+		keysCount++;
+		transitionsCount += transitions.size();
+		const uint64_t hash = HashKey(key.data(), m_order);
+		keysStream.write(reinterpret_cast<const char*>(key.data()), m_order * sizeof(WordId));
+		rangesStream.write(reinterpret_cast<const char*>(&transitionsCount), sizeof(transitionsCount));
+		hashesStream.write(reinterpret_cast<const char*>(&hash), sizeof(hash));
+		encoder.Add(transitions);
+	});
+	encoder.Close();
 
-	struct stat stat_buf;
-	Check(stat(filePath.c_str(), &stat_buf) == -1, (boost::format("Can't get file size: %1%") % filePath).str());
-	m_size = stat_buf.st_size;
+	keysStream.close();
+	rangesStream.close();
+	bitOffsetsStream.close();
+	transitionsStream.close();
+	weightsStream.close();
+	hashesStream.close();
+	Check(!keysStream || !rangesStream || !bitOffsetsStream || !transitionsStream || !weightsStream || !hashesStream,
+		"Can't write temporary files");
+
+	// Vocabulary isn't needed after words are written
+	BinaryModelWriter writer(filePath, m_vocabulary, m_order, keysCount, transitionsCount, layout,
+		encoder.GetTransitionsSize(), encoder.GetWeightsSize());
+	m_vocabulary = Vocabulary();
+
+	// Sections are copied by the writer with a buffer of BufferSize
+	CountMemory(2 * StreamMemory + BufferSize);
+	writer.Pad(writer.GetHeader().keysOffset);
+	writer.Copy(m_tempPath + ".keys");
+	writer.Pad(writer.GetHeader().rangesOffset);
+	const uint64_t range = 0;
+	writer.Write(&range, sizeof(range));
+	writer.Copy(m_tempPath + ".ranges");
+	writer.Copy(m_tempPath + ".offsets");
+	writer.Copy(m_tempPath + ".transitions");
+	if (layout.IsCompact())
+	{
+		writer.Pad(writer.GetHeader().weightsOffset);
+		writer.Copy(m_tempPath + ".weights");
+	}
+	writer.Pad(writer.GetHeader().slotsOffset);
+	CountMemory(StreamMemory + writer.WriteSlots(m_tempPath + ".hashes", m_tempPath, m_memoryBudget - min(m_memoryBudget, StreamMemory)));
+	writer.Close();
+
+	RemoveFiles();
 }
 
-bool MarkovChainView::GetNextWord(const wstring& key, wstring& word)
+void ExternalModelBuilder::RemoveFiles()
 {
-	Chain::const_iterator it = m_chain.find(key);
-	if (it != m_chain.end())
+	for (const auto& run : m_runs)
+		remove(run.c_str());
+	m_runs.clear();
+
+	for (const char* suffix : { ".keys", ".ranges", ".offsets", ".transitions", ".weights", ".hashes" })
+		remove((m_tempPath + suffix).c_str());
+}
+
+MarkovChainView::MarkovChainView(string filePath, uint32_t order, uint64_t seed)
+	: MarkovChainModel(order),
+	  m_file(filePath),
+	  m_transitions(nullptr),
+	  m_ids(nullptr),
+	  m_bitOffsets(nullptr),
+	  m_bits(nullptr),
+	  m_bitsCount(0),
+	  m_weights(nullptr),
+	  m_state(order, seed)
+{
+	Check(m_file.GetSize() < sizeof(m_header), "Bad model, file is too small");
+	memcpy(&m_header, m_file.GetData(), sizeof(m_header));
+	Check(!equal(m_header.magic, m_header.magic + sizeof(m_header.magic), BinaryModelMagic), "Bad model, it is not a binary model file");
+	Check(m_order != m_header.order, "Order from file is not compatible, order wrong");
+	Check(m_header.fileSize != m_file.GetSize(), "Bad model, wrong file size");
+	Check(m_header.slotsCount == 0 || (m_header.slotsCount & (m_header.slotsCount - 1)) != 0 || m_header.keysCount >= m_header.slotsCount,
+		"Bad model, wrong index size");
+	Check((m_header.weightBits != 8 && m_header.weightBits != 16 && m_header.weightBits != 32) || m_header.eliasFano > 1,
+		"Bad model, unknown layout");
+
+	BinaryModelLayout layout;
+	layout.weightBits = m_header.weightBits;
+	layout.eliasFano = m_header.eliasFano != 0;
+	if (!layout.IsCompact())
 	{
-		word = GetRandomWord((MarkovChainModel::ChainValue)*it);
-		return true;
+		m_transitions = m_file.GetSection<Transition>(m_header.transitionsOffset, m_header.transitionsCount);
 	}
 	else
 	{
-		ChainValue result;
-		if (SearchKey(key, 2, m_size, result))
+		if (layout.eliasFano)
+		{
+			m_bitOffsets = m_file.GetSection<uint64_t>(m_header.transitionsOffset, m_header.keysCount + 1);
+			const uint64_t bitsOffset = m_header.transitionsOffset + (m_header.keysCount + 1) * sizeof(uint64_t);
+			Check(m_header.weightsOffset < bitsOffset, "Bad model, wrong transitions");
+			m_bits = m_file.GetSection<uint64_t>(bitsOffset, (m_header.weightsOffset - bitsOffset) / sizeof(uint64_t));
+			m_bitsCount = (m_header.weightsOffset - bitsOffset) / sizeof(uint64_t) * 64;
+		}
+		else
+		{
+			m_ids = m_file.GetSection<WordId>(m_header.transitionsOffset, m_header.transitionsCount);
+		}
+		m_weights = m_file.GetSection<unsigned char>(m_header.weightsOffset, m_header.transitionsCount * m_header.weightBits / 8);
+	}
+
+	m_keys = m_file.GetSection<WordId>(m_header.keysOffset, m_header.keysCount * m_order);
+	m_ranges = m_file.GetSection<uint64_t>(m_header.rangesOffset, m_header.keysCount + 1);
+	m_slots = m_file.GetSection<uint32_t>(m_header.slotsOffset, m_header.slotsCount);
+
+	// Only vocabulary is read, it is needed to convert words of the prompt to ids
+	DecodeWords(m_file, m_header.wordsOffset, m_header.wordsCount, *m_vocabulary);
+	m_wordOffsets = m_file.GetSection<uint64_t>(m_header.wordsOffset, m_header.wordsCount + 1);
+	m_words = m_file.GetSection<char>(m_header.wordsOffset + (m_header.wordsCount + 1) * sizeof(uint64_t), m_wordOffsets[m_header.wordsCount]);
+}
+
+bool MarkovChainView::GetNextWord(const WordId* key, State& state, WordId& word) const
+{
+	const AliasTable* sampler = state.samplers.Find(key);
+	if (sampler == nullptr)
+	{
+		uint64_t index;
+		if (!FindKey(key, index))
+			return false;
+
+		uint64_t begin = m_ranges[index], end = m_ranges[index + 1];
+		Check(begin >= end || end > m_header.transitionsCount, "Bad model, wrong transitions");
+
+		const Transition* transitions = m_transitions + begin;
+		if (m_transitions == nullptr)
+		{
+			DecodeTransitions(index, state.decoded);
+			transitions = state.decoded.data();
+		}
+		for (uint64_t i = 0; i < end - begin; ++i)
+			Check(transitions[i].word >= m_header.wordsCount || transitions[i].count == 0, "Bad model, wrong transitions");
+
+		const size_t size = AliasTable::GetMemoryUsage(end - begin) + m_order * sizeof(WordId);
+		if (size > MaxCachedSamplersSize / 4)
 		{
-			word = GetRandomWord(result);
-			m_chain.insert(result);
+			word = AliasTable::SampleDirectly(transitions, end - begin, state.random);
 			return true;
 		}
+		if (state.samplersSize + size > MaxCachedSamplersSize)
+		{
+			state.samplers.Clear();
+			state.samplersSize = 0;
+		}
+
+		AliasTable& cached = state.samplers[key];
+		cached.Build(transitions, end - begin);
+		state.samplersSize += size;
+		sampler = &cached;
+	}
+
+	word = sampler->Sample(state.random);
+	return true;
+}
+
+void MarkovChainView::DecodeTransitions(uint64_t index, vector<Transition>& transitions) const
+{
+	const uint64_t begin = m_ranges[index], count = m_ranges[index + 1] - begin;
+	transitions.resize(count);
+
+	vector<WordId> ids(count);
+	if (m_bits != nullptr)
+	{
+		const uint64_t offset = m_bitOffsets[index];
+		const uint64_t next = m_bitOffsets[index + 1];
+		Check(offset > next || next > m_bitsCount || next - offset != GetEliasFanoSize(count, m_header.wordsCount),
+			"Bad model, wrong transitions");
+		Check(!DecodeEliasFano(m_bits, offset, count, m_header.wordsCount, ids.data()), "Bad model, wrong transitions");
+	}
+	else
+	{
+		copy_n(m_ids + begin, count, ids.begin());
+	}
+
+	for (uint64_t i = 0; i < count; ++i)
+	{
+		transitions[i].word = ids[i];
+		switch (m_header.weightBits)
+		{
+		case 8:
+			transitions[i].count = m_weights[begin + i];
+			break;
+		case 16:
+			transitions[i].count = reinterpret_cast<const uint16_t*>(m_weights)[begin + i];
+			break;
+		default:
+			transitions[i].count = reinterpret_cast<const uint32_t*>(m_weights)[begin + i];
+		}
+	}
+}
+
+bool MarkovChainView::FindKey(const WordId* key, uint64_t& index) const
+{
+	// Word absent in vocabulary can't be a part of any key
+	if (any_of(key, key + m_order, [](WordId id) { return id == Vocabulary::Unknown; }))
+		return false;
+
+	const uint64_t mask = m_header.slotsCount - 1;
+	uint64_t slot = HashKey(key, m_order) & mask;
+	for (uint64_t probes = 0; probes < m_header.slotsCount && m_slots[slot] != EmptySlot; ++probes, slot = (slot + 1) & mask)
+	{
+		index = m_slots[slot];
+		Check(index >= m_header.keysCount, "Bad model, wrong index");
+		if (equal(key, key + m_order, m_keys + index * m_order))
+			return true;
 	}
-	
 	return false;
 }
-	
-wstring MarkovChainView::GetRandomWord(ChainValue& value) const
+
+BackoffModelBuilder::BackoffModelBuilder(uint32_t maxOrder, shared_ptr<Vocabulary> vocabulary)
+	: m_maxOrder(maxOrder),
+	  m_vocabulary(vocabulary)
+{
+	Check(maxOrder == 0, "Order of model should be positive");
+	for (uint32_t order = 1; order <= maxOrder; ++order)
+		m_chains.emplace_back(order);
+}
+
+void BackoffModelBuilder::AddText(TextStream& stream, const wchar_t* text, size_t size)
+{
+	stream.tokenizer.Write(text, size, [&](const wchar_t* word, size_t length) { AddWord(stream.window, word, length); });
+}
+
+void BackoffModelBuilder::AddText(TextStream& stream, const char* text, size_t size)
+{
+	stream.utf8Tokenizer.Write(text, size, [&](const wchar_t* word, size_t length) { AddWord(stream.window, word, length); });
+}
+
+void BackoffModelBuilder::EndText(TextStream& stream)
+{
+	auto addWord = [&](const wchar_t* word, size_t length) { AddWord(stream.window, word, length); };
+	stream.tokenizer.Close(addWord);
+	stream.utf8Tokenizer.Close(addWord);
+	Check(stream.window.GetCount() < 2, "Text is too small");
+}
+
+// Context of order k is the last k words of the window, they are valid before the window is full too
+void BackoffModelBuilder::AddWord(NGramWindow& window, const wchar_t* word, size_t length)
+{
+	WordId id = m_vocabulary->Add(word, length);
+	if (id >= m_wordCounts.size())
+		m_wordCounts.resize(id + 1, 0);
+	m_wordCounts[id]++;
+
+	const WordId* end = window.GetKey() + m_maxOrder;
+	const size_t count = min<size_t>(window.GetCount(), m_maxOrder);
+	for (size_t order = 1; order <= count; ++order)
+		MarkovChainModel::AddTransition(m_chains[order - 1][end - order], id, 1);
+	window.Push(id);
+}
+
+size_t BackoffModelBuilder::GetSize() const
 {
-	const auto& list = value.second;
-	size_t size = distance(list.begin(), list.end());
-	size_t pos = size != 0 ? GenerateRandom(0, size - 1) : 0;
-	auto randomValue = list.begin();
-	advance(randomValue, pos);
-	return *randomValue;
+	size_t size = 1;
+	for (const auto& chain : m_chains)
+		size += chain.GetSize();
+	return size;
 }
 
-bool MarkovChainView::SearchKey(const wstring& key, uint32_t l, uint32_t r, ChainValue& result)
+void BackoffModelBuilder::SaveBinary(const string& filePath, const PruneOptions& pruneOptions)
 {
-	if (r >= l)
+	// Every level of the trie is reversed contexts of one order in sorted order,
+	// then children of a node follow each other and go in order of parents
+	struct Level
 	{
-		int mid = l + (r - l) / 2;
+		vector<WordId> keys;
+		vector<const Transitions*> transitions;
+		// Index of parent in previous level for every node
+		vector<uint64_t> parents;
+	};
 
-		wstring line;
-		GetLine(mid, line);
-		SplitLine(line, result);
+	Transitions words;
+	for (WordId id = 0; id < m_wordCounts.size(); ++id)
+	{
+		if (m_wordCounts[id] != 0)
+			words.push_back(Transition{ id, m_wordCounts[id] });
+	}
+	MarkovChainModel::PruneTransitions(words, pruneOptions);
 
-		if (result.first == key)
-			return true;
+	vector<Level> levels(m_maxOrder + 1);
+	levels[0].transitions.push_back(&words);
+	for (uint32_t order = 1; order <= m_maxOrder; ++order)
+	{
+		vector<WordId> keys;
+		vector<const Transitions*> transitions;
+		m_chains[order - 1].ForEach([&](const WordId* key, Transitions& keyTransitions)
+		{
+			if (!MarkovChainModel::PruneTransitions(keyTransitions, pruneOptions))
+				return;
+			keys.insert(keys.end(), reverse_iterator<const WordId*>(key + order), reverse_iterator<const WordId*>(key));
+			transitions.push_back(&keyTransitions);
+		});
+
+		vector<size_t> sorted(transitions.size());
+		for (size_t i = 0; i < sorted.size(); ++i)
+			sorted[i] = i;
+		sort(sorted.begin(), sorted.end(), [&](size_t a, size_t b)
+		{
+			return lexicographical_compare(&keys[a * order], &keys[a * order] + order, &keys[b * order], &keys[b * order] + order);
+		});
 
-		if (result.first > key)
-			return SearchKey(key, l, mid - 1, result);
+		// Parent is the context without the oldest word, it is found by walking both sorted levels.
+		// Context left without parent by pruning is dropped.
+		const Level& parents = levels[order - 1];
+		Level& level = levels[order];
+		uint64_t parent = 0;
+		for (size_t index : sorted)
+		{
+			const WordId* key = &keys[index * order];
+			auto getParentKey = [&](uint64_t node) { return parents.keys.data() + node * (order - 1); };
+			while (parent < parents.transitions.size() && lexicographical_compare(getParentKey(parent), getParentKey(parent) + order - 1, key, key + order - 1))
+				parent++;
+			if (parent == parents.transitions.size() || !equal(key, key + order - 1, getParentKey(parent)))
+				continue;
 
-		return SearchKey(key, mid + 1, r, result);
+			level.keys.insert(level.keys.end(), key, key + order);
+			level.transitions.push_back(transitions[index]);
+			level.parents.push_back(parent);
+		}
 	}
 
-	return false;
+	BackoffModelHeader header = {};
+	copy_n(BackoffModelMagic, sizeof(BackoffModelMagic), header.magic);
+	header.order = m_maxOrder;
+	header.wordsCount = m_vocabulary->GetSize();
+	for (const auto& level : levels)
+	{
+		header.nodesCount += level.transitions.size();
+		for (const auto* transitions : level.transitions)
+			header.transitionsCount += transitions->size();
+	}
+
+	vector<uint64_t> wordOffsets;
+	string wordsData;
+	EncodeWords(*m_vocabulary, wordOffsets, wordsData);
+
+	header.wordsOffset = AlignOffset(sizeof(header));
+	header.labelsOffset = AlignOffset(header.wordsOffset + wordOffsets.size() * sizeof(uint64_t) + wordsData.size());
+	header.childrenOffset = AlignOffset(header.labelsOffset + header.nodesCount * sizeof(WordId));
+	header.rangesOffset = header.childrenOffset + (header.nodesCount + 1) * sizeof(uint64_t);
+	header.transitionsOffset = header.rangesOffset + (header.nodesCount + 1) * sizeof(uint64_t);
+	header.fileSize = header.transitionsOffset + header.transitionsCount * sizeof(Transition);
+
+	ofstream stream(filePath, ios::binary);
+	Check(!stream.is_open(), (boost::format("Can't open file %1%") % filePath).str());
+
+	uint64_t position = 0;
+	auto write = [&](const void* data, uint64_t size)
+	{
+		stream.write(static_cast<const char*>(data), size);
+		position += size;
+	};
+	auto pad = [&](uint64_t offset)
+	{
+		const char zeros[8] = {};
+		write(zeros, offset - position);
+	};
+
+	write(&header, sizeof(header));
+	pad(header.wordsOffset);
+	write(wordOffsets.data(), wordOffsets.size() * sizeof(uint64_t));
+	write(wordsData.data(), wordsData.size());
+
+	// Label is the oldest word of the context, the rest is the context of the parent
+	pad(header.labelsOffset);
+	const WordId rootLabel = Vocabulary::Unknown;
+	write(&rootLabel, sizeof(rootLabel));
+	for (uint32_t order = 1; order <= m_maxOrder; ++order)
+	{
+		for (size_t node = 0; node < levels[order].transitions.size(); ++node)
+			write(&levels[order].keys[node * order + order - 1], sizeof(WordId));
+	}
+
+	pad(header.childrenOffset);
+	uint64_t levelStart = 0;
+	for (uint32_t order = 0; order <= m_maxOrder; ++order)
+	{
+		const uint64_t nextLevelStart = levelStart + levels[order].transitions.size();
+		const vector<uint64_t> noChildren;
+		const vector<uint64_t>& childParents = order < m_maxOrder ? levels[order + 1].parents : noChildren;
+
+		size_t child = 0;
+		for (uint64_t node = 0; node < levels[order].transitions.size(); ++node)
+		{
+			while (child < childParents.size() && childParents[child] < node)
+				child++;
+			const uint64_t firstChild = nextLevelStart + child;
+			write(&firstChild, sizeof(firstChild));
+		}
+		levelStart = nextLevelStart;
+	}
+	write(&header.nodesCount, sizeof(header.nodesCount));
+
+	uint64_t range = 0;
+	write(&range, sizeof(range));
+	for (const auto& level : levels)
+	{
+		for (const auto* transitions : level.transitions)
+		{
+			range += transitions->size();
+			write(&range, sizeof(range));
+		}
+	}
+
+	for (const auto& level : levels)
+	{
+		for (const auto* transitions : level.transitions)
+			write(transitions->data(), transitions->size() * sizeof(Transition));
+	}
+
+	stream.close();
+	Check(!stream || position != header.fileSize, (boost::format("Can't write file %1%") % filePath).str());
+}
+
+BackoffModelView::BackoffModelView(const string& filePath, uint64_t seed)
+	: m_file(filePath),
+	  m_vocabulary(make_shared<Vocabulary>()),
+	  m_state(seed)
+{
+	Check(m_file.GetSize() < sizeof(m_header), "Bad model, file is too small");
+	memcpy(&m_header, m_file.GetData(), sizeof(m_header));
+	Check(!equal(m_header.magic, m_header.magic + sizeof(m_header.magic), BackoffModelMagic), "Bad model, it is not a backoff model file");
+	Check(m_header.fileSize != m_file.GetSize(), "Bad model, wrong file size");
+	Check(m_header.order == 0 || m_header.nodesCount == 0, "Bad model, no contexts");
+
+	m_labels = m_file.GetSection<WordId>(m_header.labelsOffset, m_header.nodesCount);
+	m_children = m_file.GetSection<uint64_t>(m_header.childrenOffset, m_header.nodesCount + 1);
+	m_ranges = m_file.GetSection<uint64_t>(m_header.rangesOffset, m_header.nodesCount + 1);
+	m_transitions = m_file.GetSection<Transition>(m_header.transitionsOffset, m_header.transitionsCount);
+
+	DecodeWords(m_file, m_header.wordsOffset, m_header.wordsCount, *m_vocabulary);
+	m_wordOffsets = m_file.GetSection<uint64_t>(m_header.wordsOffset, m_header.wordsCount + 1);
+	m_words = m_file.GetSection<char>(m_header.wordsOffset + (m_header.wordsCount + 1) * sizeof(uint64_t), m_wordOffsets[m_header.wordsCount]);
+}
+
+bool BackoffModelView::IsBackoffModel(const string& filePath)
+{
+	ifstream stream(filePath, ios::binary);
+	char magic[sizeof(BackoffModelMagic)] = {};
+	stream.read(magic, sizeof(magic));
+	return stream && equal(magic, magic + sizeof(magic), BackoffModelMagic);
 }
 
-void MarkovChainView::SplitLine(const wstring& line, ChainValue& result)
+bool BackoffModelView::GetNextWord(const WordId* key, State& state, WordId& word) const
 {
-	vector<wstring> words;
-	boost::split(words, line, boost::is_any_of(" "));
-	auto currentWord = words.begin();
+	// Context goes from the last word of the key back while the trie has it
+	uint64_t node = 0;
+	for (uint32_t i = 0; i < m_header.order && key[m_header.order - 1 - i] != Vocabulary::Unknown; ++i)
+	{
+		uint64_t child = FindChild(node, key[m_header.order - 1 - i]);
+		if (child == 0)
+			break;
+		node = child;
+	}
 
-	wstring key;
-	for (uint32_t i = 1; i <= m_order; ++i, ++currentWord)
+	auto sampler = state.samplers.find(node);
+	if (sampler == state.samplers.end())
 	{
-		Check(currentWord == words.end(), "Bad model");
+		uint64_t begin = m_ranges[node], end = m_ranges[node + 1];
+		Check(begin > end || end > m_header.transitionsCount, "Bad model, wrong transitions");
+		if (begin == end)
+			return false;
+		for (uint64_t i = begin; i < end; ++i)
+			Check(m_transitions[i].word >= m_header.wordsCount || m_transitions[i].count == 0, "Bad model, wrong transitions");
 
-		key += *currentWord;
-		if (i != m_order)
-			key += L" ";
+		const size_t size = AliasTable::GetMemoryUsage(end - begin) + sizeof(node);
+		if (size > MaxCachedSamplersSize / 4)
+		{
+			word = AliasTable::SampleDirectly(m_transitions + begin, end - begin, state.random);
+			return true;
+		}
+		if (state.samplersSize + size > MaxCachedSamplersSize)
+		{
+			state.samplers.clear();
+			state.samplersSize = 0;
+		}
+
+		sampler = state.samplers.emplace(node, AliasTable()).first;
+		sampler->second.Build(m_transitions + begin, end - begin);
+		state.samplersSize += size;
 	}
-	
-	result.first = key;
-	result.second = forward_list<wstring>(currentWord, words.end());
+
+	word = sampler->second.Sample(state.random);
+	return true;
 }
 
-void MarkovChainView::GetLine(uint32_t pos, wstring& line)
+uint64_t BackoffModelView::FindChild(uint64_t node, WordId label) const
 {
-	m_stream.seekg(std::ios::beg);
-	m_stream.seekg(pos);
-	m_stream.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-	getline(m_stream, line);
-}
\ No newline at end of file
+	const uint64_t begin = m_children[node], end = m_children[node + 1];
+	if (begin == end)
+		return 0;
+	Check(begin <= node || begin > end || end > m_header.nodesCount, "Bad model, wrong trie");
+
+	const WordId* child = lower_bound(m_labels + begin, m_labels + end, label);
+	return child != m_labels + end && *child == label ? child - m_labels : 0;
+}
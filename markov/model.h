@@ -2,83 +2,437 @@
 #define MODEL_H
 
 #include "common.h"
-#include <map>
-#include <forward_list>
-#include <deque>
+#include "ngram_table.h"
+#include "vocabulary.h"
+#include "alias_table.h"
+#include "binary_model.h"
+#include "elias_fano.h"
+#include "mapped_file.h"
+#include "tokenizer.h"
+#include "utf8_tokenizer.h"
+#include <memory>
 #include <random>
+#include <mutex>
+#include <unordered_map>
 
+// Last words of generated text, they are the key of the next word
 class Sentence
 {
 public:
-	Sentence(const wstring& str, uint32_t size)
+	// Words absent in vocabulary get Vocabulary::Unknown id, such key is never found.
+	// Short sentence is padded by unknown words before it.
+	Sentence(const wstring& str, uint32_t size, const Vocabulary& vocabulary)
+		: m_window(size), m_size(size)
 	{
-		boost::split(m_deque, str, boost::is_any_of(" "));
+		vector<wstring> words;
+		boost::split(words, str, boost::is_any_of(" "));
+		for (size_t i = words.size(); i < size; ++i)
+			m_window.Push(Vocabulary::Unknown);
+		for (const auto& word : words)
+			m_window.Push(vocabulary.Find(word));
 	}
 
-	Sentence(vector<wstring> words, uint32_t size)
+	void InsertWord(WordId word)
 	{
-		copy_n(words.begin(), size, back_inserter(m_deque));
+		m_window.Push(word);
 	}
 
-	void InsertWord(const wstring& word)
+	const WordId* GetKey() const
 	{
-		m_deque.pop_front();
-		m_deque.push_back(word);
+		return m_window.GetKey();
 	}
 
-	wstring GetKey()
+	uint32_t GetSize() const
 	{
-		return boost::join(m_deque, L" ");
+		return m_size;
 	}
 
 private:
-	deque<wstring> m_deque;
+	NGramWindow m_window;
+	uint32_t m_size;
+};
+
+// Text being added to a model by chunks: word cut by the end of a chunk and window of last words.
+// Text is either wide or UTF-8, tokenizer of the other kind stays empty.
+struct TextStream
+{
+	explicit TextStream(uint32_t order) : window(order)
+	{
+	}
+
+	Tokenizer tokenizer;
+	Utf8Tokenizer utf8Tokenizer;
+	NGramWindow window;
+};
+
+// Rare keys and transitions make most of a model, limits below drop them
+struct PruneOptions
+{
+	// Transitions seen fewer times are dropped
+	uint32_t minCount = 1;
+	// Keys with less remaining transitions in total are dropped
+	uint32_t minKeyCount = 1;
+	// Only this many most frequent next words of a key are kept, 0 keeps all
+	uint32_t maxTransitions = 0;
 };
 
 class MarkovChainModel
 {
 public:
-	MarkovChainModel(uint32_t order);
+	// Models which are going to be merged should share vocabulary, then merge doesn't remap ids
+	MarkovChainModel(uint32_t order, shared_ptr<Vocabulary> vocabulary = make_shared<Vocabulary>());
 
 	bool CreateModel(vector<wchar_t>& text);
+
+	// Adds text given by chunks of any size, memory doesn't depend on size of the text.
+	// EndText throws if text is shorter than order of model.
+	void BeginText();
+	void AddText(const wchar_t* text, size_t size);
+	void EndText();
 	void Merge(const MarkovChainModel& otherModel);
-	bool Load(const wstring& filePath, bool fullLoad = false);
-	void Save(const string& filePath) const;
 
-	bool operator== (const MarkovChainModel& model) const
+	// Transitions of other model are moved if vocabulary is shared, other model becomes empty
+	void Merge(MarkovChainModel&& otherModel);
+	void SaveBinary(const string& filePath, const BinaryModelLayout& layout = BinaryModelLayout()) const;
+
+	// Drops rare transitions and keys left without transitions
+	void Prune(const PruneOptions& options);
+
+	bool operator== (const MarkovChainModel& model) const;
+
+	size_t GetSize() const
 	{
-		return m_order == model.m_order && m_chain == model.m_chain;
+		return m_chain.GetSize();
 	}
 
-	size_t GetSize() const
+	const shared_ptr<Vocabulary>& GetVocabulary() const
 	{
-		return m_chain.size();
+		return m_vocabulary;
 	}
 
 protected:
-	typedef map<wstring, forward_list<wstring>> Chain;
-	typedef pair<wstring, forward_list<wstring>> ChainValue;
-	
+	friend class ParallelModelBuilder;
+	friend class ExternalModelBuilder;
+	friend class BackoffModelBuilder;
+
+	// Distinct next words of the key with counts
+	typedef vector<Transition> Transitions;
+	typedef NGramTable<Transitions> Chain;
+
+	static void AddTransition(Transitions& transitions, WordId word, uint32_t count);
+
+	// False if the key should be dropped
+	static bool PruneTransitions(Transitions& transitions, const PruneOptions& options);
+	void AddWord(const wchar_t* word, size_t length);
+
+	// Adds transitions of the same key from other table, they are moved when possible
+	static void MoveTransitions(Transitions& transitions, Transitions& otherTransitions);
+
+	typedef pair<const WordId*, const Transitions*> KeyValue;
+	void GetSortedKeys(vector<KeyValue>& keys) const;
+
 	Chain m_chain;
 	uint32_t m_order;
+	shared_ptr<Vocabulary> m_vocabulary;
+
+	// Text being added
+	TextStream m_text;
+};
+
+// Builds one model from many texts on several threads. Every worker adds texts to its own tables
+// split into shards by the top bits of key hash, it takes a lock only for words it sees first time.
+// Then shards are merged in parallel, transitions are moved, not copied. Keys of a shard have home slots
+// in one range of slots of the model table (see NGramTable::GetPart), so shards are moved to the model
+// in parallel too, every thread writes only its own range of slots.
+class ParallelModelBuilder
+{
+public:
+	ParallelModelBuilder(uint32_t order, shared_ptr<Vocabulary> vocabulary, size_t workersCount);
+
+	// Same as in MarkovChainModel, but several texts can be added by one worker at once,
+	// every text has its own stream. Can be called concurrently for different workers.
+	void AddText(size_t worker, TextStream& stream, const wchar_t* text, size_t size);
+	void EndText(size_t worker, TextStream& stream);
+
+	// Raw UTF-8 text, it is lowercased and cleared of punctuation on the way (see Utf8Tokenizer)
+	void AddText(size_t worker, TextStream& stream, const char* text, size_t size);
+
+	// Moves everything to the model, model should share vocabulary with builder
+	void Build(MarkovChainModel& model);
+
+private:
+	typedef MarkovChainModel::Chain Chain;
+
+	struct Worker
+	{
+		// Local ids of words are converted to ids of shared vocabulary
+		Vocabulary words;
+		vector<WordId> globalIds;
+		vector<Chain> shards;
+	};
+
+	void AddWord(Worker& worker, NGramWindow& window, const wchar_t* word, size_t length);
+
+	size_t GetShard(const WordId* key) const
+	{
+		return Chain::GetPart(key, m_order, m_shardsCount);
+	}
+
+	uint32_t m_order;
+	shared_ptr<Vocabulary> m_vocabulary;
+	mutex m_vocabularyMutex;
+	size_t m_shardsCount;
+	vector<Worker> m_workers;
+};
+
+// Builds binary model of texts which don't fit in memory. Transitions are counted in memory
+// until tables would exceed the budget, then they are sorted by key and spilled to a run file.
+// Runs are merged k-way into the sorted binary model, by groups if there are too many of them to read
+// at once. Hashes of keys go to a file and the index is filled part by part (see BinaryModelWriter).
+// Vocabulary stays in memory for the whole build and is counted in the budget.
+class ExternalModelBuilder
+{
+public:
+	// Temporary files are named tempPath + suffix, memoryBudget is in bytes
+	ExternalModelBuilder(uint32_t order, const string& tempPath, size_t memoryBudget);
+	~ExternalModelBuilder();
+
+	ExternalModelBuilder(const ExternalModelBuilder&) = delete;
+	ExternalModelBuilder& operator= (const ExternalModelBuilder&) = delete;
+
+	// Same as in ParallelModelBuilder, but on one thread
+	void AddText(TextStream& stream, const wchar_t* text, size_t size);
+	void AddText(TextStream& stream, const char* text, size_t size);
+	void EndText(TextStream& stream);
+
+	// Merges runs into the file pruning the model on the way, builder is empty after that
+	void SaveBinary(const string& filePath, const BinaryModelLayout& layout = BinaryModelLayout(),
+		const PruneOptions& pruneOptions = PruneOptions());
+
+	size_t GetRunsCount() const
+	{
+		return m_runs.size();
+	}
+
+	// Largest memory taken by the build so far by its own estimate, it stays within the budget
+	size_t GetPeakMemory() const
+	{
+		return m_peakMemory;
+	}
+
+private:
+	typedef MarkovChainModel::Transitions Transitions;
+	typedef MarkovChainModel::Chain Chain;
+
+	class RunReader;
+
+	void AddWord(NGramWindow& window, const wchar_t* word, size_t length);
+	void Spill();
+	void RemoveFiles();
+	string GetNewRunPath();
+
+	// Merges runs [begin, end) k-way, func gets every key with transitions of all these runs added up.
+	// memory is taken by the caller besides the readers.
+	template <typename Func>
+	void MergeRuns(size_t begin, size_t end, size_t memory, Func func);
+
+	// Memory of counting tables with the given capacity of the table
+	size_t GetCountingMemory(size_t capacity) const;
+
+	// Vocabulary is counted twice: the binary writer makes a UTF-8 copy of it
+	size_t GetVocabularyMemory() const
+	{
+		return 2 * m_vocabulary.GetMemoryUsage();
+	}
+
+	void CountMemory(size_t memory)
+	{
+		m_peakMemory = max(m_peakMemory, memory);
+	}
+
+	uint32_t m_order;
+	string m_tempPath;
+	size_t m_memoryBudget;
+	Vocabulary m_vocabulary;
+	Chain m_chain;
+
+	// Estimated size of transitions of m_chain in bytes
+	size_t m_memory;
+	size_t m_peakMemory;
+	vector<string> m_runs;
+	size_t m_runsCreated;
+};
+
+// Counts contexts of all orders up to maxOrder at once and saves them as one backoff model
+// (see BackoffModelHeader), so generation can fall back to a shorter context instead of stopping
+class BackoffModelBuilder
+{
+public:
+	BackoffModelBuilder(uint32_t maxOrder, shared_ptr<Vocabulary> vocabulary = make_shared<Vocabulary>());
+
+	// Same as in ParallelModelBuilder but on one thread, streams should be of maxOrder
+	void AddText(TextStream& stream, const wchar_t* text, size_t size);
+	void AddText(TextStream& stream, const char* text, size_t size);
+	void EndText(TextStream& stream);
+
+	// Pruned context drops longer contexts continuing it, builder is pruned too
+	void SaveBinary(const string& filePath, const PruneOptions& pruneOptions = PruneOptions());
+
+	// Number of contexts of all orders
+	size_t GetSize() const;
+
+private:
+	typedef MarkovChainModel::Transitions Transitions;
+	typedef MarkovChainModel::Chain Chain;
+
+	void AddWord(NGramWindow& window, const wchar_t* word, size_t length);
+
+	uint32_t m_maxOrder;
+	shared_ptr<Vocabulary> m_vocabulary;
+
+	// Count of every word is the context of order 0, contexts of order k are in m_chains[k - 1]
+	vector<uint32_t> m_wordCounts;
+	vector<Chain> m_chains;
 };
 
+// Generates text by binary model file mapped to memory (see binary_model.h),
+// only vocabulary is loaded and ids of the view are ids of the file
 class MarkovChainView : protected MarkovChainModel
 {
 public:
-	MarkovChainView(string filePath, uint32_t order);
-	bool GetNextWord(const wstring& key, wstring& word);
+	// Random generator and samplers of one generating thread. View is not changed by generation
+	// with a state, so threads with states of their own share one view.
+	struct State
+	{
+		State(uint32_t order, uint64_t seed) : samplers(order), samplersSize(0), random(seed)
+		{
+		}
+
+		// Bounded by MaxCachedSamplersSize
+		NGramTable<AliasTable> samplers;
+		size_t samplersSize;
+		vector<Transition> decoded;
+		mt19937_64 random;
+	};
+
+	// Same seed gives the same text
+	MarkovChainView(string filePath, uint32_t order, uint64_t seed = random_device()());
+
+	State CreateState(uint64_t seed) const
+	{
+		return State(m_order, seed);
+	}
+
+	bool GetNextWord(const WordId* key, State& state, WordId& word) const;
+
+	bool GetNextWord(const WordId* key, WordId& word)
+	{
+		return GetNextWord(key, m_state, word);
+	}
+
+	// Word as it is stored in the file, UTF-8 is not null terminated
+	const char* GetUtf8Word(WordId id, size_t& length) const
+	{
+		length = m_wordOffsets[id + 1] - m_wordOffsets[id];
+		return m_words + m_wordOffsets[id];
+	}
+
+	using MarkovChainModel::GetVocabulary;
 	
 private:
-	wstring GetRandomWord(ChainValue& value) const;
-	bool SearchKey(const wstring& key, uint32_t l, uint32_t r, ChainValue& result);
-	void GetLine(uint32_t pos, wstring& line);
-	void SplitLine(const wstring& line, ChainValue& result);
-	
-	wfstream m_stream;
-	uint32_t m_size;
+	// Hash probe in file index, false if there is no such key
+	bool FindKey(const WordId* key, uint64_t& index) const;
+
+	// Transitions of key in compact layout, weights are in place of counts
+	void DecodeTransitions(uint64_t index, vector<Transition>& transitions) const;
+
+	MappedFile m_file;
+	BinaryModelHeader m_header;
+	const WordId* m_keys;
+	const uint64_t* m_ranges;
+	const Transition* m_transitions;
+
+	// Compact layout: plain or Elias-Fano coded ids and weights of 1, 2 or 4 bytes
+	const WordId* m_ids;
+	const uint64_t* m_bitOffsets;
+	const uint64_t* m_bits;
+	uint64_t m_bitsCount;
+	const unsigned char* m_weights;
+	const uint32_t* m_slots;
+	const uint64_t* m_wordOffsets;
+	const char* m_words;
+
+	// State of generation by the view itself
+	State m_state;
 };
 
+// Generates text by backoff model file mapped to memory: the next word follows the longest context
+// of the key known by the model, down to no context at all
+class BackoffModelView
+{
+public:
+	// Random generator and samplers of nodes used by one generating thread
+	struct State
+	{
+		explicit State(uint64_t seed) : samplersSize(0), random(seed)
+		{
+		}
+
+		// Bounded by MaxCachedSamplersSize
+		unordered_map<uint64_t, AliasTable> samplers;
+		size_t samplersSize;
+		mt19937_64 random;
+	};
+
+	explicit BackoffModelView(const string& filePath, uint64_t seed = random_device()());
+
+	static bool IsBackoffModel(const string& filePath);
+
+	State CreateState(uint64_t seed) const
+	{
+		return State(seed);
+	}
+
+	// Key is the last GetOrder() words, unknown word ends the context.
+	// False only if the model is empty.
+	bool GetNextWord(const WordId* key, State& state, WordId& word) const;
 
+	bool GetNextWord(const WordId* key, WordId& word)
+	{
+		return GetNextWord(key, m_state, word);
+	}
+
+	const char* GetUtf8Word(WordId id, size_t& length) const
+	{
+		length = m_wordOffsets[id + 1] - m_wordOffsets[id];
+		return m_words + m_wordOffsets[id];
+	}
+
+	uint32_t GetOrder() const
+	{
+		return m_header.order;
+	}
+
+	const shared_ptr<Vocabulary>& GetVocabulary() const
+	{
+		return m_vocabulary;
+	}
+
+private:
+	// Child of the node with the label or 0 (the root is nobody's child)
+	uint64_t FindChild(uint64_t node, WordId label) const;
+
+	MappedFile m_file;
+	BackoffModelHeader m_header;
+	shared_ptr<Vocabulary> m_vocabulary;
+	const WordId* m_labels;
+	const uint64_t* m_children;
+	const uint64_t* m_ranges;
+	const Transition* m_transitions;
+	const uint64_t* m_wordOffsets;
+	const char* m_words;
+
+	State m_state;
+};
 
 #endif // MODEL_H
\ No newline at end of file
@@ -1,56 +1,14 @@
 
-#include <cwctype>
 #include <list>
-#include <boost\format.hpp>
-#include <boost\program_options.hpp>
+#include <boost/format.hpp>
+#include <boost/program_options.hpp>
 #include <unordered_map>
+#include <thread>
+#include <mutex>
 #include "model.h"
+#include "downloader.h"
 #include "common.h"
 
-template<class T, class T2>
-void PreprocessString(vector<T>& buffer, vector<T2>& result)
-{
-	for (size_t i = 0; i < buffer.size(); ++i)
-	{
-		if (std::iswupper(buffer[i]))
-			result.push_back(towlower(buffer[i]));
-		else if (iswlower(buffer[i]))
-			result.push_back(buffer[i]);
-		else if (buffer[i] == '\'' || iswspace(buffer[i]))
-			result.push_back(buffer[i]);
-	}
-}
-
-template<typename T>
-using deleted_unique_ptr = std::unique_ptr<T, std::function<void(T*)>>;
-
-vector<wchar_t> DownloadUrl(const wstring& url)
-{
-	deleted_unique_ptr<FILE> file(_wpopen((boost::wformat(L"\"%1%\" -s --url %2%") % CurlPath % url).str().c_str(), L"rt"), 
-		[] (FILE* fp) { _pclose(fp); });
-	
-	Check(file.get() == NULL, "Can't download url");
-
-	vector<char> buffer(BufferSize, 0);
-	vector<wchar_t> result;
-	result.reserve(BufferSize);
-	size_t readed = 0;
-
-	while (true)
-	{
-		readed = fread(&buffer[0], sizeof buffer[0], buffer.size(), file.get());
-		if (readed < BufferSize)
-			buffer.resize(readed);
-
-		PreprocessString(buffer, result);
-
-		if (readed != BufferSize)
-			break;
-	}
-	
-	return result;
-}
-
 void ReadLinks(const string& filePath, list<wstring>& links)
 {
 	if (filePath.empty())
@@ -72,7 +30,16 @@ int main(int argc, char** argv)
 		po::options_description description("Allowed options");
 		description.add_options()("order", po::value<uint32_t>(), "order of model")
 								 ("urls", po::value<string>(), "path to txt file with links to download")
-								 ("out", po::value<string>(), "path to file of result model");
+								 ("out", po::value<string>(), "path to file of result model")
+								 ("threads", po::value<uint32_t>(), "number of download and parse workers, by default number of cores")
+								 ("downloads", po::value<uint32_t>(), "number of downloads every worker runs at once, 4 by default")
+								 ("memory", po::value<uint32_t>(), "build model out of memory with the budget in megabytes, texts are parsed on one thread")
+								 ("backoff", "save orders from 1 to order in one backoff model, texts are parsed on one thread")
+								 ("min-count", po::value<uint32_t>(), "drop transitions seen fewer times")
+								 ("min-key-count", po::value<uint32_t>(), "drop keys seen fewer times")
+								 ("top", po::value<uint32_t>(), "keep only this many most frequent next words of every key")
+								 ("weight-bits", po::value<uint32_t>(), "8 or 16 to store quantized probabilities instead of counts in binary model")
+								 ("elias-fano", "store next word ids of binary model in Elias-Fano code");
 
 		po::variables_map vm;
 		po::store(po::parse_command_line(argc, argv, description), vm);
@@ -85,43 +52,149 @@ int main(int argc, char** argv)
 		}
 
 		uint32_t order = vm["order"].as<uint32_t>();
+
+		PruneOptions pruneOptions;
+		if (!vm["min-count"].empty())
+			pruneOptions.minCount = vm["min-count"].as<uint32_t>();
+		if (!vm["min-key-count"].empty())
+			pruneOptions.minKeyCount = vm["min-key-count"].as<uint32_t>();
+		if (!vm["top"].empty())
+			pruneOptions.maxTransitions = vm["top"].as<uint32_t>();
+
+		BinaryModelLayout layout;
+		if (!vm["weight-bits"].empty())
+			layout.weightBits = vm["weight-bits"].as<uint32_t>();
+		layout.eliasFano = vm.count("elias-fano") != 0;
+		Check(layout.weightBits != 8 && layout.weightBits != 16 && layout.weightBits != 32, "Weight bits can be 8, 16 or 32");
 		string pathToResultModel(vm["out"].as<string>());
 
 		list<wstring> links;
 		ReadLinks(vm["urls"].as<string>(), links);
 
 		Check(links.empty(), "No links to download");
+#ifdef _WIN32
 		Check(!IsFileExists(CurlPath), "curl.exe not exists, place it near bin file");
+#endif
+
+		// External build spills sorted parts of model to files near the result and merges them at the end
+		unique_ptr<ExternalModelBuilder> externalBuilder;
+		if (!vm["memory"].empty())
+		{
+			externalBuilder.reset(new ExternalModelBuilder(order, pathToResultModel, size_t(vm["memory"].as<uint32_t>()) << 20));
+		}
+
+		unique_ptr<BackoffModelBuilder> backoffBuilder;
+		if (vm.count("backoff"))
+		{
+			Check(externalBuilder || layout.IsCompact(), "Backoff model can be saved only with default layout in memory");
+			backoffBuilder.reset(new BackoffModelBuilder(order));
+		}
+
+		uint32_t threadsCount = externalBuilder || backoffBuilder ? 1 : vm["threads"].empty() ? thread::hardware_concurrency() : vm["threads"].as<uint32_t>();
+		threadsCount = max<uint32_t>(1, min<uint32_t>(threadsCount, links.size()));
+		uint32_t downloadsCount = vm["downloads"].empty() ? 4 : vm["downloads"].as<uint32_t>();
 
 		MarkovChainModel completeModel(order);
-		
-		while (!links.empty())
+		ParallelModelBuilder builder(order, completeModel.GetVocabulary(), threadsCount);
+
+		// Links are dealt to workers, every worker downloads several of its links at once
+		// and parses their chunks as they arrive into its own tables
+		vector<list<wstring>> workerLinks(threadsCount);
+		size_t linkIndex = 0;
+		for (const wstring& link : links)
+			workerLinks[linkIndex++ % threadsCount].push_back(link);
+
+		mutex outputMutex;
+		auto worker = [&](size_t workerIndex)
 		{
-			auto link = links.front();
-			links.pop_front();
+			const vector<wstring> names(workerLinks[workerIndex].begin(), workerLinks[workerIndex].end());
+			vector<TextStream> streams(names.size(), TextStream(order));
+			vector<bool> failed(names.size(), false);
 
-			try
+			auto reportError = [&](size_t link, const string& error)
 			{
-				MarkovChainModel tempModel(order);
-				if (tempModel.CreateModel(DownloadUrl(link)))
+				failed[link] = true;
+				lock_guard<mutex> lock(outputMutex);
+				wcout << "Download error: " << names[link] << ", error: " << error.c_str() << endl;
+			};
+
+			Downloader downloader(downloadsCount);
+			downloader.Download(workerLinks[workerIndex],
+				[&](size_t link, const char* data, size_t size)
 				{
-					wcout << "Model for: " << link << " created, size: " << tempModel.GetSize() << endl;
-					completeModel.Merge(tempModel);
-					wcout << "After merge: " << completeModel.GetSize() << endl;
-				}
-			}
-			catch (exception& e)
-			{
-				wcout << "Download error: " << link <<", error: " << e.what() << endl;
-			}
+					if (failed[link])
+						return;
+					try
+					{
+						if (externalBuilder)
+							externalBuilder->AddText(streams[link], data, size);
+						else if (backoffBuilder)
+							backoffBuilder->AddText(streams[link], data, size);
+						else
+							builder.AddText(workerIndex, streams[link], data, size);
+					}
+					catch (exception& e)
+					{
+						reportError(link, e.what());
+					}
+				},
+				[&](size_t link, bool succeeded)
+				{
+					if (failed[link])
+						return;
+					try
+					{
+						Check(!succeeded, "Can't download url");
+						if (externalBuilder)
+							externalBuilder->EndText(streams[link]);
+						else if (backoffBuilder)
+							backoffBuilder->EndText(streams[link]);
+						else
+							builder.EndText(workerIndex, streams[link]);
+						lock_guard<mutex> lock(outputMutex);
+						wcout << "Model for: " << names[link] << " created" << endl;
+					}
+					catch (exception& e)
+					{
+						reportError(link, e.what());
+					}
+					streams[link] = TextStream(order);
+				});
+		};
+
+		vector<thread> threads;
+		for (uint32_t i = 1; i < threadsCount; ++i)
+			threads.emplace_back(worker, i);
+		worker(0);
+		for (auto& thread : threads)
+			thread.join();
+
+		if (externalBuilder)
+		{
+			wcout << "All urls downloaded, merging " << externalBuilder->GetRunsCount() << " parts of model" << endl;
+			externalBuilder->SaveBinary(pathToResultModel, layout, pruneOptions);
+			wcout << "Model was saved to: " << pathToResultModel.c_str();
+			return 0;
 		}
-		cout << "All urls downloaded, saving model to file" << endl;
-		completeModel.Save(pathToResultModel);
-		cout << "Model was saved to: " << pathToResultModel;
+
+		if (backoffBuilder)
+		{
+			wcout << "Model size: " << backoffBuilder->GetSize() << endl;
+			backoffBuilder->SaveBinary(pathToResultModel, pruneOptions);
+			wcout << "Model was saved to: " << pathToResultModel.c_str();
+			return 0;
+		}
+
+		builder.Build(completeModel);
+		completeModel.Prune(pruneOptions);
+		wcout << "Model size: " << completeModel.GetSize() << endl;
+		wcout << "All urls downloaded, saving model to file" << endl;
+		completeModel.SaveBinary(pathToResultModel, layout);
+		wcout << "Model was saved to: " << pathToResultModel.c_str();
 	}
 	catch (std::exception& e)
 	{
-		cout << "Error: " << e.what();
+		wcout << "Error: " << e.what();
 		return 1;
 	}
 
@@ -0,0 +1,277 @@
+#ifndef NGRAM_TABLE_H
+#define NGRAM_TABLE_H
+
+#include "common.h"
+#include <cstdint>
+
+// Hash of n-gram, it is stored in binary model files, so it doesn't depend on platform
+inline uint64_t HashKey(const WordId* key, uint32_t order)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	for (uint32_t i = 0; i < order; ++i)
+		hash = (hash ^ key[i]) * 1099511628211ULL;
+	return hash ^ (hash >> 29);
+}
+
+// Hash table with open addressing (linear probing): n-gram of word ids -> value.
+// All keys are of the same length (order of model), they are stored in one flat array slot by slot,
+// so lookup touches no heap memory except the table itself.
+// Home slot of a key is given by the high bits of its hash, so keys with the same top bits of hash
+// (one part, see GetPart) have home slots in one range of slots for any capacity.
+// High bits of HashKey barely depend on the last word, so the hash is mixed by Fibonacci hashing first.
+template <typename Value>
+class NGramTable
+{
+public:
+	// Slots of one part are never less than this, so few keys of a small table overflow their part
+	static const size_t MinPartCapacity = 64;
+
+	// Table of keys of one part among 2^partBits parts skips the top bits of hash they share
+	explicit NGramTable(uint32_t order, uint32_t partBits = 0) : m_order(order), m_size(0), m_partBits(partBits), m_shift(64)
+	{
+	}
+
+	// Part of the key among partsCount (power of two) parts
+	static size_t GetPart(const WordId* key, uint32_t order, size_t partsCount)
+	{
+		return partsCount > 1 ? static_cast<size_t>(MixHash(key, order) >> (64 - Log2(partsCount))) : 0;
+	}
+
+	uint32_t GetOrder() const
+	{
+		return m_order;
+	}
+
+	size_t GetSize() const
+	{
+		return m_size;
+	}
+
+	// Number of slots, table holds at most 3/4 of it
+	size_t GetCapacity() const
+	{
+		return m_used.size();
+	}
+
+	void Clear()
+	{
+		m_keys.clear();
+		m_values.clear();
+		m_used.clear();
+		m_size = 0;
+		m_shift = 64;
+	}
+
+	// Allocates table for count keys at once
+	void Reserve(size_t count)
+	{
+		Reserve(count, 1);
+	}
+
+	// Same, but table can be filled by partsCount (power of two) threads with InsertInPart
+	void Reserve(size_t count, size_t partsCount)
+	{
+		size_t capacity = max<size_t>(16, m_used.size());
+		if (partsCount > 1)
+			capacity = max(capacity, MinPartCapacity * partsCount);
+		while (count * 4 > capacity * 3)
+			capacity *= 2;
+		if (capacity != m_used.size())
+			Rehash(capacity);
+	}
+
+	Value* Find(const WordId* key)
+	{
+		if (m_size == 0)
+			return nullptr;
+
+		size_t slot = FindSlot(key);
+		return m_used[slot] ? &m_values[slot] : nullptr;
+	}
+
+	const Value* Find(const WordId* key) const
+	{
+		return const_cast<NGramTable*>(this)->Find(key);
+	}
+
+	// Value of the key, default value is inserted if key is absent
+	Value& operator[](const WordId* key)
+	{
+		if ((m_size + 1) * 4 > m_used.size() * 3)
+			Rehash(max<size_t>(16, m_used.size() * 2));
+
+		size_t slot = FindSlot(key);
+		if (!m_used[slot])
+		{
+			copy_n(key, m_order, &m_keys[slot * m_order]);
+			m_used[slot] = 1;
+			m_size++;
+		}
+		return m_values[slot];
+	}
+
+	// Inserts key of the part (see GetPart) only into slots of the part, for a table reserved by
+	// Reserve(count, partsCount) with enough room. Different parts can be filled concurrently, table is not grown.
+	// Returns nullptr if the probe reaches the end of the part, such keys should be added by operator[]
+	// after all parts are filled. 'added' is increased for new keys, it is added to size by AddSize.
+	Value* InsertInPart(const WordId* key, size_t part, size_t partsCount, size_t& added)
+	{
+		const size_t end = (part + 1) * (m_used.size() / partsCount);
+		for (size_t slot = GetHomeSlot(key); slot < end; ++slot)
+		{
+			if (!m_used[slot])
+			{
+				copy_n(key, m_order, &m_keys[slot * m_order]);
+				m_used[slot] = 1;
+				added++;
+				return &m_values[slot];
+			}
+			if (equal(key, key + m_order, &m_keys[slot * m_order]))
+				return &m_values[slot];
+		}
+		return nullptr;
+	}
+
+	void AddSize(size_t added)
+	{
+		m_size += added;
+	}
+
+	// Calls func(key, value) for every element in unspecified order
+	template <typename Func>
+	void ForEach(Func func)
+	{
+		for (size_t slot = 0; slot < m_used.size(); ++slot)
+		{
+			if (m_used[slot])
+				func(&m_keys[slot * m_order], m_values[slot]);
+		}
+	}
+
+	template <typename Func>
+	void ForEach(Func func) const
+	{
+		for (size_t slot = 0; slot < m_used.size(); ++slot)
+		{
+			if (m_used[slot])
+				func(&m_keys[slot * m_order], m_values[slot]);
+		}
+	}
+
+private:
+	// Slot of the key or empty slot where it should be inserted
+	size_t FindSlot(const WordId* key) const
+	{
+		const size_t mask = m_used.size() - 1;
+		for (size_t slot = GetHomeSlot(key); ; slot = (slot + 1) & mask)
+		{
+			if (!m_used[slot] || equal(key, key + m_order, &m_keys[slot * m_order]))
+				return slot;
+		}
+	}
+
+	// Capacity is always a power of two, table is at most 3/4 full
+	void Rehash(size_t capacity)
+	{
+		vector<WordId> keys(capacity * m_order);
+		vector<Value> values(capacity);
+		vector<uint8_t> used(capacity, 0);
+
+		m_keys.swap(keys);
+		m_values.swap(values);
+		m_used.swap(used);
+		m_shift = 64 - Log2(capacity);
+
+		for (size_t slot = 0; slot < used.size(); ++slot)
+		{
+			if (!used[slot])
+				continue;
+
+			const WordId* key = &keys[slot * m_order];
+			size_t newSlot = FindSlot(key);
+			copy_n(key, m_order, &m_keys[newSlot * m_order]);
+			m_values[newSlot] = move(values[slot]);
+			m_used[newSlot] = 1;
+		}
+	}
+
+	static uint64_t MixHash(const WordId* key, uint32_t order)
+	{
+		return HashKey(key, order) * 0x9E3779B97F4A7C15ULL;
+	}
+
+	size_t GetHomeSlot(const WordId* key) const
+	{
+		return static_cast<size_t>((MixHash(key, m_order) << m_partBits) >> m_shift);
+	}
+
+	static uint32_t Log2(size_t value)
+	{
+		uint32_t bits = 0;
+		while ((size_t(1) << bits) < value)
+			bits++;
+		return bits;
+	}
+
+	vector<WordId> m_keys;
+	vector<Value>  m_values;
+	// Byte per slot, not vector<bool>: threads filling neighbouring parts write neighbouring flags
+	vector<uint8_t> m_used;
+	uint32_t	   m_order;
+	size_t		   m_size;
+
+	// Home slot is (hash << m_partBits) >> m_shift
+	uint32_t	   m_partBits;
+	uint32_t	   m_shift;
+};
+
+template <typename Value>
+const size_t NGramTable<Value>::MinPartCapacity;
+
+// Last 'order' words of a text. Every id is written twice, at position and position + order,
+// so the key is always contiguous and nothing is shifted when a word is added.
+class NGramWindow
+{
+public:
+	explicit NGramWindow(uint32_t order) : m_ids(2 * order), m_order(order), m_position(0), m_count(0)
+	{
+	}
+
+	void Clear()
+	{
+		m_position = 0;
+		m_count = 0;
+	}
+
+	void Push(WordId id)
+	{
+		m_ids[m_position] = m_ids[m_position + m_order] = id;
+		m_position = m_position + 1 != m_order ? m_position + 1 : 0;
+		m_count++;
+	}
+
+	// Key is valid only when window is full
+	bool IsFull() const
+	{
+		return m_count >= m_order;
+	}
+
+	const WordId* GetKey() const
+	{
+		return &m_ids[m_position];
+	}
+
+	// Number of words pushed since Clear
+	size_t GetCount() const
+	{
+		return m_count;
+	}
+
+private:
+	vector<WordId> m_ids;
+	uint32_t	   m_order;
+	uint32_t	   m_position;
+	size_t		   m_count;
+};
+
+#endif // NGRAM_TABLE_H
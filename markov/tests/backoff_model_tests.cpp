@@ -0,0 +1,130 @@
+#include <gtest/gtest.h>
+#include <map>
+#include <set>
+#include <cstring>
+#include "../model.h"
+#include "../binary_model.h"
+
+using namespace std;
+
+// Contexts of "p q r s p q r s x q t" and their next words:
+//   order 0: p 2, q 3, r 2, s 2, x 1, t 1
+//   order 1: p -> q 2; q -> r 2, t 1; r -> s 2; s -> p 1, x 1; x -> q 1
+//   order 2: p q -> r 2; q r -> s 2; r s -> p 1, x 1; s p -> q 1; s x -> q 1; x q -> t 1
+static const wstring Text = L"p q r s p q r s x q t";
+static const string ModelPath = "backoff_model_tests.bin";
+
+static void SaveModel(const PruneOptions& pruneOptions = PruneOptions())
+{
+	BackoffModelBuilder builder(2);
+	TextStream stream(2);
+	builder.AddText(stream, Text.data(), Text.size());
+	builder.EndText(stream);
+	builder.SaveBinary(ModelPath, pruneOptions);
+}
+
+static BackoffModelHeader ReadHeader()
+{
+	BackoffModelHeader header = {};
+	ifstream stream(ModelPath, ios::binary);
+	stream.read(reinterpret_cast<char*>(&header), sizeof(header));
+	return header;
+}
+
+// Next words of the key sampled many times with their counts, words absent in the model are unknown
+static map<wstring, size_t> Sample(BackoffModelView& view, const vector<wstring>& words, size_t count = 3000)
+{
+	const Vocabulary& vocabulary = *view.GetVocabulary();
+	vector<WordId> key;
+	for (const auto& word : words)
+		key.push_back(vocabulary.Find(word));
+
+	map<wstring, size_t> result;
+	for (size_t i = 0; i < count; ++i)
+	{
+		WordId word;
+		EXPECT_TRUE(view.GetNextWord(key.data(), word));
+		result[vocabulary.GetWord(word)]++;
+	}
+	return result;
+}
+
+static set<wstring> GetWords(const map<wstring, size_t>& samples)
+{
+	set<wstring> words;
+	for (const auto& sample : samples)
+		words.insert(sample.first);
+	return words;
+}
+
+static const set<wstring> AllWords = { L"p", L"q", L"r", L"s", L"x", L"t" };
+
+TEST(BackoffModelTest, LongestKnownContextIsUsed)
+{
+	SaveModel();
+	{
+		BackoffModelView view(ModelPath, 1);
+		ASSERT_EQ(view.GetOrder(), 2u);
+		EXPECT_EQ(ReadHeader().nodesCount, 1u + 5 + 6);
+
+		// Context of order 2 is known
+		EXPECT_EQ(GetWords(Sample(view, { L"p", L"q" })), set<wstring>({ L"r" }));
+		EXPECT_EQ(GetWords(Sample(view, { L"x", L"q" })), set<wstring>({ L"t" }));
+		EXPECT_EQ(GetWords(Sample(view, { L"r", L"s" })), set<wstring>({ L"p", L"x" }));
+
+		// "s q" is missing, "q" is known: r 2 and t 1
+		const map<wstring, size_t> samples = Sample(view, { L"s", L"q" });
+		EXPECT_EQ(GetWords(samples), set<wstring>({ L"r", L"t" }));
+		EXPECT_NEAR(samples.at(L"t") / 3000.0, 1.0 / 3, 0.04);
+
+		// Unknown older word ends the context at "q"
+		EXPECT_EQ(GetWords(Sample(view, { L"unknown", L"q" })), set<wstring>({ L"r", L"t" }));
+
+		// "t" has no next words, the last word is unknown or the whole key is: all words of the text
+		EXPECT_EQ(GetWords(Sample(view, { L"p", L"t" })), AllWords);
+		EXPECT_EQ(GetWords(Sample(view, { L"q", L"unknown" })), AllWords);
+		EXPECT_EQ(GetWords(Sample(view, { L"unknown", L"unknown" })), AllWords);
+	}
+	remove(ModelPath.c_str());
+}
+
+TEST(BackoffModelTest, PrunedContextsAreRemoved)
+{
+	// --min-key-count 2 drops contexts with less than 2 next words in total: "x", "s p", "s x" and "x q".
+	// "s x" continues "x", so it would go with "x" anyway.
+	PruneOptions pruneOptions;
+	pruneOptions.minKeyCount = 2;
+	SaveModel(pruneOptions);
+	{
+		BackoffModelView view(ModelPath, 1);
+		EXPECT_EQ(ReadHeader().nodesCount, 1u + 4 + 3);
+
+		// Kept contexts are as before
+		EXPECT_EQ(GetWords(Sample(view, { L"p", L"q" })), set<wstring>({ L"r" }));
+		EXPECT_EQ(GetWords(Sample(view, { L"r", L"s" })), set<wstring>({ L"p", L"x" }));
+
+		// "x q" backs off to "q", "s x" and "x" back off to the root
+		EXPECT_EQ(GetWords(Sample(view, { L"x", L"q" })), set<wstring>({ L"r", L"t" }));
+		EXPECT_EQ(GetWords(Sample(view, { L"s", L"x" })), AllWords);
+		EXPECT_EQ(GetWords(Sample(view, { L"s", L"p" })), set<wstring>({ L"q" }));
+	}
+	remove(ModelPath.c_str());
+}
+
+TEST(BackoffModelTest, RareWordsArePrunedEverywhere)
+{
+	// Next words seen once are dropped, keys left without next words go with them
+	PruneOptions pruneOptions;
+	pruneOptions.minCount = 2;
+	SaveModel(pruneOptions);
+	{
+		BackoffModelView view(ModelPath, 1);
+
+		// Root keeps p, q, r, s; contexts are p, q, r and p q, q r
+		EXPECT_EQ(ReadHeader().nodesCount, 1u + 3 + 2);
+		EXPECT_EQ(GetWords(Sample(view, { L"unknown", L"unknown" })), set<wstring>({ L"p", L"q", L"r", L"s" }));
+		EXPECT_EQ(GetWords(Sample(view, { L"s", L"q" })), set<wstring>({ L"r" }));
+		EXPECT_EQ(GetWords(Sample(view, { L"r", L"s" })), set<wstring>({ L"p", L"q", L"r", L"s" }));
+	}
+	remove(ModelPath.c_str());
+}
@@ -0,0 +1,300 @@
+#include <gtest/gtest.h>
+#include <sstream>
+#include <cstring>
+#include "../model.h"
+#include "../elias_fano.h"
+#include "../binary_model.h"
+
+using namespace std;
+
+// Code of the ids as uint64 words and its size in bits
+static vector<uint64_t> Encode(const vector<WordId>& ids, uint64_t universe, uint64_t& size)
+{
+	ostringstream stream;
+	BitWriter writer(stream);
+	EncodeEliasFano(ids.data(), ids.size(), universe, writer);
+	size = writer.GetSize();
+	writer.Close();
+
+	const string bytes = stream.str();
+	vector<uint64_t> words(bytes.size() / sizeof(uint64_t));
+	memcpy(words.data(), bytes.data(), bytes.size());
+	return words;
+}
+
+static void ExpectRoundTrip(const vector<WordId>& ids, uint64_t universe)
+{
+	uint64_t size = 0;
+	const vector<uint64_t> words = Encode(ids, universe, size);
+	EXPECT_EQ(size, GetEliasFanoSize(ids.size(), universe));
+
+	vector<WordId> decoded(ids.size());
+	ASSERT_TRUE(DecodeEliasFano(words.data(), 0, ids.size(), universe, decoded.data()));
+	EXPECT_EQ(decoded, ids);
+}
+
+TEST(EliasFanoTest, RoundTripOfEdgeUniverses)
+{
+	// Every id of the universe
+	for (uint64_t universe : { 1, 2, 3, 64, 65, 1000 })
+	{
+		vector<WordId> ids(universe);
+		for (WordId id = 0; id < universe; ++id)
+			ids[id] = id;
+		ExpectRoundTrip(ids, universe);
+	}
+
+	// Single id at both ends of the universe
+	for (uint64_t universe : { 1, 2, 100, 1 << 20 })
+	{
+		ExpectRoundTrip({ 0 }, universe);
+		ExpectRoundTrip({ static_cast<WordId>(universe - 1) }, universe);
+	}
+
+	// Ids near the end of the universe, low bits of the last ones are all set
+	ExpectRoundTrip({ 5, 1022, 1023 }, 1024);
+	ExpectRoundTrip({ 0, 1, 4294967294u }, 4294967295u);
+	ExpectRoundTrip({ 1, 7, 8, 100, 4095 }, 4096);
+}
+
+TEST(EliasFanoTest, CodesFollowEachOther)
+{
+	// Codes of several lists in one bit stream, as in transitions section
+	const vector<vector<WordId>> lists = { { 3 }, { 0, 1, 2, 3, 4 }, { 9 }, { 2, 5, 8 } };
+	const uint64_t universe = 10;
+
+	ostringstream stream;
+	BitWriter writer(stream);
+	vector<uint64_t> offsets;
+	for (const auto& ids : lists)
+	{
+		offsets.push_back(writer.GetSize());
+		EncodeEliasFano(ids.data(), ids.size(), universe, writer);
+	}
+	writer.Close();
+	const string bytes = stream.str();
+	vector<uint64_t> words(bytes.size() / sizeof(uint64_t));
+	memcpy(words.data(), bytes.data(), bytes.size());
+
+	for (size_t i = 0; i < lists.size(); ++i)
+	{
+		vector<WordId> decoded(lists[i].size());
+		ASSERT_TRUE(DecodeEliasFano(words.data(), offsets[i], decoded.size(), universe, decoded.data()));
+		EXPECT_EQ(decoded, lists[i]);
+	}
+}
+
+TEST(EliasFanoTest, CorruptedCodesAreRejected)
+{
+	uint64_t size = 0;
+	vector<WordId> decoded(2);
+
+	// Ids 4 and 5 of 8 have 2 low bits: lows 0 and 1 in bits 0..3, then high parts 1 and 1 as "01" "1"
+	vector<uint64_t> words = Encode({ 4, 5 }, 8, size);
+	ASSERT_EQ(GetEliasFanoLowBits(2, 8), 2u);
+	ASSERT_TRUE(DecodeEliasFano(words.data(), 0, 2, 8, decoded.data()));
+
+	// Low bits of the first id are made 3: ids go down
+	vector<uint64_t> broken = words;
+	broken[0] |= 3;
+	EXPECT_FALSE(DecodeEliasFano(broken.data(), 0, 2, 8, decoded.data()));
+
+	// Same ids: low bits of the second id are made 0
+	broken = words;
+	broken[0] &= ~uint64_t(0xC);
+	EXPECT_FALSE(DecodeEliasFano(broken.data(), 0, 2, 8, decoded.data()));
+
+	// No ones in high parts: the code ends before all ids are found
+	broken = words;
+	broken[0] &= 0xF;
+	EXPECT_FALSE(DecodeEliasFano(broken.data(), 0, 2, 8, decoded.data()));
+
+	// Id over the universe: 5 of 6 has low bits 1 and high part 1, low bits 3 give 7
+	words = Encode({ 5 }, 6, size);
+	ASSERT_TRUE(DecodeEliasFano(words.data(), 0, 1, 6, decoded.data()));
+	words[0] |= 3;
+	EXPECT_FALSE(DecodeEliasFano(words.data(), 0, 1, 6, decoded.data()));
+
+	// Ones of the next code are not taken for ones of this one: code of 0, 1, 2 is "101010",
+	// its last one is moved right after its end
+	words = Encode({ 0, 1, 2 }, 3, size);
+	ASSERT_EQ(size, 6u);
+	words[0] &= ~(uint64_t(1) << (size - 2));
+	words[0] |= uint64_t(1) << size;
+	EXPECT_FALSE(DecodeEliasFano(words.data(), 0, 3, 3, decoded.data()));
+}
+
+// Order 1 text: after "a" goes "b" 300000 times and "c" once, after "x" goes "y" 3 times and "z" once
+class CompactModelTest : public testing::Test
+{
+protected:
+	static void SetUpTestCase()
+	{
+		wstring text;
+		for (size_t i = 0; i < 300000; ++i)
+			text += L"a b ";
+		text += L"a c x y x y x y x z";
+
+		MarkovChainModel model(1);
+		model.BeginText();
+		model.AddText(text.data(), text.size());
+		model.EndText();
+
+		for (uint32_t weightBits : { 8, 16, 32 })
+		{
+			for (bool eliasFano : { false, true })
+			{
+				BinaryModelLayout layout;
+				layout.weightBits = weightBits;
+				layout.eliasFano = eliasFano;
+				model.SaveBinary(GetPath(layout), layout);
+			}
+		}
+	}
+
+	static void TearDownTestCase()
+	{
+		for (uint32_t weightBits : { 8, 16, 32 })
+		{
+			for (bool eliasFano : { false, true })
+			{
+				BinaryModelLayout layout;
+				layout.weightBits = weightBits;
+				layout.eliasFano = eliasFano;
+				remove(GetPath(layout).c_str());
+			}
+		}
+	}
+
+	static string GetPath(const BinaryModelLayout& layout)
+	{
+		return "compact_model_tests_" + to_string(layout.weightBits) + (layout.eliasFano ? "_ef" : "") + ".bin";
+	}
+
+	static string ReadFile(const string& filePath)
+	{
+		ifstream stream(filePath, ios::binary);
+		return string(istreambuf_iterator<char>(stream), istreambuf_iterator<char>());
+	}
+
+	// Weights of the file by key, next words of a key are sorted by id
+	static vector<vector<uint32_t>> ReadWeights(const string& filePath)
+	{
+		const string file = ReadFile(filePath);
+		BinaryModelHeader header;
+		memcpy(&header, file.data(), sizeof(header));
+		const uint64_t* ranges = reinterpret_cast<const uint64_t*>(file.data() + header.rangesOffset);
+
+		vector<vector<uint32_t>> weights(header.keysCount);
+		for (uint64_t key = 0; key < header.keysCount; ++key)
+		{
+			for (uint64_t i = ranges[key]; i < ranges[key + 1]; ++i)
+			{
+				const char* weight = file.data() + header.weightsOffset + i * header.weightBits / 8;
+				weights[key].push_back(header.weightBits == 8 ? *reinterpret_cast<const uint8_t*>(weight) : *reinterpret_cast<const uint16_t*>(weight));
+			}
+		}
+		return weights;
+	}
+
+	// Share of the next word among samples of the key
+	static double GetShare(MarkovChainView& view, const wstring& key, const wstring& next, size_t samplesCount)
+	{
+		const Vocabulary& vocabulary = *view.GetVocabulary();
+		const WordId keyId = vocabulary.Find(key), nextId = vocabulary.Find(next);
+		size_t count = 0;
+		for (size_t i = 0; i < samplesCount; ++i)
+		{
+			WordId word;
+			EXPECT_TRUE(view.GetNextWord(&keyId, word));
+			count += word == nextId;
+		}
+		return static_cast<double>(count) / samplesCount;
+	}
+};
+
+TEST_F(CompactModelTest, QuantizedWeightsKeepRareWords)
+{
+	for (uint32_t weightBits : { 8, 16 })
+	{
+		BinaryModelLayout layout;
+		layout.weightBits = weightBits;
+		const uint32_t maxWeight = (1u << weightBits) - 1;
+
+		// The most frequent next word has the largest weight, "c" after "a" would be rounded to 0
+		for (const auto& keyWeights : ReadWeights(GetPath(layout)))
+		{
+			ASSERT_FALSE(keyWeights.empty());
+			EXPECT_EQ(*max_element(keyWeights.begin(), keyWeights.end()), maxWeight);
+			EXPECT_GE(*min_element(keyWeights.begin(), keyWeights.end()), 1u);
+		}
+
+		MarkovChainView view(GetPath(layout), 1, 1);
+		const WordId a = view.GetVocabulary()->Find(L"a"), c = view.GetVocabulary()->Find(L"c");
+		bool sampled = false;
+		for (size_t i = 0; i < 100 * maxWeight && !sampled; ++i)
+		{
+			WordId word;
+			ASSERT_TRUE(view.GetNextWord(&a, word));
+			sampled = word == c;
+		}
+		EXPECT_TRUE(sampled) << weightBits;
+	}
+}
+
+TEST_F(CompactModelTest, SamplingFollowsWeights)
+{
+	// Weights of "y" and "z" after "x" are 3:1 in every layout
+	for (uint32_t weightBits : { 8, 16, 32 })
+	{
+		for (bool eliasFano : { false, true })
+		{
+			BinaryModelLayout layout;
+			layout.weightBits = weightBits;
+			layout.eliasFano = eliasFano;
+			MarkovChainView view(GetPath(layout), 1, 2);
+
+			EXPECT_NEAR(GetShare(view, L"x", L"z", 40000), 0.25, 0.015) << GetPath(layout);
+			EXPECT_EQ(GetShare(view, L"y", L"x", 100), 1.0);
+			EXPECT_GT(GetShare(view, L"a", L"b", 1000), 0.9);
+
+			// Same seed gives the same words
+			MarkovChainView first(GetPath(layout), 1, 3), second(GetPath(layout), 1, 3);
+			const WordId x = first.GetVocabulary()->Find(L"x");
+			for (size_t i = 0; i < 100; ++i)
+			{
+				WordId firstWord, secondWord;
+				ASSERT_TRUE(first.GetNextWord(&x, firstWord));
+				ASSERT_TRUE(second.GetNextWord(&x, secondWord));
+				EXPECT_EQ(firstWord, secondWord);
+			}
+		}
+	}
+}
+
+TEST_F(CompactModelTest, CorruptedCodesFailGeneration)
+{
+	BinaryModelLayout layout;
+	layout.weightBits = 8;
+	layout.eliasFano = true;
+	string file = ReadFile(GetPath(layout));
+	BinaryModelHeader header;
+	memcpy(&header, file.data(), sizeof(header));
+
+	// Codes follow bit offsets of keys in transitions section, they are cleared
+	const uint64_t codesOffset = header.transitionsOffset + (header.keysCount + 1) * sizeof(uint64_t);
+	fill(file.begin() + codesOffset, file.begin() + header.weightsOffset, '\0');
+	const string path = "compact_model_tests_broken.bin";
+	{
+		ofstream stream(path, ios::binary);
+		stream.write(file.data(), file.size());
+	}
+
+	{
+		MarkovChainView view(path, 1, 1);
+		const WordId x = view.GetVocabulary()->Find(L"x");
+		WordId word;
+		EXPECT_THROW(view.GetNextWord(&x, word), runtime_error);
+	}
+	remove(path.c_str());
+}
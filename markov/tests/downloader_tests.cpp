@@ -0,0 +1,79 @@
+#include <gtest/gtest.h>
+#include <unistd.h>
+#include "../downloader.h"
+
+using namespace std;
+
+// file:// url of a file in the current directory
+static wstring GetFileUrl(const string& fileName)
+{
+	vector<char> directory(4096);
+	EXPECT_NE(getcwd(directory.data(), directory.size()), nullptr);
+	const string path = string(directory.data()) + "/" + fileName;
+	return wstring(L"file://") + wstring(path.begin(), path.end());
+}
+
+static void WriteFile(const string& fileName, const string& data)
+{
+	ofstream stream(fileName, ios::binary);
+	stream.write(data.data(), data.size());
+}
+
+TEST(DownloaderTest, FileUrls)
+{
+	// Texts are bigger than one read of a pipe, so they come by several chunks
+	vector<string> texts;
+	list<wstring> links;
+	for (size_t i = 0; i < 5; ++i)
+	{
+		string text;
+		for (size_t word = 0; word < 20000 * (i + 1); ++word)
+			text += "word" + to_string((word * 7 + i) % 1000) + " ";
+		texts.push_back(text);
+
+		const string fileName = "downloader_test_" + to_string(i) + ".txt";
+		WriteFile(fileName, text);
+		links.push_back(GetFileUrl(fileName));
+	}
+	links.push_back(GetFileUrl("downloader_test_missing.txt"));
+
+	vector<string> received(links.size());
+	vector<int> doneCount(links.size(), 0);
+	vector<bool> succeeded(links.size(), false);
+	Downloader downloader(2);
+	downloader.Download(links,
+		[&](size_t link, const char* data, size_t size)
+		{
+			ASSERT_LT(link, links.size());
+			EXPECT_EQ(doneCount[link], 0);
+			received[link].append(data, size);
+		},
+		[&](size_t link, bool result)
+		{
+			ASSERT_LT(link, links.size());
+			doneCount[link]++;
+			succeeded[link] = result;
+		});
+
+	for (size_t i = 0; i < texts.size(); ++i)
+	{
+		EXPECT_EQ(doneCount[i], 1);
+		EXPECT_TRUE(succeeded[i]);
+		EXPECT_EQ(received[i], texts[i]);
+		remove(("downloader_test_" + to_string(i) + ".txt").c_str());
+	}
+	EXPECT_EQ(doneCount.back(), 1);
+	EXPECT_FALSE(succeeded.back());
+}
+
+TEST(DownloaderTest, ThrowingHandlerStopsDownloads)
+{
+	WriteFile("downloader_test_throw.txt", string(1 << 20, 'a'));
+	list<wstring> links(4, GetFileUrl("downloader_test_throw.txt"));
+
+	Downloader downloader(4);
+	EXPECT_THROW(downloader.Download(links,
+		[](size_t, const char*, size_t) { throw runtime_error("stop"); },
+		[](size_t, bool) {}), runtime_error);
+	remove("downloader_test_throw.txt");
+}
@@ -0,0 +1,79 @@
+#include <gtest/gtest.h>
+#include <random>
+#include <cmath>
+#include "../model.h"
+#include "../common.h"
+
+using namespace std;
+
+static string ReadFile(const string& filePath)
+{
+	ifstream stream(filePath, ios::binary);
+	return string(istreambuf_iterator<char>(stream), istreambuf_iterator<char>());
+}
+
+// Words of letters with Zipf-like frequencies, so there are both long and short transition lists
+static wstring MakeText(size_t wordsCount, size_t vocabularySize, uint64_t seed)
+{
+	mt19937_64 random(seed);
+	uniform_real_distribution<double> uniform(0.0, 1.0);
+	wstring text;
+	for (size_t i = 0; i < wordsCount; ++i)
+	{
+		size_t id = static_cast<size_t>(pow(static_cast<double>(vocabularySize), uniform(random))) - 1;
+		for (text += L'a' + id % 26, id /= 26; id != 0; id /= 26)
+			text += L'a' + id % 26;
+		text += L' ';
+	}
+	return text;
+}
+
+// Key count of the text is far over the budget: tables, runs and index are bounded by it,
+// and the file is the same as the one of the model built in memory
+static void ExpectExternalBuildWithinBudget(const BinaryModelLayout& layout)
+{
+	const uint32_t order = 2;
+	const size_t memoryBudget = size_t(2) << 20;
+	const wstring text = MakeText(1000000, 5000, 1);
+
+	MarkovChainModel model(order);
+	model.BeginText();
+	model.AddText(text.data(), text.size());
+	model.EndText();
+	model.SaveBinary("model_tests_memory.bin", layout);
+	EXPECT_GT(model.GetSize() * order * sizeof(WordId), memoryBudget);
+
+	ExternalModelBuilder builder(order, "model_tests_external.bin", memoryBudget);
+	TextStream stream(order);
+	builder.AddText(stream, text.data(), text.size());
+	builder.EndText(stream);
+	EXPECT_GT(builder.GetRunsCount(), 1u);
+
+	builder.SaveBinary("model_tests_external.bin", layout);
+	EXPECT_LE(builder.GetPeakMemory(), memoryBudget);
+	EXPECT_TRUE(ReadFile("model_tests_external.bin") == ReadFile("model_tests_memory.bin"));
+
+	remove("model_tests_memory.bin");
+	remove("model_tests_external.bin");
+}
+
+TEST(ExternalModelBuilderTest, BuildWithinBudget)
+{
+	ExpectExternalBuildWithinBudget(BinaryModelLayout());
+}
+
+TEST(ExternalModelBuilderTest, CompactBuildWithinBudget)
+{
+	BinaryModelLayout compact;
+	compact.weightBits = 8;
+	compact.eliasFano = true;
+	ExpectExternalBuildWithinBudget(compact);
+}
+
+TEST(ExternalModelBuilderTest, BudgetTooSmallForVocabulary)
+{
+	const wstring text = MakeText(100000, 20000, 2);
+	ExternalModelBuilder builder(2, "model_tests_external.bin", 64 * 1024);
+	TextStream stream(2);
+	EXPECT_THROW(builder.AddText(stream, text.data(), text.size()), exception);
+}
@@ -0,0 +1,270 @@
+#include <gtest/gtest.h>
+#include <random>
+#include <sstream>
+#include <poll.h>
+#include "../text_generator/batch_generator.h"
+
+using namespace std;
+
+static const string ChainPath = "text_generator_tests.bin";
+static const string BackoffPath = "text_generator_tests_backoff.bin";
+static const uint32_t ChainOrder = 2;
+static const uint32_t BackoffOrder = 3;
+
+// Words of the text, some of them are not ASCII, so answers are checked to be in UTF-8
+static const vector<wstring> Words = { L"the", L"cat", L"dog", L"sat", L"on", L"a", L"mat", L"and", L"ran", L"away",
+	L"кот", L"пёс", L"сидел", L"на", L"коврике", L"и", L"убежал", L"über", L"straße", L"ночью" };
+
+class TextGeneratorTest : public testing::Test
+{
+protected:
+	static void SetUpTestCase()
+	{
+		mt19937_64 random(1);
+		uniform_int_distribution<size_t> word(0, Words.size() - 1);
+		for (size_t i = 0; i < 20000; ++i)
+			text += Words[word(random)] + L" ";
+
+		MarkovChainModel model(ChainOrder);
+		model.BeginText();
+		model.AddText(text.data(), text.size());
+		model.EndText();
+		model.SaveBinary(ChainPath);
+
+		BackoffModelBuilder builder(BackoffOrder);
+		TextStream stream(BackoffOrder);
+		builder.AddText(stream, text.data(), text.size());
+		builder.EndText(stream);
+		builder.SaveBinary(BackoffPath);
+	}
+
+	static void TearDownTestCase()
+	{
+		remove(ChainPath.c_str());
+		remove(BackoffPath.c_str());
+	}
+
+	// Prompts of several words of the text, one of them is unknown to the models
+	static vector<string> MakeRequests(size_t count, size_t promptLength)
+	{
+		wstring_convert<codecvt_utf8_utf16<wchar_t>> converter;
+		vector<string> requests;
+		for (size_t i = 0; i < count; ++i)
+		{
+			string prompt;
+			for (size_t word = 0; word < promptLength; ++word)
+				prompt += (word != 0 ? " " : "") + converter.to_bytes(i == 7 ? L"unknown" : Words[(i * 3 + word * 5) % Words.size()]);
+			requests.push_back(to_string(i * 1000 + 1) + " " + to_string(i % 40) + " " + prompt);
+		}
+		return requests;
+	}
+
+	static wstring text;
+};
+
+wstring TextGeneratorTest::text;
+
+template <typename Model>
+static void ExpectSameAsSingleRequests(const Model& model, uint32_t order, size_t threadsCount, const vector<string>& requests,
+	const function<wstring(const string&)>& generateSingle)
+{
+	BatchGenerator<Model> generator(model, order, threadsCount);
+	vector<string> answers;
+
+	// Second run reuses states with samplers cached by the first one
+	for (int run = 0; run < 2; ++run)
+	{
+		generator.Run(requests, requests.size(), answers);
+		for (size_t i = 0; i < requests.size(); ++i)
+		{
+			ASSERT_FALSE(answers[i].empty());
+			EXPECT_EQ(answers[i].back(), '\n');
+			EXPECT_EQ(Convert(answers[i].substr(0, answers[i].size() - 1)), generateSingle(requests[i])) << requests[i];
+		}
+	}
+}
+
+TEST_F(TextGeneratorTest, ChainBatchMatchesSingleRequests)
+{
+	auto generateSingle = [](const string& request)
+	{
+		istringstream stream(request);
+		uint64_t seed;
+		uint32_t count;
+		string prompt;
+		stream >> seed >> count >> ws;
+		getline(stream, prompt);
+
+		wstring beginSentence = Convert(prompt), resultText = beginSentence;
+		MarkovChainView model(ChainPath, ChainOrder, seed);
+		Generate(model, beginSentence, ChainOrder, count, resultText);
+		return resultText;
+	};
+
+	MarkovChainView model(ChainPath, ChainOrder);
+	const vector<string> requests = MakeRequests(100, ChainOrder);
+	ExpectSameAsSingleRequests(model, ChainOrder, 1, requests, generateSingle);
+	ExpectSameAsSingleRequests(model, ChainOrder, 4, requests, generateSingle);
+}
+
+TEST_F(TextGeneratorTest, BackoffBatchMatchesSingleRequests)
+{
+	auto generateSingle = [](const string& request)
+	{
+		istringstream stream(request);
+		uint64_t seed;
+		uint32_t count;
+		string prompt;
+		stream >> seed >> count >> ws;
+		getline(stream, prompt);
+
+		wstring beginSentence = Convert(prompt), resultText = beginSentence;
+		BackoffModelView model(BackoffPath, seed);
+		Generate(model, beginSentence, model.GetOrder(), count, resultText);
+		return resultText;
+	};
+
+	BackoffModelView model(BackoffPath);
+	for (size_t promptLength = 1; promptLength <= BackoffOrder + 1; ++promptLength)
+		ExpectSameAsSingleRequests(model, BackoffOrder, 4, MakeRequests(50, promptLength), generateSingle);
+}
+
+TEST_F(TextGeneratorTest, WrongRequestFailsAlone)
+{
+	MarkovChainView model(ChainPath, ChainOrder);
+	BatchGenerator<MarkovChainView> generator(model, ChainOrder, 2);
+	vector<string> requests = { "1 5 the cat", "seed 5 the cat", "2 many the cat", "3 0 the cat\r" }, answers;
+	generator.Run(requests, requests.size(), answers);
+
+	EXPECT_EQ(answers[0].compare(0, 7, "the cat"), 0);
+	EXPECT_EQ(answers[1], "Fail: Request should start with seed\n");
+	EXPECT_EQ(answers[2], "Fail: Wrong number of words in request\n");
+	EXPECT_EQ(answers[3], "the cat\n");
+}
+
+TEST_F(TextGeneratorTest, ServeStreamAnswersInOrder)
+{
+	MarkovChainView model(ChainPath, ChainOrder);
+	BatchGenerator<MarkovChainView> generator(model, ChainOrder, 4);
+	const vector<string> requests = MakeRequests(100, ChainOrder);
+
+	string input, expected;
+	vector<string> answers;
+	generator.Run(requests, requests.size(), answers);
+	for (size_t i = 0; i < requests.size(); ++i)
+	{
+		input += requests[i] + "\n";
+		expected += answers[i];
+	}
+
+	istringstream inputStream(input);
+	ostringstream outputStream;
+	ServeStream(generator, inputStream, outputStream);
+	EXPECT_EQ(outputStream.str(), expected);
+}
+
+#ifndef _WIN32
+static int Connect(const string& path)
+{
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	copy(path.begin(), path.end(), address.sun_path);
+
+	// Server may be not listening yet
+	for (int attempt = 0; attempt < 500; ++attempt)
+	{
+		int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0)
+			return fd;
+		close(fd);
+		this_thread::sleep_for(chrono::milliseconds(10));
+	}
+	return -1;
+}
+
+static void Send(int fd, const string& data)
+{
+	for (size_t sent = 0; sent < data.size(); )
+	{
+		ssize_t written = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+		ASSERT_GT(written, 0);
+		sent += written;
+	}
+}
+
+// Reads until linesCount line feeds come, empty string if nothing comes for timeout
+static string ReceiveLines(int fd, size_t linesCount, int timeoutMs)
+{
+	string result;
+	vector<char> buffer(64 * 1024);
+	while (static_cast<size_t>(count(result.begin(), result.end(), '\n')) < linesCount)
+	{
+		pollfd event = { fd, POLLIN, 0 };
+		if (poll(&event, 1, timeoutMs) != 1)
+			return string();
+		ssize_t readed = read(fd, buffer.data(), buffer.size());
+		if (readed <= 0)
+			return string();
+		result.append(buffer.data(), readed);
+	}
+	return result;
+}
+
+// Client which doesn't read its long answers doesn't stop answers to other clients
+TEST_F(TextGeneratorTest, ServeSocketDoesNotWaitForSlowClient)
+{
+	const string path = "text_generator_tests.socket";
+	MarkovChainView model(ChainPath, ChainOrder);
+	BatchGenerator<MarkovChainView> generator(model, ChainOrder, 2);
+
+	// Answers of the slow client are megabytes, far over the buffer of the socket
+	vector<string> slowRequests, fastRequests = MakeRequests(10, ChainOrder), answers;
+	for (size_t i = 0; i < 300; ++i)
+		slowRequests.push_back(to_string(i) + " 1000 the cat");
+	string slowInput, slowExpected, fastExpected;
+	generator.Run(slowRequests, slowRequests.size(), answers);
+	for (size_t i = 0; i < slowRequests.size(); ++i)
+	{
+		slowInput += slowRequests[i] + "\n";
+		slowExpected += answers[i];
+	}
+	generator.Run(fastRequests, fastRequests.size(), answers);
+	for (size_t i = 0; i < fastRequests.size(); ++i)
+		fastExpected += answers[i];
+	ASSERT_GT(slowExpected.size(), size_t(1) << 20);
+
+	int stop[2];
+	ASSERT_EQ(pipe(stop), 0);
+	thread server([&] { ServeSocket(generator, path, stop[0]); });
+
+	int slow = Connect(path);
+	ASSERT_NE(slow, -1);
+	Send(slow, slowInput);
+
+	// Requests of the fast client are sent one by one, every answer comes while the slow client reads nothing
+	int fast = Connect(path);
+	ASSERT_NE(fast, -1);
+	string fastOutput;
+	for (size_t i = 0; i < fastRequests.size(); ++i)
+	{
+		Send(fast, fastRequests[i] + "\n");
+		fastOutput += ReceiveLines(fast, 1, 10000);
+	}
+	EXPECT_EQ(fastOutput, fastExpected);
+
+	EXPECT_EQ(ReceiveLines(slow, slowRequests.size(), 10000), slowExpected);
+
+	// Client can send a request by parts
+	Send(fast, fastRequests[0].substr(0, 5));
+	this_thread::sleep_for(chrono::milliseconds(50));
+	Send(fast, fastRequests[0].substr(5) + "\n");
+	EXPECT_EQ(ReceiveLines(fast, 1, 10000), fastExpected.substr(0, fastExpected.find('\n') + 1));
+
+	close(slow);
+	close(fast);
+	ASSERT_EQ(write(stop[1], "", 1), 1);
+	server.join();
+	close(stop[0]);
+	close(stop[1]);
+}
+#endif
@@ -0,0 +1,143 @@
+#include <gtest/gtest.h>
+#include "../utf8_tokenizer.h"
+
+using namespace std;
+
+// Words of the text written by chunks of the given sizes, the rest goes by the last chunk
+static vector<wstring> Tokenize(const string& text, const vector<size_t>& chunkSizes = vector<size_t>())
+{
+	Utf8Tokenizer tokenizer;
+	vector<wstring> words;
+	auto add = [&](const wchar_t* word, size_t length) { words.emplace_back(word, length); };
+
+	size_t position = 0;
+	for (size_t size : chunkSizes)
+	{
+		size = min(size, text.size() - position);
+		tokenizer.Write(text.data() + position, size, add);
+		position += size;
+	}
+	tokenizer.Write(text.data() + position, text.size() - position, add);
+	tokenizer.Close(add);
+	return words;
+}
+
+static vector<wstring> TokenizeByBytes(const string& text)
+{
+	return Tokenize(text, vector<size_t>(text.size(), 1));
+}
+
+// Code point as wchar_t string, surrogate pair where wchar_t is UTF-16
+static wstring Character(uint32_t codePoint)
+{
+	if (sizeof(wchar_t) == 2 && codePoint > 0xFFFF)
+	{
+		codePoint -= 0x10000;
+		return wstring{ static_cast<wchar_t>(0xD800 + (codePoint >> 10)), static_cast<wchar_t>(0xDC00 + (codePoint & 0x3FF)) };
+	}
+	return wstring(1, static_cast<wchar_t>(codePoint));
+}
+
+TEST(Utf8TokenizerTest, AsciiBlocks)
+{
+	// Blocks of 16 bytes with letters and spaces only are stored at once, words cross blocks
+	const string text = "The quick brown fox jumps over The lazy dog\tand\nRUNS away ";
+	const vector<wstring> expected = { L"the", L"quick", L"brown", L"fox", L"jumps", L"over", L"the", L"lazy", L"dog", L"and", L"runs", L"away" };
+	EXPECT_EQ(Tokenize(text), expected);
+	EXPECT_EQ(TokenizeByBytes(text), expected);
+}
+
+TEST(Utf8TokenizerTest, AsciiBlocksWithPunctuation)
+{
+	// Blocks with characters to drop go character by character
+	const string text = "Hello, world! It's a test-case; OK? 42 apples (and 7 pears) \"quoted\" end.";
+	const vector<wstring> expected = { L"hello", L"world", L"it's", L"a", L"testcase", L"ok", L"apples", L"and", L"pears", L"quoted", L"end" };
+	EXPECT_EQ(Tokenize(text), expected);
+	EXPECT_EQ(TokenizeByBytes(text), expected);
+}
+
+TEST(Utf8TokenizerTest, LettersOfTable)
+{
+	const string text = u8"Привет, МИР! Ёлка Straße ÀÉÎ Ÿ Źdźbło ŽŠ Άλφα ΣΟΦΙΑ ſ ’quoted’ a b";
+	const vector<wstring> expected = { L"привет", L"мир", L"ёлка", L"straße", L"àéî", L"ÿ", L"źdźbło", L"žš", L"άλφα", L"σοφια", L"ſ",
+		L"'quoted'", L"a", L"b" };
+	EXPECT_EQ(Tokenize(text), expected);
+	EXPECT_EQ(TokenizeByBytes(text), expected);
+}
+
+TEST(Utf8TokenizerTest, InvalidSequencesAreDropped)
+{
+	// Overlong forms, surrogates, code points over U+10FFFF, stray continuation bytes,
+	// sequences cut by other characters and by the end of text
+	const string text = "a\xC0\x80" "b \xE0\x80\xAF" "c \xED\xA0\x80" "d \xF4\x90\x80\x80" "e \x80\xBF" "f \xE2\x82" "g \xF0\x9F\x98 h\xE2\x82";
+	const vector<wstring> expected = { L"ab", L"c", L"d", L"e", L"f", L"g", L"h" };
+	EXPECT_EQ(Tokenize(text), expected);
+	EXPECT_EQ(TokenizeByBytes(text), expected);
+}
+
+TEST(Utf8TokenizerTest, CodePointsOutsideOfBasicPlane)
+{
+	// U+20000 is a letter, U+1F600 is an emoji which is dropped
+	const string text = "a\xF0\xA0\x80\x80" "b \xF0\x9F\x98\x80 c";
+	const vector<wstring> expected = { L"a" + Character(0x20000) + L"b", L"c" };
+	EXPECT_EQ(Tokenize(text), expected);
+	EXPECT_EQ(TokenizeByBytes(text), expected);
+	if (sizeof(wchar_t) == 2)
+		EXPECT_EQ(expected[0].size(), 4u);
+}
+
+TEST(Utf8TokenizerTest, SequenceCutByChunks)
+{
+	// Sequence completed by the next chunk and by the one after it
+	EXPECT_EQ(Tokenize(u8"сон кот", { 3 }), vector<wstring>({ L"сон", L"кот" }));
+	EXPECT_EQ(Tokenize("a\xF0\xA0\x80\x80" "b c", { 2, 1 }), vector<wstring>({ L"a" + Character(0x20000) + L"b", L"c" }));
+
+	// Pending byte is followed by a byte that is not a continuation: it is dropped alone,
+	// and the bytes taken to complete it are decoded again
+	EXPECT_EQ(Tokenize("ab\xE2" "cd ef", { 3 }), vector<wstring>({ L"abcd", L"ef" }));
+	EXPECT_EQ(Tokenize("ab\xE2\x82" "cd ef", { 3 }), vector<wstring>({ L"abcd", L"ef" }));
+	EXPECT_EQ(Tokenize("ab\xF0\xA0" "\x80" u8"ж ef", { 3, 1 }), vector<wstring>({ L"abж", L"ef" }));
+
+	// Incomplete sequence at the end of text is dropped
+	EXPECT_EQ(Tokenize(u8"ab\xD0", { 2 }), vector<wstring>({ L"ab" }));
+}
+
+// Text of ASCII blocks with and without punctuation at offsets of 16 bytes and non-ASCII between them.
+// Every split into two and three chunks and writing byte by byte give the same words.
+TEST(Utf8TokenizerTest, SameWordsForAnyChunks)
+{
+	string text;
+	text += "abcdefgh ijklmno";						// 16 letters and spaces
+	text += "Pqrstuv wxyz ABC";						// 16 with upper case
+	text += "it's, a test!...";						// 16 with punctuation
+	text += u8"Съешь же ещё этих мягких";				// Cyrillic
+	text += "  spaces   only  ";
+	text += "\xF0\xA0\x80\x80x\xC0\x80y\xED\xA0\x80z";	// astral letter and invalid sequences
+	text += "longwordlongwordlongwordlongword";			// word over two blocks
+	text += u8" Ÿź’s";
+
+	const vector<wstring> expected = Tokenize(text);
+	ASSERT_EQ(expected.front(), L"abcdefgh");
+	ASSERT_EQ(expected.back(), L"ÿź's");
+	EXPECT_EQ(TokenizeByBytes(text), expected);
+
+	for (size_t first = 0; first <= text.size(); ++first)
+	{
+		EXPECT_EQ(Tokenize(text, { first }), expected) << first;
+		for (size_t second = 0; first + second <= text.size(); ++second)
+			ASSERT_EQ(Tokenize(text, { first, second }), expected) << first << " " << second;
+	}
+}
+
+TEST(Utf8TokenizerTest, ResetDropsPendingState)
+{
+	Utf8Tokenizer tokenizer;
+	vector<wstring> words;
+	auto add = [&](const wchar_t* word, size_t length) { words.emplace_back(word, length); };
+
+	tokenizer.Write("abc\xD0", 4, add);
+	tokenizer.Reset();
+	tokenizer.Write("def", 3, add);
+	tokenizer.Close(add);
+	EXPECT_EQ(words, vector<wstring>({ L"def" }));
+}
@@ -0,0 +1,411 @@
+#ifndef BATCH_GENERATOR_H
+#define BATCH_GENERATOR_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdlib>
+#include <unordered_map>
+#include "../model.h"
+#include "../common.h"
+
+#ifndef _WIN32
+#include <cerrno>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+using namespace std;
+
+inline wstring Convert(const string& str)
+{
+	wstring_convert<std::codecvt_utf8_utf16<wchar_t>> converter;
+	return converter.from_bytes(str);
+}
+
+inline string Convert(const wstring& str)
+{
+	wstring_convert<std::codecvt_utf8_utf16<wchar_t>> converter;
+	return converter.to_bytes(str);
+}
+
+// Appends up to count words to the text, stops when model doesn't know the key
+template <typename Model>
+void Generate(Model& model, const wstring& beginSentence, uint32_t order, uint32_t count, wstring& resultText)
+{
+	const Vocabulary& vocabulary = *model.GetVocabulary();
+	Sentence s(beginSentence, order, vocabulary);
+	for (uint32_t counter = 0; counter < count; ++counter)
+	{
+		WordId nextWord;
+		if (!model.GetNextWord(s.GetKey(), nextWord))
+			break;
+
+		s.InsertWord(nextWord);
+		resultText += L" ";
+		resultText.append(vocabulary.GetData(nextWord), vocabulary.GetLength(nextWord));
+	}
+}
+
+// Answers batches of requests on several threads at once. Model is shared by all threads,
+// every thread has its own state of generation. Request is a line "<seed> <words> <prompt>" in UTF-8,
+// answer is the prompt followed by generated words, the same as for the same options in command line.
+template <typename Model>
+class BatchGenerator
+{
+public:
+	BatchGenerator(const Model& model, uint32_t order, size_t threadsCount)
+		: m_model(model), m_order(order), m_requests(nullptr), m_answers(nullptr), m_count(0), m_next(0), m_running(0), m_round(0), m_stop(false)
+	{
+		for (size_t i = 0; i < max<size_t>(1, threadsCount); ++i)
+			m_states.push_back(model.CreateState(0));
+
+		// Calling thread works with the first state
+		for (size_t i = 1; i < m_states.size(); ++i)
+			m_threads.emplace_back(&BatchGenerator::Work, this, i);
+	}
+
+	~BatchGenerator()
+	{
+		{
+			lock_guard<mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_start.notify_all();
+		for (auto& thread : m_threads)
+			thread.join();
+	}
+
+	// answers[i] is the line for requests[i] with line feed, i < count. Strings of both vectors
+	// are reused from batch to batch, so their memory is allocated only while they grow.
+	void Run(const vector<string>& requests, size_t count, vector<string>& answers)
+	{
+		if (answers.size() < count)
+			answers.resize(count);
+		if (m_threads.empty() || count < 2)
+		{
+			for (size_t i = 0; i < count; ++i)
+				Answer(requests[i], m_states[0], answers[i]);
+			return;
+		}
+
+		{
+			lock_guard<mutex> lock(m_mutex);
+			m_requests = &requests;
+			m_answers = &answers;
+			m_count = count;
+			m_next = 0;
+			m_running = m_threads.size();
+			m_round++;
+		}
+		m_start.notify_all();
+		Process(m_states[0]);
+
+		unique_lock<mutex> lock(m_mutex);
+		m_done.wait(lock, [this] { return m_running == 0; });
+	}
+
+private:
+	typedef typename Model::State State;
+
+	void Work(size_t index)
+	{
+		for (uint64_t round = 0; ; )
+		{
+			{
+				unique_lock<mutex> lock(m_mutex);
+				m_start.wait(lock, [&] { return m_stop || m_round != round; });
+				if (m_stop)
+					return;
+				round = m_round;
+			}
+
+			Process(m_states[index]);
+
+			lock_guard<mutex> lock(m_mutex);
+			if (--m_running == 0)
+				m_done.notify_one();
+		}
+	}
+
+	// Threads take requests one by one until the batch is over
+	void Process(State& state)
+	{
+		for (size_t i = m_next++; i < m_count; i = m_next++)
+			Answer((*m_requests)[i], state, (*m_answers)[i]);
+	}
+
+	// Wrong request gets "Fail: ..." answer, other requests don't suffer
+	void Answer(const string& request, State& state, string& answer) const
+	{
+		answer.clear();
+		try
+		{
+			const char* text = request.c_str();
+			char* end = nullptr;
+			const uint64_t seed = strtoull(text, &end, 10);
+			Check(end == text, "Request should start with seed");
+
+			text = end;
+			const unsigned long count = strtoul(text, &end, 10);
+			Check(end == text || count > numeric_limits<uint32_t>::max(), "Wrong number of words in request");
+
+			text = end + strspn(end, " \t");
+			size_t length = request.c_str() + request.size() - text;
+			if (length != 0 && text[length - 1] == '\r')
+				length--;
+
+			const Vocabulary& vocabulary = *m_model.GetVocabulary();
+			Sentence sentence(Convert(string(text, length)), m_order, vocabulary);
+			state.random.seed(seed);
+
+			answer.reserve(length + count * 8 + 1);
+			answer.append(text, length);
+			for (unsigned long counter = 0; counter < count; ++counter)
+			{
+				WordId nextWord;
+				if (!m_model.GetNextWord(sentence.GetKey(), state, nextWord))
+					break;
+
+				sentence.InsertWord(nextWord);
+				size_t wordLength = 0;
+				const char* word = m_model.GetUtf8Word(nextWord, wordLength);
+				answer += ' ';
+				answer.append(word, wordLength);
+			}
+		}
+		catch (exception& e)
+		{
+			answer = string("Fail: ") + e.what();
+		}
+		answer += '\n';
+	}
+
+	const Model&		   m_model;
+	uint32_t			   m_order;
+	vector<State>		   m_states;
+	vector<thread>		   m_threads;
+
+	const vector<string>*  m_requests;
+	vector<string>*		   m_answers;
+	size_t				   m_count;
+	atomic<size_t>		   m_next;
+	size_t				   m_running;
+	uint64_t			   m_round;
+	bool				   m_stop;
+	mutex				   m_mutex;
+	condition_variable	   m_start;
+	condition_variable	   m_done;
+};
+
+const size_t MaxBatchSize = 4096;
+
+// Requests already read from the stream make one batch, so a client sending requests one by one
+// waits for nothing and a big file of requests goes by big batches
+template <typename Model>
+void ServeStream(BatchGenerator<Model>& generator, istream& input, ostream& output)
+{
+	vector<string> requests(MaxBatchSize), answers;
+	for (;;)
+	{
+		size_t count = 0;
+		while (count < MaxBatchSize && (count == 0 || input.rdbuf()->in_avail() > 0) && getline(input, requests[count]))
+			count++;
+		if (count == 0)
+			break;
+
+		generator.Run(requests, count, answers);
+		for (size_t i = 0; i < count; ++i)
+			output.write(answers[i].data(), answers[i].size());
+		output.flush();
+	}
+}
+
+#ifndef _WIN32
+// Longer line without line feed disconnects the client
+const size_t MaxRequestLength = 64 * 1024;
+
+// Serves clients of unix socket in one thread with epoll, requests of all clients that are ready
+// at once make one batch. Answers go back to every client in order of its requests.
+// Sockets are non-blocking: answers not taken by a client wait in its buffer, and its requests
+// aren't read until the buffer is sent, so a slow client stalls only itself.
+// Serving ends when stopFd gets readable, -1 serves forever.
+template <typename Model>
+void ServeSocket(BatchGenerator<Model>& generator, const string& path, int stopFd = -1)
+{
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	Check(path.size() >= sizeof(address.sun_path), "Socket path is too long");
+	copy(path.begin(), path.end(), address.sun_path);
+
+	int server = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	Check(server == -1, "Can't create socket");
+	unlink(path.c_str());
+	if (bind(server, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(server, SOMAXCONN) != 0)
+	{
+		close(server);
+		throw runtime_error((boost::format("Can't listen socket %1%") % path).str());
+	}
+
+	int epoll = epoll_create1(EPOLL_CLOEXEC);
+	epoll_event event = {};
+	event.events = EPOLLIN;
+	event.data.fd = server;
+	epoll_event stopEvent = {};
+	stopEvent.events = EPOLLIN;
+	stopEvent.data.fd = stopFd;
+	if (epoll == -1 || epoll_ctl(epoll, EPOLL_CTL_ADD, server, &event) != 0 ||
+		(stopFd != -1 && epoll_ctl(epoll, EPOLL_CTL_ADD, stopFd, &stopEvent) != 0))
+	{
+		if (epoll != -1)
+			close(epoll);
+		close(server);
+		throw runtime_error("Can't create epoll");
+	}
+
+	struct Client
+	{
+		string input;	// incomplete last line
+		string output;	// answers not sent yet
+	};
+
+	unordered_map<int, Client> clients;
+	vector<string> requests, answers;
+	vector<int> owners;
+	vector<char> buffer(BufferSize);
+	vector<epoll_event> events(64);
+
+	auto disconnect = [&](int fd)
+	{
+		epoll_ctl(epoll, EPOLL_CTL_DEL, fd, nullptr);
+		close(fd);
+		clients.erase(fd);
+	};
+
+	// Client is watched for reading while its buffer is empty and for writing otherwise
+	auto watch = [&](int fd, uint32_t events)
+	{
+		epoll_event clientEvent = {};
+		clientEvent.events = events;
+		clientEvent.data.fd = fd;
+		if (epoll_ctl(epoll, EPOLL_CTL_MOD, fd, &clientEvent) != 0)
+			disconnect(fd);
+	};
+
+	// Sends as much of the buffer as the socket takes
+	auto flush = [&](int fd, bool watchingOutput)
+	{
+		string& output = clients[fd].output;
+		size_t sent = 0;
+		while (sent < output.size())
+		{
+			ssize_t written = send(fd, output.data() + sent, output.size() - sent, MSG_NOSIGNAL);
+			if (written > 0)
+				sent += written;
+			else if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			else if (errno != EINTR)
+			{
+				disconnect(fd);
+				return;
+			}
+		}
+		output.erase(0, sent);
+		if (output.empty() == watchingOutput)
+			watch(fd, output.empty() ? EPOLLIN : EPOLLOUT);
+	};
+
+	for (bool stopping = false; !stopping; )
+	{
+		int count = epoll_wait(epoll, events.data(), static_cast<int>(events.size()), -1);
+		if (count == -1 && errno == EINTR)
+			continue;
+		Check(count == -1, "epoll_wait failed");
+
+		requests.clear();
+		owners.clear();
+		bool accepting = false;
+		for (int i = 0; i < count; ++i)
+		{
+			int fd = events[i].data.fd;
+			if (fd == server)
+			{
+				accepting = true;
+				continue;
+			}
+			if (fd == stopFd)
+			{
+				stopping = true;
+				continue;
+			}
+			if (clients.count(fd) == 0)
+				continue;
+
+			if (!clients[fd].output.empty())
+			{
+				flush(fd, true);
+				continue;
+			}
+
+			ssize_t readed = read(fd, buffer.data(), buffer.size());
+			if (readed <= 0)
+			{
+				if (readed == 0 || (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK))
+					disconnect(fd);
+				continue;
+			}
+
+			string& pending = clients[fd].input;
+			pending.append(buffer.data(), readed);
+			size_t begin = 0;
+			for (size_t end = pending.find('\n'); end != string::npos; begin = end + 1, end = pending.find('\n', begin))
+			{
+				requests.emplace_back(pending, begin, end - begin);
+				owners.push_back(fd);
+			}
+			pending.erase(0, begin);
+			if (pending.size() > MaxRequestLength)
+				disconnect(fd);
+		}
+
+		generator.Run(requests, requests.size(), answers);
+
+		// Answers of one client are together in the batch, they are sent at once
+		for (size_t i = 0; i < requests.size(); )
+		{
+			int fd = owners[i];
+			auto client = clients.find(fd);
+			for (; i < requests.size() && owners[i] == fd; ++i)
+			{
+				if (client != clients.end())
+					client->second.output += answers[i];
+			}
+			if (client != clients.end())
+				flush(fd, false);
+		}
+
+		// New clients come after answers, so descriptors of clients gone in this round aren't reused yet
+		if (accepting)
+		{
+			int client = accept4(server, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+			event.data.fd = client;
+			if (client != -1 && epoll_ctl(epoll, EPOLL_CTL_ADD, client, &event) == 0)
+				clients[client];
+			else if (client != -1)
+				close(client);
+		}
+	}
+
+	while (!clients.empty())
+		disconnect(clients.begin()->first);
+	close(epoll);
+	close(server);
+	unlink(path.c_str());
+}
+#endif
+
+#endif // BATCH_GENERATOR_H
@@ -1,17 +1,29 @@
 #include <iostream>
-#include <vector>
-#include "../model.h"
-#include "../common.h"
+#include <thread>
+#include "batch_generator.h"
 
-#include <boost\program_options.hpp>
-#include <boost\lexical_cast.hpp>
+#include <boost/program_options.hpp>
+#include <boost/lexical_cast.hpp>
 
 using namespace std;
 
-wstring Convert(const string& str)
+// Model stays in memory and answers requests of stdin or of clients of the socket
+template <typename Model>
+void Serve(const Model& model, uint32_t order, size_t threadsCount, const string& socketPath)
 {
-	wstring_convert<std::codecvt_utf8_utf16<wchar_t>> converter;
-	return converter.from_bytes(str);
+	BatchGenerator<Model> generator(model, order, threadsCount);
+	if (socketPath.empty())
+	{
+		ios::sync_with_stdio(false);
+		ServeStream(generator, cin, cout);
+		return;
+	}
+
+#ifdef _WIN32
+	throw runtime_error("Socket server is supported only on Linux");
+#else
+	ServeSocket(generator, socketPath);
+#endif
 }
 
 int main(int argc, char** argv)
@@ -21,13 +33,40 @@ int main(int argc, char** argv)
 		namespace po = boost::program_options;
 		po::options_description description("Allowed options");
 		description.add_options()("words", po::value<uint32_t>(), "number of words you want to generate")
-			("input", po::value<string>(), "input sequence of words (quantity will be used as order of model)")
-			("model", po::value<string>(), "path to file of model");
+			("input", po::value<string>(), "input sequence of words (quantity will be used as order of model, backoff model takes any quantity)")
+			("model", po::value<string>(), "path to file of model")
+			("seed", po::value<uint64_t>(), "seed of random generator, same seed gives the same text")
+			("batch", "answer requests \"<seed> <words> <prompt>\" of stdin line by line, model is loaded once")
+			("socket", po::value<string>(), "answer requests of clients of this unix socket, like in batch mode")
+			("order", po::value<uint32_t>(), "order of model for batch and socket modes, backoff model knows its order")
+			("threads", po::value<uint32_t>()->default_value(thread::hardware_concurrency()), "threads answering requests in batch and socket modes");
 
 		po::variables_map vm;
 		po::store(po::parse_command_line(argc, argv, description), vm);
 		po::notify(vm);
 
+		if (vm.count("batch") != 0 || vm.count("socket") != 0)
+		{
+			Check(vm["model"].empty(), "Model is required");
+			string pathToModel = vm["model"].as<string>();
+			string socketPath = vm["socket"].empty() ? string() : vm["socket"].as<string>();
+			size_t threadsCount = vm["threads"].as<uint32_t>();
+
+			if (BackoffModelView::IsBackoffModel(pathToModel))
+			{
+				BackoffModelView model(pathToModel);
+				Serve(model, model.GetOrder(), threadsCount, socketPath);
+			}
+			else
+			{
+				Check(vm["order"].empty(), "Order of model is required");
+				uint32_t order = vm["order"].as<uint32_t>();
+				MarkovChainView model(pathToModel, order);
+				Serve(model, order, threadsCount, socketPath);
+			}
+			return 0;
+		}
+
 		if (vm["input"].empty() || vm["words"].empty() || vm["model"].empty())
 		{
 			cout << description << endl;
@@ -43,28 +82,28 @@ int main(int argc, char** argv)
 		uint32_t order = words.size();
 		string pathToModel = vm["model"].as<string>();
 
-		wstring currentSentence;
 		wstring resultText;
 		resultText += beginSentence;
 
-		uint32_t counter = 0;
-		MarkovChainView model(pathToModel, order);
-
-		Sentence s(beginSentence, order);
-		while (counter < k)
+		// Backoff model has its own order, prompt of any length is a key for it
+		uint64_t seed = vm["seed"].empty() ? random_device()() : vm["seed"].as<uint64_t>();
+		if (BackoffModelView::IsBackoffModel(pathToModel))
 		{
-			wstring nextWord;
-			if (!model.GetNextWord(s.GetKey(), nextWord))
-				break;
-
-			s.InsertWord(nextWord);
-			resultText += L" ";
-			resultText += nextWord;
-
-			counter++;
+			BackoffModelView model(pathToModel, seed);
+			Generate(model, beginSentence, model.GetOrder(), k, resultText);
+		}
+		else
+		{
+			MarkovChainView model(pathToModel, order, seed);
+			Generate(model, beginSentence, order, k, resultText);
 		}
 
+#ifdef _WIN32
 		wcout << resultText << endl;
+#else
+		// Same UTF-8 as answers of batch mode, wide stream would convert by locale of the process
+		cout << Convert(resultText) << endl;
+#endif
 	}
 	catch (exception& e)
 	{
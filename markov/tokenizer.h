@@ -0,0 +1,73 @@
+#ifndef TOKENIZER_H
+#define TOKENIZER_H
+
+#include "common.h"
+#include <cwctype>
+
+// Splits text given by chunks of any size into words separated by spaces.
+// Word cut by the end of a chunk is kept until its rest comes with the next chunk,
+// other words are passed right from the chunk without copying.
+class Tokenizer
+{
+public:
+	// Calls func(word, length) for every complete word
+	template <typename Func>
+	void Write(const wchar_t* text, size_t size, Func func)
+	{
+		const wchar_t* end = text + size;
+		const wchar_t* current = text;
+
+		if (!m_word.empty())
+		{
+			const wchar_t* wordEnd = find_if(current, end, IsSpace);
+			m_word.append(current, wordEnd);
+			if (wordEnd == end)
+				return;
+
+			func(m_word.data(), m_word.size());
+			m_word.clear();
+			current = wordEnd;
+		}
+
+		for (;;)
+		{
+			current = find_if_not(current, end, IsSpace);
+			if (current == end)
+				return;
+
+			const wchar_t* wordEnd = find_if(current, end, IsSpace);
+			if (wordEnd == end)
+			{
+				m_word.assign(current, end);
+				return;
+			}
+
+			func(current, wordEnd - current);
+			current = wordEnd;
+		}
+	}
+
+	// End of text, the last word is complete
+	template <typename Func>
+	void Close(Func func)
+	{
+		if (!m_word.empty())
+			func(m_word.data(), m_word.size());
+		m_word.clear();
+	}
+
+	void Reset()
+	{
+		m_word.clear();
+	}
+
+private:
+	static bool IsSpace(wchar_t c)
+	{
+		return iswspace(c) != 0;
+	}
+
+	wstring m_word;
+};
+
+#endif // TOKENIZER_H
@@ -0,0 +1,377 @@
+#ifndef UTF8_TOKENIZER_H
+#define UTF8_TOKENIZER_H
+
+#include "common.h"
+#include <cstdint>
+#include <cwctype>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define UTF8_TOKENIZER_SSE2
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Normalizes UTF-8 text given by chunks and splits it into words in one pass: letters are lowercased,
+// apostrophes are kept, whitespace separates words and everything else is dropped.
+// ASCII is classified 16 bytes at once with SSE2, Latin, Greek and Cyrillic letters by a table,
+// letters of other scripts are kept as is. Words are passed as spans of the decoded chunk,
+// a word or UTF-8 sequence cut by the end of a chunk waits for the next one.
+class Utf8Tokenizer
+{
+public:
+	Utf8Tokenizer() : m_length(0), m_pendingSize(0)
+	{
+	}
+
+	// Calls func(word, length) for every complete word
+	template <typename Func>
+	void Write(const char* text, size_t size, Func func)
+	{
+		const unsigned char* data = reinterpret_cast<const unsigned char*>(text);
+		const unsigned char* end = data + size;
+
+		// Every byte gives at most one character, sequence completed from previous chunk gives two at most
+		if (m_text.size() < m_length + size + 2)
+			m_text.resize(m_length + size + 2);
+
+		m_position = m_length;
+		m_wordStart = 0;
+
+		if (m_pendingSize != 0)
+		{
+			size_t taken = 0;
+			for (; m_pendingSize < sizeof(m_pending) && data != end && !IsComplete(m_pending, m_pendingSize); ++taken)
+				m_pending[m_pendingSize++] = *data++;
+			if (!IsComplete(m_pending, m_pendingSize))
+			{
+				m_length = m_position;
+				return;
+			}
+
+			uint32_t codePoint;
+			size_t length = Decode(m_pending, m_pendingSize, codePoint);
+			AddCodePoint(codePoint, func);
+
+			// Invalid sequence takes one byte, the rest of this chunk is decoded again.
+			// Bytes of previous chunk are continuation bytes, they would be dropped anyway.
+			data -= min(taken, m_pendingSize - length);
+			m_pendingSize = 0;
+		}
+
+		while (data != end)
+		{
+#ifdef UTF8_TOKENIZER_SSE2
+			if (end - data >= 16 && AddAsciiBlock(data, func))
+			{
+				data += 16;
+				continue;
+			}
+#endif
+			if (*data < 0x80)
+			{
+				AddCharacter(GetTable()[*data++], func);
+				continue;
+			}
+
+			if (!IsComplete(data, end - data))
+			{
+				m_pendingSize = end - data;
+				copy(data, end, m_pending);
+				break;
+			}
+
+			uint32_t codePoint;
+			data += Decode(data, end - data, codePoint);
+			AddCodePoint(codePoint, func);
+		}
+
+		// Incomplete word is moved to the beginning for the next chunk
+		m_length = m_position - m_wordStart;
+		copy(m_text.begin() + m_wordStart, m_text.begin() + m_position, m_text.begin());
+	}
+
+	// End of text, the last word is complete and incomplete UTF-8 sequence is dropped
+	template <typename Func>
+	void Close(Func func)
+	{
+		if (m_length != 0)
+			func(m_text.data(), m_length);
+		Reset();
+	}
+
+	void Reset()
+	{
+		m_length = 0;
+		m_pendingSize = 0;
+	}
+
+private:
+	static const wchar_t Dropped = 0;
+	static const wchar_t Separator = L' ';
+
+	template <typename Func>
+	void AddCharacter(wchar_t c, Func& func)
+	{
+		if (c == Dropped)
+			return;
+		if (c == Separator)
+		{
+			EndWord(m_position, func);
+			return;
+		}
+		m_text[m_position++] = c;
+	}
+
+	template <typename Func>
+	void AddCodePoint(uint32_t codePoint, Func& func)
+	{
+		if (codePoint < TableSize)
+		{
+			AddCharacter(GetTable()[codePoint], func);
+			return;
+		}
+
+		wchar_t c = Classify(codePoint);
+		if (c != Dropped && c != Separator && codePoint > 0xFFFF && sizeof(wchar_t) == 2)
+		{
+			// Surrogate pair for UTF-16 wchar_t
+			codePoint -= 0x10000;
+			m_text[m_position++] = static_cast<wchar_t>(0xD800 + (codePoint >> 10));
+			m_text[m_position++] = static_cast<wchar_t>(0xDC00 + (codePoint & 0x3FF));
+			return;
+		}
+		AddCharacter(c, func);
+	}
+
+	// Word is [m_wordStart, position), next one starts after the separator
+	template <typename Func>
+	void EndWord(size_t position, Func& func)
+	{
+		if (position > m_wordStart)
+			func(m_text.data() + m_wordStart, position - m_wordStart);
+		m_wordStart = position + 1;
+		m_position = max(m_position, m_wordStart);
+	}
+
+#ifdef UTF8_TOKENIZER_SSE2
+	// False if the block is not ASCII. Block without characters to drop is stored at once
+	// with separators in place, words between them are passed right from the buffer.
+	template <typename Func>
+	bool AddAsciiBlock(const unsigned char* data, Func& func)
+	{
+		const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+		if (_mm_movemask_epi8(block) != 0)
+			return false;
+
+		const __m128i isUpper = _mm_and_si128(_mm_cmpgt_epi8(block, _mm_set1_epi8('A' - 1)), _mm_cmplt_epi8(block, _mm_set1_epi8('Z' + 1)));
+		const __m128i lowered = _mm_or_si128(block, _mm_and_si128(isUpper, _mm_set1_epi8(0x20)));
+		const __m128i isLetter = _mm_and_si128(_mm_cmpgt_epi8(lowered, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(lowered, _mm_set1_epi8('z' + 1)));
+		const __m128i isSpace = _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8(' ')),
+			_mm_and_si128(_mm_cmpgt_epi8(block, _mm_set1_epi8('\t' - 1)), _mm_cmplt_epi8(block, _mm_set1_epi8('\r' + 1))));
+		const __m128i isKept = _mm_or_si128(_mm_or_si128(isLetter, isSpace), _mm_cmpeq_epi8(block, _mm_set1_epi8('\'')));
+
+		if (_mm_movemask_epi8(isKept) != 0xFFFF)
+		{
+			alignas(16) unsigned char bytes[16];
+			_mm_store_si128(reinterpret_cast<__m128i*>(bytes), lowered);
+			for (size_t i = 0; i < 16; ++i)
+				AddCharacter(GetTable()[bytes[i]], func);
+			return true;
+		}
+
+		const size_t position = m_position;
+		StoreWide(lowered, &m_text[position]);
+		m_position += 16;
+		for (uint32_t spaces = _mm_movemask_epi8(isSpace); spaces != 0; spaces &= spaces - 1)
+			EndWord(position + CountTrailingZeros(spaces), func);
+		return true;
+	}
+
+	// Zero extends 16 ASCII bytes to wchar_t
+	static void StoreWide(__m128i block, wchar_t* output)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i low = _mm_unpacklo_epi8(block, zero), high = _mm_unpackhi_epi8(block, zero);
+		if (sizeof(wchar_t) == 2)
+		{
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(output), low);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(output + 8), high);
+			return;
+		}
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(output), _mm_unpacklo_epi16(low, zero));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(output + 4), _mm_unpackhi_epi16(low, zero));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(output + 8), _mm_unpacklo_epi16(high, zero));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(output + 12), _mm_unpackhi_epi16(high, zero));
+	}
+
+	static uint32_t CountTrailingZeros(uint32_t value)
+	{
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanForward(&index, value);
+		return index;
+#else
+		return __builtin_ctz(value);
+#endif
+	}
+#endif
+
+	static size_t GetSequenceLength(unsigned char lead)
+	{
+		return lead < 0xC2 ? 1 : lead < 0xE0 ? 2 : lead < 0xF0 ? 3 : lead < 0xF5 ? 4 : 1;
+	}
+
+	// False if more bytes are needed to decode the first character
+	static bool IsComplete(const unsigned char* data, size_t size)
+	{
+		const size_t length = GetSequenceLength(data[0]);
+		for (size_t i = 1; i < length && i < size; ++i)
+		{
+			if ((data[i] & 0xC0) != 0x80)
+				return true;
+		}
+		return size >= length;
+	}
+
+	// Length of the first character in bytes, invalid or overlong sequence is one byte
+	// of a character that is dropped
+	static size_t Decode(const unsigned char* data, size_t size, uint32_t& codePoint)
+	{
+		static const uint32_t MinCodePoints[] = { 0, 0, 0x80, 0x800, 0x10000 };
+
+		const size_t length = GetSequenceLength(data[0]);
+		codePoint = length == 1 ? data[0] : data[0] & (0x7F >> length);
+		if (length == 1)
+		{
+			if (data[0] >= 0x80)
+				codePoint = InvalidCodePoint;
+			return 1;
+		}
+
+		for (size_t i = 1; i < length; ++i)
+		{
+			if (i >= size || (data[i] & 0xC0) != 0x80)
+			{
+				codePoint = InvalidCodePoint;
+				return 1;
+			}
+			codePoint = (codePoint << 6) | (data[i] & 0x3F);
+		}
+
+		if (codePoint < MinCodePoints[length] || codePoint > 0x10FFFF || (codePoint >= 0xD800 && codePoint <= 0xDFFF))
+		{
+			codePoint = InvalidCodePoint;
+			return 1;
+		}
+		return length;
+	}
+
+	// Characters outside of the table: spaces and punctuation blocks are known,
+	// the rest is letters of other scripts. Symbols and emoji of plane 1 are dropped,
+	// CJK ideographs of planes 2 and 3 are kept.
+	static wchar_t Classify(uint32_t codePoint)
+	{
+		if (codePoint == InvalidCodePoint)
+			return Dropped;
+		if (codePoint == 0x2018 || codePoint == 0x2019)
+			return L'\'';
+		if ((codePoint >= 0x2000 && codePoint <= 0x200A) || codePoint == 0x2028 || codePoint == 0x2029 ||
+			codePoint == 0x202F || codePoint == 0x205F || codePoint == 0x3000)
+			return Separator;
+		if ((codePoint >= 0x200B && codePoint <= 0x2BFF) || (codePoint >= 0x3000 && codePoint <= 0x303F) ||
+			(codePoint >= 0xE000 && codePoint <= 0xF8FF) || (codePoint >= 0xFE00 && codePoint <= 0xFE6F) ||
+			(codePoint >= 0xFF00 && codePoint <= 0xFF20) || codePoint == 0xFEFF ||
+			(codePoint >= 0x1F000 && codePoint <= 0x1FFFF) || codePoint >= 0xE0000)
+			return Dropped;
+
+		wchar_t c = static_cast<wchar_t>(codePoint);
+		return codePoint <= 0xFFFF && iswupper(c) ? static_cast<wchar_t>(towlower(c)) : c;
+	}
+
+	static const uint32_t TableSize = 0x500;
+	static const uint32_t InvalidCodePoint = 0xFFFFFFFF;
+
+	// Lowercased letter, Separator or Dropped for code points up to the end of Cyrillic block
+	static const wchar_t* GetTable()
+	{
+		static const vector<wchar_t> table = []()
+		{
+			vector<wchar_t> result(TableSize, wchar_t(Dropped));
+			auto letters = [&](uint32_t first, uint32_t last, uint32_t shift)
+			{
+				for (uint32_t c = first; c <= last; ++c)
+					result[c] = static_cast<wchar_t>(c + shift);
+			};
+			// Upper and lower case letters go in pairs, upper one is at even or odd code point
+			auto pairs = [&](uint32_t first, uint32_t last)
+			{
+				for (uint32_t c = first; c <= last; c += 2)
+				{
+					result[c] = static_cast<wchar_t>(c + 1);
+					result[c + 1] = static_cast<wchar_t>(c + 1);
+				}
+			};
+
+			for (uint32_t c : { 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x20, 0x85, 0xA0 })
+				result[c] = Separator;
+			result['\''] = L'\'';
+			result[0x2BC] = L'\'';
+
+			letters('A', 'Z', 0x20);
+			letters('a', 'z', 0);
+			letters(0xC0, 0xDE, 0x20);
+			letters(0xDF, 0xFF, 0);
+			result[0xD7] = result[0xF7] = Dropped;
+			result[0xAA] = 0xAA;
+			result[0xB5] = 0xB5;
+			result[0xBA] = 0xBA;
+
+			pairs(0x100, 0x137);
+			result[0x138] = 0x138;
+			pairs(0x139, 0x148);
+			result[0x149] = 0x149;
+			pairs(0x14A, 0x177);
+			result[0x178] = 0xFF;
+			pairs(0x179, 0x17E);
+			result[0x17F] = 0x17F;
+			letters(0x180, 0x24F, 0);
+			letters(0x250, 0x2AF, 0);
+
+			letters(0x391, 0x3A9, 0x20);
+			result[0x3A2] = Dropped;
+			letters(0x3AC, 0x3CE, 0);
+			result[0x386] = 0x3AC;
+			letters(0x388, 0x38A, 0x25);
+			result[0x38C] = 0x3CC;
+			letters(0x38E, 0x38F, 0x3F);
+			result[0x390] = 0x390;
+
+			letters(0x400, 0x40F, 0x50);
+			letters(0x410, 0x42F, 0x20);
+			letters(0x430, 0x45F, 0);
+			pairs(0x460, 0x481);
+			pairs(0x48A, 0x4BF);
+			result[0x4C0] = 0x4CF;
+			pairs(0x4C1, 0x4CE);
+			result[0x4CF] = 0x4CF;
+			pairs(0x4D0, 0x4FF);
+			return result;
+		}();
+		return table.data();
+	}
+
+	// Decoded characters: incomplete word of previous chunk and then the current chunk
+	vector<wchar_t> m_text;
+	size_t m_length;
+	size_t m_position;
+	size_t m_wordStart;
+
+	// Bytes of UTF-8 sequence cut by the end of the chunk
+	unsigned char m_pending[4];
+	size_t m_pendingSize;
+};
+
+#endif // UTF8_TOKENIZER_H
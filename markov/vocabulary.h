@@ -0,0 +1,121 @@
+#ifndef VOCABULARY_H
+#define VOCABULARY_H
+
+#include "common.h"
+#include <cstdint>
+#include <limits>
+
+// Interned words: every distinct word is stored once in a contiguous pool and gets a 32-bit id.
+// One vocabulary is shared by models, sentences and views, so everything else works with ids only.
+class Vocabulary
+{
+public:
+	static const WordId Unknown = numeric_limits<WordId>::max();
+
+	Vocabulary() : m_offsets(1, 0), m_size(0)
+	{
+	}
+
+	// Id of the word, new id is assigned if word is seen first time
+	WordId Add(const wchar_t* word, size_t length)
+	{
+		if ((m_size + 1) * 2 > m_index.size())
+			Grow();
+
+		size_t slot = FindSlot(word, length);
+		if (m_index[slot] == Unknown)
+		{
+			m_index[slot] = static_cast<WordId>(m_size++);
+			m_pool.insert(m_pool.end(), word, word + length);
+			m_offsets.push_back(m_pool.size());
+		}
+		return m_index[slot];
+	}
+
+	WordId Add(const wstring& word)
+	{
+		return Add(word.data(), word.length());
+	}
+
+	// Unknown if word is absent
+	WordId Find(const wchar_t* word, size_t length) const
+	{
+		return m_size != 0 ? m_index[FindSlot(word, length)] : Unknown;
+	}
+
+	WordId Find(const wstring& word) const
+	{
+		return Find(word.data(), word.length());
+	}
+
+	size_t GetSize() const
+	{
+		return m_size;
+	}
+
+	// Word is not null terminated
+	const wchar_t* GetData(WordId id) const
+	{
+		return m_pool.data() + m_offsets[id];
+	}
+
+	size_t GetLength(WordId id) const
+	{
+		return m_offsets[id + 1] - m_offsets[id];
+	}
+
+	wstring GetWord(WordId id) const
+	{
+		return wstring(GetData(id), GetLength(id));
+	}
+
+	// Heap memory of pool and index in bytes
+	size_t GetMemoryUsage() const
+	{
+		return m_pool.capacity() * sizeof(wchar_t) + m_offsets.capacity() * sizeof(size_t) + m_index.capacity() * sizeof(WordId);
+	}
+
+	void Clear()
+	{
+		m_pool.clear();
+		m_offsets.assign(1, 0);
+		m_index.clear();
+		m_size = 0;
+	}
+
+private:
+	size_t Hash(const wchar_t* word, size_t length) const
+	{
+		uint64_t hash = 14695981039346656037ULL;
+		for (size_t i = 0; i < length; ++i)
+			hash = (hash ^ static_cast<uint32_t>(word[i])) * 1099511628211ULL;
+		return static_cast<size_t>(hash ^ (hash >> 29));
+	}
+
+	// Slot of the word or empty slot where it should be inserted
+	size_t FindSlot(const wchar_t* word, size_t length) const
+	{
+		const size_t mask = m_index.size() - 1;
+		for (size_t slot = Hash(word, length) & mask; ; slot = (slot + 1) & mask)
+		{
+			WordId id = m_index[slot];
+			if (id == Unknown || (GetLength(id) == length && equal(word, word + length, GetData(id))))
+				return slot;
+		}
+	}
+
+	// Capacity is always a power of two, index is at most half full
+	void Grow()
+	{
+		m_index.assign(max<size_t>(16, m_index.size() * 2), WordId(Unknown));
+		for (WordId id = 0; id < m_size; ++id)
+			m_index[FindSlot(GetData(id), GetLength(id))] = id;
+	}
+
+	vector<wchar_t> m_pool;
+	vector<size_t>	m_offsets;
+	vector<WordId>	m_index;
+	size_t			m_size;
+};
+
+#endif // VOCABULARY_H